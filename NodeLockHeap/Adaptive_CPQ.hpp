@@ -0,0 +1,270 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	Adaptive Concurrent Priority Queue
+ *
+ *	Runs in one of two modes on the same heap array as the CPQ:
+ *
+ *		COARSE	every operation holds heap_lock for its whole duration and
+ *				works on the heap sequentially: no node locks, no tags of
+ *				the owner and no thread count
+ *		FINE	the node-locked protocol of the CPQ
+ *
+ *	Every operation samples whether it was contended while it holds
+ *	heap_lock: in COARSE mode if it had to wait for heap_lock (longer than
+ *	contended_ns), in FINE mode if another operation was still in the heap.
+ *	At the end of every window of operations the holder of heap_lock
+ *	switches to FINE if the contended fraction reached to_fine, or back to
+ *	COARSE if it dropped to to_coarse.
+ *
+ *	Both switches are made at a quiescent point: COARSE operations never
+ *	overlap, and before switching to COARSE the switching thread drains the
+ *	heap like the growth path does (heap_lock is held, so no operation can
+ *	enter and all operations in the heap finish with the FINE protocol).
+ *	Both modes keep the tags EMPTY and AVAILABLE of the CPQ, so the heap is
+ *	valid for either mode at the switch.
+ *
+ *	The CPQ is a private base: its insert and pop_front are not virtual and
+ *	would run the FINE protocol in COARSE mode if they could be called
+ *	through a CPQ reference. Only the read-only members are public.
+ */
+
+#ifndef ADAPTIVE_CPQ_HPP
+#define ADAPTIVE_CPQ_HPP
+
+#include "CPQ.hpp"
+#include "histogram.hpp"
+
+template< class value_t,  class lock_t = omp_lock,
+		  class counter_t = Bit_reversed_counter>
+class Adaptive_CPQ : private CPQ<value_t, lock_t, counter_t>
+{
+	typedef CPQ<value_t, lock_t, counter_t> base_t;
+
+public:
+	enum Mode { COARSE, FINE };
+
+	using base_t::empty;
+	using base_t::size;
+	using base_t::stats;
+	using base_t::write_timeline;
+
+	/* Constructor (starts in COARSE mode) */
+	Adaptive_CPQ(double to_fine = 0.5, double to_coarse = 0.1,
+				 std::size_t window = 1024, double contended_ns = 200)
+		: mode_(COARSE), to_fine_(to_fine), to_coarse_(to_coarse), window_(window),
+		  contended_ticks_(std::uint64_t(contended_ns / Latency_clock::ns_per_tick())),
+		  samples_(0), contended_(0), switches_(0)
+	{}
+
+	/**
+	 *	insert: Inserts an element (value, priority) into the priority queue
+	 */
+	void insert(value_t value, std::size_t priority)
+	{
+		this->tracer_.begin(Trace_event::INSERT);
+
+		if (lock_and_adapt() == FINE)
+			this->insert_locked(value, priority);
+		else
+		{
+			insert_sequential(value, priority);
+			this->unlock_global();
+		}
+
+		this->tracer_.end(Trace_event::INSERT);
+	}
+
+	/**
+	 *	pop_front: 	Assigns the value of the first element in the queue to
+	 *				the parameter value. Returns false if the assignement failed.
+	 */
+	bool pop_front(value_t& value)
+	{
+		std::size_t priority;
+		return pop_front(value, priority);
+	}
+
+	/* pop_front which also returns the priority of the element */
+	bool pop_front(value_t& value, std::size_t& priority)
+	{
+		this->tracer_.begin(Trace_event::POP);
+		bool success;
+
+		if (lock_and_adapt() == FINE)
+			success = this->pop_front_locked(value, priority);
+		else
+		{
+			success = pop_front_sequential(value, priority);
+			this->unlock_global();
+		}
+
+		this->tracer_.end(Trace_event::POP);
+		return success;
+	}
+
+	/**
+	 *	pop_if:	Pops the first element if pred(value, priority) holds for it,
+	 *			see CPQ::pop_if. In COARSE mode the root is only protected
+	 *			by heap_lock, hence it is always checked with heap_lock held.
+	 */
+	template< class pred_t >
+	bool pop_if(pred_t pred, value_t& value, std::size_t& priority)
+	{
+		this->tracer_.begin(Trace_event::POP);
+		bool success;
+
+		if (lock_and_adapt() == FINE)
+			success = this->pop_if_locked(pred, value, priority);
+		else
+		{
+			success = !this->empty() &&
+					  pred(this->node(ROOT).value(), this->node(ROOT).priority()) &&
+					  pop_front_sequential(value, priority);
+			this->unlock_global();
+		}
+
+		this->tracer_.end(Trace_event::POP);
+		return success;
+	}
+
+	template< class pred_t >
+	bool pop_if(pred_t pred, value_t& value)
+	{
+		std::size_t priority;
+		return pop_if(pred, value, priority);
+	}
+
+	/* Pops the first element if its priority is at least threshold */
+	inline bool pop_front_if_priority_at_least(std::size_t threshold, value_t& value)
+	{
+		std::size_t priority;
+		return pop_if(Priority_at_least(threshold), value, priority);
+	}
+
+	/* Mode and number of mode switches (only exact while no thread is in the queue) */
+	inline Mode mode() const { return Mode(mode_); }
+	inline std::size_t switches() const { return switches_; }
+
+private:
+	/* Acquires heap_lock, samples the contention and returns the mode to use */
+	inline Mode lock_and_adapt()
+	{
+		std::uint64_t start = Latency_clock::now();
+		this->lock_global();
+
+		bool contended = mode_ == FINE
+			? this->thread_count_.load(std::memory_order_relaxed) > 0
+			: Latency_clock::now() - start > contended_ticks_;
+
+		contended_ += contended;
+		if (++samples_ == window_)
+			adapt();
+
+		return Mode(mode_);
+	}
+
+	// Called with heap_lock held at the end of a window
+	void adapt()
+	{
+		double fraction = double(contended_) / samples_;
+		samples_ = contended_ = 0;
+
+		if (mode_ == COARSE && fraction >= to_fine_)
+		{
+			mode_ = FINE;
+			++switches_;
+		}
+		else if (mode_ == FINE && fraction <= to_coarse_)
+		{
+			this->drain();
+			mode_ = COARSE;
+			++switches_;
+		}
+	}
+
+	void insert_sequential(value_t value, std::size_t priority)
+	{
+		this->check_capacity();
+		
+		std::size_t child = this->size_.increment();
+
+		// No thread is in the heap, the drain of grow() returns immediately
+		if (this->size() == this->capacity_)
+			this->grow();
+
+		this->node(child).init(value, priority, AVAILABLE);
+
+		while (child > ROOT)
+		{
+			std::size_t parent = Heap_layout::parent(child);
+			this->stats_.add(CPQ_stats::SIFT_UP_LEVELS);
+
+			if (this->node(child).priority() <= this->node(parent).priority())
+				break;
+
+			this->node(child).swap(this->node(parent));
+			this->stats_.add(CPQ_stats::SWAPS);
+			child = parent;
+		}
+	}
+
+	bool pop_front_sequential(value_t& value, std::size_t& priority)
+	{
+		if (this->empty())
+			return false;
+
+		std::size_t bottom = this->size_.decrement();
+
+		value_t value_bottom = this->node(bottom).value();
+		std::size_t priority_bottom = this->node(bottom).priority();
+		this->node(bottom).set_tag(EMPTY);
+
+		value = this->node(ROOT).value();
+		priority = this->node(ROOT).priority();
+
+		// The bottom element was the root
+		if (this->node(ROOT).tag() == EMPTY)
+			return true;
+
+		this->node(ROOT).init(value_bottom, priority_bottom, AVAILABLE);
+
+		std::size_t parent = ROOT;
+		while (Heap_layout::left(parent) <= this->capacity_-1)
+		{
+			std::size_t left = Heap_layout::left(parent);
+			std::size_t right = Heap_layout::right(parent);
+			this->stats_.add(CPQ_stats::SIFT_DOWN_LEVELS);
+
+			if (this->node(left).tag() == EMPTY)
+				break;
+
+			std::size_t child = (this->node(right).tag() == EMPTY ||
+								 this->node(left).priority() > this->node(right).priority())
+								? left : right;
+
+			if (this->node(child).priority() <= this->node(parent).priority())
+				break;
+
+			this->node(child).swap(this->node(parent));
+			this->stats_.add(CPQ_stats::SWAPS);
+			parent = child;
+		}
+		return true;
+	}
+
+	using base_t::ROOT;
+
+	// Written only with heap_lock held
+	int mode_;
+	double to_fine_;
+	double to_coarse_;
+	std::size_t window_;
+	std::uint64_t contended_ticks_;
+	std::size_t samples_;
+	std::size_t contended_;
+	std::size_t switches_;
+};
+
+#endif // ADAPTIVE_CPQ_HPP
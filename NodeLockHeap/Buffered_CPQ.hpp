@@ -0,0 +1,224 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	CPQ with a small sorted buffer in front of the root. The buffer holds
+ *	(about) the capacity elements of highest priority in two contiguous
+ *	arrays, the priorities in increasing order and the values alongside:
+ *
+ *		- pop_front takes the last element of the buffer, without a sift
+ *		  down. Once the buffer is empty it is refilled from the heap with a
+ *		  batch of capacity/2 pops.
+ *		- An insert which beats the minimum of the buffer is merged into it,
+ *		  if the buffer is full its minimum moves to the heap. Every other
+ *		  insert goes to the heap.
+ *
+ *	The buffer is protected by buffer_lock, the minimum is published in an
+ *	atomic, so the inserts into the heap do not take buffer_lock. Such an
+ *	insert may race with a refill and end up above the minimum of the
+ *	buffer. Hence an insert into the heap which finds the buffer empty or
+ *	its element above the minimum once it is done raises a flag, and the
+ *	next pop moves the roots of the heap above the minimum into the buffer
+ *	(CPQ::pop_if) before it takes the last element. The flag is cleared
+ *	before the roots are checked, an insert finishing in between raises it
+ *	again.
+ *
+ *	All pops hold buffer_lock, including the refill, the evictions of a
+ *	full buffer and the moves from the heap, which take heap_lock. The pops
+ *	are therefore serialized: the buffer cuts the latency of a single (or a
+ *	few) consumers fed by many producers. With many consumers the plain CPQ,
+ *	whose pops only meet at the root, scales better.
+ *
+ *	The insertion point is found by counting the smaller priorities, a loop
+ *	without branches which the compiler vectorizes.
+ */
+
+#ifndef BUFFERED_CPQ_HPP
+#define BUFFERED_CPQ_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "CPQ.hpp"
+
+template< class value_t,  class lock_t = omp_lock,
+		  class counter_t = Bit_reversed_counter, std::size_t capacity = 64>
+class Buffered_CPQ
+{
+public:
+	static_assert(capacity >= 2, "the buffer is refilled with capacity/2 elements");
+
+	/* Constructor */
+	Buffered_CPQ()
+		: count_(0), minimum_(NONE), buffered_(0), heap_inserted_(false)
+	{}
+
+	/**
+	 *	insert: Inserts an element (value, priority) into the priority queue
+	 */
+	void insert(value_t value, std::size_t priority)
+	{
+		if (priority > minimum_.load(std::memory_order_relaxed))
+		{
+			buffer_lock_.lock();
+			if (count_ > 0 && priority > priorities_[0])
+			{
+				merge(value, priority);
+				buffer_lock_.unlock();
+				return;
+			}
+			buffer_lock_.unlock();
+		}
+		heap_.insert(value, priority);
+
+		// A refill may have run meanwhile, the element can be above the new
+		// minimum. The flag is only written if it changes, the inserts share
+		// the cacheline for reading.
+		std::size_t minimum = minimum_.load(std::memory_order_relaxed);
+		if ((minimum == NONE || priority > minimum) &&
+			!heap_inserted_.load(std::memory_order_relaxed))
+			heap_inserted_.store(true, std::memory_order_release);
+	}
+
+	/**
+	 *	pop_front: 	Assigns the value of the first element in the queue to
+	 *				the parameter value. Returns false if the assignement failed.
+	 */
+	bool pop_front(value_t& value)
+	{
+		std::size_t priority;
+		return pop_front(value, priority);
+	}
+
+	/* pop_front which also returns the priority of the element */
+	bool pop_front(value_t& value, std::size_t& priority)
+	{
+		buffer_lock_.lock();
+
+		if (count_ == 0)
+			refill();
+
+		bool success = count_ > 0;
+		if (success)
+		{
+			// Inserts into the heap raced with the refill
+			if (heap_inserted())
+				pull_heap_above_minimum();
+
+			--count_;
+			value = values_[count_];
+			priority = priorities_[count_];
+			publish();
+		}
+
+		buffer_lock_.unlock();
+		return success;
+	}
+
+	inline bool empty() const { return size() == 0; }
+	inline std::size_t size() const
+	{
+		return heap_.size() + buffered_.load(std::memory_order_relaxed);
+	}
+
+	/* Elements in the front buffer */
+	inline std::size_t buffered() const { return buffered_.load(std::memory_order_relaxed); }
+
+private:
+	Buffered_CPQ(const Buffered_CPQ&);
+	Buffered_CPQ& operator=(const Buffered_CPQ&);
+
+	// Minimum while the buffer is empty, no insert goes to the buffer
+	static const std::size_t NONE = std::numeric_limits<std::size_t>::max();
+
+	// Called with buffer_lock held, the element beats the minimum
+	void merge(value_t value, std::size_t priority)
+	{
+		if (count_ == capacity)
+		{
+			heap_.insert(values_[0], priorities_[0]);
+			std::copy(priorities_ + 1, priorities_ + count_, priorities_);
+			std::copy(values_ + 1, values_ + count_, values_);
+			--count_;
+		}
+
+		std::size_t position = 0;
+		for (std::size_t i = 0; i < count_; ++i)
+			position += priorities_[i] < priority;
+
+		std::copy_backward(priorities_ + position, priorities_ + count_, priorities_ + count_ + 1);
+		std::copy_backward(values_ + position, values_ + count_, values_ + count_ + 1);
+		priorities_[position] = priority;
+		values_[position] = value;
+		++count_;
+
+		publish();
+	}
+
+	// Called with buffer_lock held on an empty buffer. The heap pops come in
+	// decreasing order, the buffer is filled from the back.
+	void refill()
+	{
+		value_t values[capacity / 2];
+		std::size_t priorities[capacity / 2];
+
+		std::size_t n = 0;
+		while (n < capacity / 2 && heap_.pop_front(values[n], priorities[n]))
+			++n;
+
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			values_[i] = values[n-1 - i];
+			priorities_[i] = priorities[n-1 - i];
+		}
+		count_ = n;
+
+		publish();
+	}
+
+	// Clears the flag, it is raised again by the inserts finishing after
+	inline bool heap_inserted()
+	{
+		return heap_inserted_.load(std::memory_order_relaxed) &&
+			   heap_inserted_.exchange(false, std::memory_order_acquire);
+	}
+
+	// Called with buffer_lock held on a non-empty buffer. Moves the roots of
+	// the heap above the minimum into the buffer, a full buffer evicts its
+	// minimum, which stays below the threshold of the next check.
+	void pull_heap_above_minimum()
+	{
+		value_t value;
+		std::size_t priority;
+
+		while (priorities_[0] != NONE &&
+			   heap_.pop_if(Priority_at_least(priorities_[0] + 1), value, priority))
+			merge(value, priority);
+	}
+
+	inline void publish()
+	{
+		minimum_.store(count_ ? priorities_[0] : NONE, std::memory_order_relaxed);
+		buffered_.store(count_, std::memory_order_relaxed);
+	}
+
+	CPQ<value_t, lock_t, counter_t> heap_;
+
+	// Protected by buffer_lock
+	lock_t buffer_lock_;
+	std::size_t priorities_[capacity];
+	value_t values_[capacity];
+	std::size_t count_;
+
+	// Written with buffer_lock held, read without it
+	std::atomic<std::size_t> minimum_;
+	std::atomic<std::size_t> buffered_;
+
+	// Raised by the inserts into the heap which may be above the minimum,
+	// cleared by the pops
+	std::atomic<bool> heap_inserted_;
+};
+
+#endif // BUFFERED_CPQ_HPP
@@ -3,6 +3,16 @@
  * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
  *
  *	Concurrent Priority Queue
+ *
+ *	Compile with -DCPQ_STATS to collect contention statistics, see cpq_stats.hpp
+ *	Compile with -DCPQ_TRACE to record a timeline of the operations, see tracer.hpp
+ *
+ *	The nodes are kept in a std::vector by default, storage_t = Shared_storage
+ *	places them in a segment shared between processes, see shared_CPQ.hpp
+ *
+ *	The nodes are stored in the classic heap order by default, layout_t =
+ *	B_heap_layout<> packs subtrees into blocks for large heaps, see
+ *	node_layout.hpp
  */
 
 #ifndef CPQ_HPP
@@ -11,212 +21,546 @@
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 #include <omp.h>
 
 #include "bit_reversed_counter.hpp"
 #include "Node.hpp"
+#include "node_storage.hpp"
+#include "node_layout.hpp"
 #include "locks.hpp"
 #include "atomics.hpp"
+#include "cpq_stats.hpp"
+#include "tracer.hpp"
+
+/* Predicate of pop_front_if_priority_at_least */
+struct Priority_at_least
+{
+	explicit Priority_at_least(std::size_t threshold) : threshold(threshold) {}
+	
+	template< class value_t >
+	inline bool operator()(const value_t&, std::size_t priority) const 
+	{ 
+		return priority >= threshold; 
+	}
+	
+	std::size_t threshold;
+};
 
 template< class value_t,  class lock_t = omp_lock, 
-		  class counter_t = Bit_reversed_counter>
+		  class counter_t = Bit_reversed_counter,
+		  template<class> class storage_t = Vector_storage,
+		  class layout_t = Heap_layout>
 class CPQ
 {	
 public:
 		 
 	/* Constructor */
 	CPQ() 
-		: size_(), thread_count_(0)
+		: size_(), capacity_(1), thread_count_(0)
 	{
 		// Insert dummy element in order to have a one based array
 		heap_.push_back(Node<value_t, lock_t>());
 	}
+	
+	/* Constructor passing its arguments to the node storage */
+	template< class arg_t, class... args_t >
+	explicit CPQ(arg_t&& arg, args_t&&... args) 
+		: heap_(std::forward<arg_t>(arg), std::forward<args_t>(args)...), 
+		  size_(), capacity_(1), thread_count_(0)
+	{
+		heap_.push_back(Node<value_t, lock_t>());
+	}
 			
 	/** 
 	 *	insert: Inserts an element (value, priority) into the priority queue 
 	 */
 	void insert(value_t value, std::size_t priority)
 	{	
-		heap_lock.lock();
-		int pid = omp_get_thread_num();
+		tracer_.begin(Trace_event::INSERT);
+		lock_global();
+		insert_locked(value, priority);
+		tracer_.end(Trace_event::INSERT);
+	}
+	
+
+	/** 
+	 *	pop_front: 	Assigns the value of the first element in the queue to
+	 *				the parameter value. Returns false if the assignement failed.
+	 */
+	bool pop_front(value_t& value)
+	{	
+		std::size_t priority;
+		return pop_front(value, priority);
+	}
+	
+	/* pop_front which also returns the priority of the element */
+	bool pop_front(value_t& value, std::size_t& priority)
+	{	
+		tracer_.begin(Trace_event::POP);
+		lock_global();
+		bool success = pop_front_locked(value, priority);
+		tracer_.end(Trace_event::POP);
+		return success;
+	}
+	
+	/**
+	 *	pop_if:	Pops the first element like pop_front if pred(value, priority)
+	 *			holds for it, otherwise returns false and leaves the queue as
+	 *			it is. The root is checked with heap_lock held (a node may 
+	 *			only be touched by a thread counted in thread_count_, the 
+	 *			heap may grow otherwise), before the bottom node is touched.
+	 */
+	template< class pred_t >
+	bool pop_if(pred_t pred, value_t& value, std::size_t& priority)
+	{
+		tracer_.begin(Trace_event::POP);
+		lock_global();
+		bool success = pop_if_locked(pred, value, priority);
+		tracer_.end(Trace_event::POP);
+		return success;
+	}
+	
+	template< class pred_t >
+	bool pop_if(pred_t pred, value_t& value)
+	{
+		std::size_t priority;
+		return pop_if(pred, value, priority);
+	}
+	
+	/* Pops the first element if its priority is at least threshold */
+	inline bool pop_front_if_priority_at_least(std::size_t threshold, value_t& value)
+	{
+		std::size_t priority;
+		return pop_if(Priority_at_least(threshold), value, priority);
+	}
+	
+	inline bool empty() const { return size_.counter() < 1 ; }
+	inline std::size_t size() const { return size_.counter(); }
+	
+	/* Snapshot of the contention statistics (all zero without CPQ_STATS) */
+	inline CPQ_stats stats() const { return stats_.snapshot(); }
+	
+	/* Appends the timeline recorded since the time stamp (nothing without CPQ_TRACE) */
+	inline void write_timeline(Timeline_writer& out, const std::string& name,
+							   std::uint64_t since = 0) const
+	{
+		tracer_.write(out, name, since);
+	}
+	
+protected:
+	/**
+	 *	insert_locked:	Fine-grained insert, called with heap_lock held. Takes
+	 *					the first node lock and releases heap_lock.
+	 */
+	void insert_locked(value_t value, std::size_t priority)
+	{
+		check_capacity();
+		
+		int pid = storage_t< Node<value_t, lock_t> >::owner_tag();
 		std::size_t child = size_.increment();
 		
 		// If the current level is full allocate memory for the next one.
-		// We first have to make sure that no other thread is currently in the
-		// queue i.e all locks are unlocked.
-		if(size() == heap_.size())
- 		{
- 			// Wait until all other threads left
- 			while(thread_count_ != 0) do_nothing();
-
- 			for(std::size_t i = 0; i < size_.high_bit(); ++i)
- 			{
- 				heap_.push_back(Node<value_t, lock_t>());
- 			}
- 		}
+		if(size() == capacity_)
+			grow();
 		
 		// Atomically increment the thread count
-		atomic_increment(&thread_count_);
+		atomic_increment(thread_count_, std::memory_order_relaxed);
 		
-		heap_[child].lock();
+		lock_node(child);
 		
-		heap_[child].init(value, priority, pid);
-		heap_lock.unlock();	
+		node(child).init(value, priority, pid);
+		unlock_global();	
 		
-		heap_[child].unlock();
+		unlock_node(child);
 		
 		std::size_t parent, old_child = 0;
 		
 		while(child > ROOT)
 		{
-			parent = child >> 1;
+			parent = layout_t::parent(child);
 			
-			heap_[parent].lock();
-			heap_[child].lock();
+			int tag_parent = lock_node(parent);
+			int tag_child = lock_node(child);
 			
 			old_child = child;
+			stats_.add(CPQ_stats::SIFT_UP_LEVELS);
 			
-			if(heap_[parent].tag() == AVAILABLE &&  heap_[child].tag() == pid)
+			if(tag_parent == AVAILABLE && tag_child == pid)
 			{
-				if (heap_[child].priority() > heap_[parent].priority())
+				if (node(child).priority() > node(parent).priority())
 				{
-					heap_[child].swap(heap_[parent]);
+					node(child).swap(node(parent));
+					stats_.add(CPQ_stats::SWAPS);
 					child = parent;
 				}
 				else
 				{
-					heap_[child].set_tag(AVAILABLE);
+					node(child).set_tag(AVAILABLE);
 					child = 0;
 				}
 			}
-			else if (heap_[parent].tag() == EMPTY)
+			else if (tag_parent == EMPTY)
 				child = 0;
-			else if (heap_[child].tag() != pid)
+			else if (tag_child != pid)
+			{
+				// Our element was moved up by another thread, follow it
+				stats_.add(CPQ_stats::TAG_RETRIES);
 				child = parent;
+			}
 			
-			heap_[old_child].unlock();
-			heap_[parent].unlock();
+			unlock_node(old_child);
+			unlock_node(parent);
 		}
 		
 		if (child == ROOT)
 		{
-			heap_[ROOT].lock();
-			if (heap_[ROOT].tag() == pid)
-				heap_[ROOT].set_tag(AVAILABLE);
-			heap_[ROOT].unlock();
+			if (lock_node(ROOT) == pid)
+				node(ROOT).set_tag(AVAILABLE);
+			unlock_node(ROOT);
 		}
 		
 		// We are done decrement thread count
-		atomic_decrement(&thread_count_);
+		atomic_decrement(thread_count_, std::memory_order_release);
 	}
 	
-
-	/** 
-	 *	pop_front: 	Assigns the value of the first element in the queue to
-	 *				the parameter value. Returns false if the assignement failed.
+	/**
+	 *	pop_front_locked:	Fine-grained pop_front, called with heap_lock held
+	 *						which it releases.
 	 */
-	bool pop_front(value_t& value)
-	{	
-		heap_lock.lock();
-		
+	bool pop_front_locked(value_t& value, std::size_t& priority)
+	{
 		// Atomically increments the thread count
-		atomic_increment(&thread_count_);
+		atomic_increment(thread_count_, std::memory_order_relaxed);
 		
 		if (empty())
 		{
-			heap_lock.unlock();
-			atomic_decrement(&thread_count_);
+			unlock_global();
+			atomic_decrement(thread_count_, std::memory_order_release);
 			return false;
 		}
 		
 		std::size_t bottom = size_.decrement();
 		
-		heap_[bottom].lock();
-		heap_lock.unlock();
+		lock_node(bottom);
+		unlock_global();
 		
-		value_t value_bottom = heap_[bottom].value();
-		std::size_t priority_bottom = heap_[bottom].priority();
-		heap_[bottom].set_tag(EMPTY);
+		value_t value_bottom = node(bottom).value();
+		std::size_t priority_bottom = node(bottom).priority();
+		node(bottom).set_tag(EMPTY);
 		
-		heap_[bottom].unlock();
+		unlock_node(bottom);
 		
-		heap_[ROOT].lock();
+		lock_node(ROOT);
 		
-		// if there is only one entry in the heap return
-		if (heap_[ROOT].tag() == EMPTY)
+		// if there is only one entry in the heap return it. Another pop may
+		// have taken the root after our bottom, the bottom element is ours.
+		if (node(ROOT).tag() == EMPTY)
 		{		
-			value = heap_[ROOT].value();
-			heap_[ROOT].unlock();
+			value = value_bottom;
+			priority = priority_bottom;
+			unlock_node(ROOT);
 			
-			atomic_decrement(&thread_count_);
+			atomic_decrement(thread_count_, std::memory_order_release);
 			return true;
 		}
 		
 		// else insert the bottom element at the top and let it sink
-		value = heap_[ROOT].value();
+		value = node(ROOT).value();
+		priority = node(ROOT).priority();
 		
-		heap_[ROOT].init(value_bottom, priority_bottom, AVAILABLE);
+		node(ROOT).init(value_bottom, priority_bottom, AVAILABLE);
 		
 		// Restore heap properties
-		std::size_t parent = ROOT;
+		std::size_t parent = sift_down(ROOT, optimistic_t());
+		unlock_node(parent);
+		
+		// We are done decrement thread count
+		atomic_decrement(thread_count_, std::memory_order_release);
+		return true;
+	}
+	
+	/**
+	 *	pop_if_locked:	Fine-grained pop_if, called with heap_lock held which
+	 *					it releases. The root is locked before the bottom 
+	 *					(nodes are locked top down), so a failed check returns
+	 *					before size_ or the bottom node changed.
+	 */
+	template< class pred_t >
+	bool pop_if_locked(pred_t& pred, value_t& value, std::size_t& priority)
+	{
+		atomic_increment(thread_count_, std::memory_order_relaxed);
+		
+		if (empty())
+		{
+			unlock_global();
+			atomic_decrement(thread_count_, std::memory_order_release);
+			return false;
+		}
+		
+		lock_node(ROOT);
+		
+		if (!pred(node(ROOT).value(), node(ROOT).priority()))
+		{
+			unlock_node(ROOT);
+			unlock_global();
+			atomic_decrement(thread_count_, std::memory_order_release);
+			return false;
+		}
+		
+		value = node(ROOT).value();
+		priority = node(ROOT).priority();
+		
+		std::size_t bottom = size_.decrement();
+		
+		// The root is the only element
+		if (bottom == ROOT)
+		{
+			node(ROOT).set_tag(EMPTY);
+			unlock_node(ROOT);
+			unlock_global();
+			
+			atomic_decrement(thread_count_, std::memory_order_release);
+			return true;
+		}
+		
+		lock_node(bottom);
+		unlock_global();
+		
+		value_t value_bottom = node(bottom).value();
+		std::size_t priority_bottom = node(bottom).priority();
+		node(bottom).set_tag(EMPTY);
+		
+		unlock_node(bottom);
+		
+		node(ROOT).init(value_bottom, priority_bottom, AVAILABLE);
+		
+		std::size_t parent = sift_down(ROOT, optimistic_t());
+		unlock_node(parent);
+		
+		atomic_decrement(thread_count_, std::memory_order_release);
+		return true;
+	}
+	
+	/**
+	 *	grow:	Allocates the next level of the heap, called with heap_lock
+	 *			held. We first have to make sure that no other thread is
+	 *			currently in the queue i.e all locks are unlocked.
+	 */
+	void grow()
+	{
+		// Wait until all other threads left
+		tracer_.begin(Trace_event::GROWTH);
+		drain();
+		stats_.add(CPQ_stats::GROWTH_EVENTS);
+
+		// The next level, not size_.high_bit(): the high bit of the
+		// Linear_counter stays 0 once the queue was empty
+		capacity_ <<= 1;
+		layout_.resize(heap_, capacity_, Node<value_t, lock_t>());
+		tracer_.end(Trace_event::GROWTH);
+	}
+	
+	/* Throws (releasing heap_lock) if the storage can not take another element */
+	inline void check_capacity()
+	{
+		if(size() + 1 >= heap_.max_size())
+		{
+			unlock_global();
+			tracer_.end(Trace_event::INSERT);
+			throw std::length_error("CPQ is full");
+		}
+	}
+	
+	/* Waits (with heap_lock held) until no other thread is in the heap */
+	inline void drain()
+	{
+		std::uint64_t drain_start = stats_.start();
+		while(thread_count_.load(std::memory_order_acquire) != 0) do_nothing();
+		stats_.stop(CPQ_stats::DRAIN_WAIT, drain_start);
+	}
+	
+	inline void lock_global()
+	{
+		tracer_.wait(true);
+		stats_.lock(heap_lock, CPQ_stats::GLOBAL);
+		tracer_.acquired(true);
+	}
+	
+	inline void unlock_global()
+	{
+		tracer_.released(true);
+		heap_lock.unlock();
+	}
+	
+	/* Node of the heap index i, placed by the layout */
+	inline Node<value_t, lock_t>& node(std::size_t i) { return heap_[layout_.position(i)]; }
+	
+	// Returns the tag of the node, read together with the lock word by the
+	// tagged_lock
+	inline int lock_node(std::size_t i)
+	{
+		if (i == ROOT) tracer_.wait(false);
+		int tag = stats_.lock(node(i), i == ROOT ? CPQ_stats::ROOT : CPQ_stats::INTERIOR);
+		if (i == ROOT) tracer_.acquired(false);
+		return tag;
+	}
+	
+	// The release is traced before unlocking, so holds never overlap
+	inline void unlock_node(std::size_t i)
+	{
+		if (i == ROOT) tracer_.released(false);
+		node(i).unlock();
+	}
+	
+	typedef std::integral_constant<bool, has_optimistic_reads<lock_t>::value> optimistic_t;
+
+	/**
+	 *	sift_down: 	Lets the element at the locked node parent sink and returns 
+	 *				the index of the node where it stopped (still locked).
+	 *				Both children are locked to compare their priorities.
+	 */
+	std::size_t sift_down(std::size_t parent, std::false_type)
+	{
 		std::size_t right, left, child;
 		
-		while(2 * parent <= heap_.size()-1)
+		// The nodes are looked up once per level, the layout may have to
+		// compute their positions
+		Node<value_t, lock_t>* node_parent = &node(parent);
+		Node<value_t, lock_t>* node_child;
+		
+		while(layout_t::left(parent) <= capacity_-1)
 		{
-			left = parent << 1;
-			right = left + 1;
+			left = layout_t::left(parent);
+			right = layout_t::right(parent);
+			
+			Node<value_t, lock_t>& node_left = node(left);
+			Node<value_t, lock_t>& node_right = node(right);
 			
-			heap_[left].lock();
-			heap_[right].lock();
+			lock_node(left);
+			lock_node(right);
+			stats_.add(CPQ_stats::SIFT_DOWN_LEVELS);
 			
-			if (heap_[left].tag() == EMPTY)
+			if (node_left.tag() == EMPTY)
 			{
-				heap_[right].unlock();
-				heap_[left].unlock();
+				unlock_node(right);
+				unlock_node(left);
 				break;
 			}
-			else if (heap_[right].tag() == EMPTY || 
-					 heap_[left].priority() > heap_[right].priority())
+			else if (node_right.tag() == EMPTY || 
+					 node_left.priority() > node_right.priority())
 			{
-				heap_[right].unlock();
+				unlock_node(right);
 				child = left;
+				node_child = &node_left;
 			}
 			else
 			{
-				heap_[left].unlock();
+				unlock_node(left);
 				child = right;
+				node_child = &node_right;
 			}
 
-			if (heap_[child].priority() > heap_[parent].priority())
+			if (node_child->priority() > node_parent->priority())
 			{
-				heap_[child].swap(heap_[parent]);
-				heap_[parent].unlock();
+				node_child->swap(*node_parent);
+				stats_.add(CPQ_stats::SWAPS);
+				unlock_node(parent);
 				parent = child;
+				node_parent = node_child;
 			}
 			else
 			{
-				heap_[child].unlock();
+				unlock_node(child);
 				break;
 			}
-
 		}
-		heap_[parent].unlock();
-		
-		// We are done decrement thread count
-		atomic_decrement(&thread_count_);
-		return true;
+		return parent;
 	}
 	
-	inline bool empty() const { return size_.counter() < 1 ; }
-	inline std::size_t size() const { return size_.counter(); }
+	/**
+	 *	sift_down: 	Optimistic version for versioned nodes. The children are
+	 *				read without locking them and only the chosen child is
+	 *				locked, provided its version did not change in between.
+	 *				Otherwise the level is retried.
+	 */
+	std::size_t sift_down(std::size_t parent, std::true_type)
+	{
+		std::size_t right, left, child;
+		std::size_t priority_left, priority_right, priority_child;
+		unsigned version_left, version_right, version_child;
+		int tag_left, tag_right;
+		
+		while(layout_t::left(parent) <= capacity_-1)
+		{
+			left = layout_t::left(parent);
+			right = layout_t::right(parent);
+			stats_.add(CPQ_stats::SIFT_DOWN_LEVELS);
+			
+			do
+			{
+				version_left = node(left).read_begin();
+				tag_left = node(left).tag();
+				priority_left = node(left).priority();
+			} while(!node(left).read_validate(version_left));
+			
+			if (tag_left == EMPTY)
+				break;
+			
+			do
+			{
+				version_right = node(right).read_begin();
+				tag_right = node(right).tag();
+				priority_right = node(right).priority();
+			} while(!node(right).read_validate(version_right));
+			
+			if (tag_right == EMPTY || priority_left > priority_right)
+			{
+				child = left;
+				version_child = version_left;
+				priority_child = priority_left;
+			}
+			else
+			{
+				child = right;
+				version_child = version_right;
+				priority_child = priority_right;
+			}
+			
+			if (priority_child <= node(parent).priority())
+				break;
+			
+			// The child changed since we read it, retry this level
+			if (!node(child).try_lock(version_child))
+			{
+				stats_.add(CPQ_stats::OPTIMISTIC_RETRIES);
+				continue;
+			}
+			
+			node(child).swap(node(parent));
+			stats_.add(CPQ_stats::SWAPS);
+			unlock_node(parent);
+			parent = child;
+		}
+		return parent;
+	}
 	
-private:
-	std::vector< Node<value_t, lock_t> > heap_;
+	storage_t< Node<value_t, lock_t> > heap_;
+	layout_t layout_;
 	counter_t size_;
+	std::size_t capacity_;		// the heap indices below it have a node
 	lock_t heap_lock;
 	
-	volatile int thread_count_;
+	// Number of threads inside the heap. Increments happen under heap_lock 
+	// which orders them with the growth check, decrements release the node
+	// accesses of the operation to a thread draining the heap for growth.
+	std::atomic<int> thread_count_;
+	
+	CPQ_stats_recorder_t stats_;
+	CPQ_tracer_t tracer_;
 	
 	static const std::size_t ROOT = 1;
 };
@@ -0,0 +1,367 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	Double-ended Concurrent Priority Queue
+ *
+ *	Concurrent interval heap with pop_front (highest priority) and pop_back
+ *	(lowest priority). Every node holds an interval of two elements lo <= hi
+ *	(the last node may hold a single element, stored in lo) and the interval
+ *	of a node contains the intervals of its children. The hi elements form a
+ *	max-heap, the lo elements a min-heap.
+ *
+ *	The locking follows the CPQ: heap_lock protects the node counter and the
+ *	choice of the bottom slot, every node has its own lock, the nodes are
+ *	locked hand-over-hand from the root downwards and the heap grows by a
+ *	level while no thread is inside (thread_count_).
+ *
+ *	Unlike the CPQ, insert works top-down (Rao and Kumar): it reserves the
+ *	bottom slot, then walks from the root to it and swaps the element with
+ *	the hi (lo) of every node it exceeds (falls below). A bottom-up insert
+ *	as in the CPQ can not track its element with a tag, because a pop may
+ *	move the element from the min to the max side of a node. With lock
+ *	coupling an element in transit always lies within the interval of the
+ *	node last passed, hence pops can not overtake it. A pop which needs the
+ *	bottom slot of an insert still in transit waits for it.
+ */
+
+#ifndef INTERVAL_CPQ_HPP
+#define INTERVAL_CPQ_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <omp.h>
+
+#include "bit_reversed_counter.hpp"
+#include "locks.hpp"
+#include "atomics.hpp"
+
+/****************************
+ * 		Interval node 		*
+ ****************************/
+template< typename value_t, class lock_t >
+class Interval_node
+{
+public:
+	struct Entry
+	{
+		value_t value;
+		std::size_t priority;
+	};
+
+	/* Constructor */
+	Interval_node()
+		: entries_(), size_(0), pending_(0), lock_()
+	{}
+
+	// The heap only grows while no thread is inside, hence the copy of a node
+	// keeps the elements and gets a fresh lock
+	Interval_node(const Interval_node& other)
+		: size_(other.size_), pending_(0), lock_()
+	{
+		entries_[0] = other.entries_[0];
+		entries_[1] = other.entries_[1];
+	}
+
+	inline void lock() { lock_.lock(); }
+	inline void unlock() { lock_.unlock(); }
+
+	inline int size() const { return size_; }
+
+	// A single element is both the lo and the hi of the node
+	inline Entry& lo() { return entries_[0]; }
+	inline Entry& hi() { return entries_[size_ - 1]; }
+
+	// Adds an element and keeps lo <= hi
+	inline void add(const Entry& entry)
+	{
+		entries_[size_++] = entry;
+		if(size_ == 2 && entries_[0].priority > entries_[1].priority)
+			std::swap(entries_[0], entries_[1]);
+	}
+
+	// Restores lo <= hi after the lo or hi was replaced
+	inline void order()
+	{
+		if(size_ == 2 && entries_[0].priority > entries_[1].priority)
+			std::swap(entries_[0], entries_[1]);
+	}
+
+	inline Entry remove_hi() { return entries_[--size_]; }
+
+	inline Entry remove_lo()
+	{
+		Entry lo = entries_[0];
+		entries_[0] = entries_[--size_];
+		return lo;
+	}
+
+	// Inserts in transit to this node, written with heap_lock held or by the
+	// arriving insert
+	inline void reserve() { pending_.fetch_add(1, std::memory_order_relaxed); }
+	inline void arrive() { pending_.fetch_sub(1, std::memory_order_release); }
+	inline bool pending() const { return pending_.load(std::memory_order_acquire) != 0; }
+
+private:
+	Entry entries_[2];
+	int size_;
+	std::atomic<int> pending_;
+	lock_t lock_;
+};
+
+/****************************
+ * 		Interval CPQ 		*
+ ****************************/
+template< class value_t,  class lock_t = omp_lock,
+		  class counter_t = Bit_reversed_counter>
+class Interval_CPQ
+{
+	typedef Interval_node<value_t, lock_t> node_t;
+	typedef typename node_t::Entry entry_t;
+
+public:
+
+	/* Constructor */
+	Interval_CPQ()
+		: nodes_(), half_(false), thread_count_(0)
+	{
+		// Insert dummy element in order to have a one based array
+		heap_.push_back(node_t());
+	}
+
+	/**
+	 *	insert: Inserts an element (value, priority) into the priority queue
+	 */
+	void insert(value_t value, std::size_t priority)
+	{
+		heap_lock.lock();
+
+		// Fill up the last node before starting a new one
+		std::size_t target;
+		if(half_)
+			target = nodes_.last();
+		else
+		{
+			target = nodes_.increment();
+			if(nodes_.counter() == heap_.size())
+				grow();
+		}
+		half_ = !half_;
+		heap_[target].reserve();
+
+		atomic_increment(thread_count_, std::memory_order_relaxed);
+
+		heap_[ROOT].lock();
+		heap_lock.unlock();
+
+		entry_t entry = { value, priority };
+		std::size_t node = ROOT;
+
+		while(node != target)
+		{
+			// Keep the element within the interval of every node passed
+			node_t& current = heap_[node];
+			if(priority > current.hi().priority)
+				std::swap(entry, current.hi());
+			else if(priority < current.lo().priority)
+				std::swap(entry, current.lo());
+			priority = entry.priority;
+
+			std::size_t child = child_towards(node, target);
+			heap_[child].lock();
+			current.unlock();
+			node = child;
+		}
+
+		heap_[target].add(entry);
+		heap_[target].arrive();
+		heap_[target].unlock();
+
+		atomic_decrement(thread_count_, std::memory_order_release);
+	}
+
+	/**
+	 *	pop_front: 	Assigns the value of the element of highest priority to
+	 *				the parameter value. Returns false if the queue is empty.
+	 */
+	inline bool pop_front(value_t& value) { return pop<true>(value); }
+
+	/**
+	 *	pop_back: 	Assigns the value of the element of lowest priority to
+	 *				the parameter value. Returns false if the queue is empty.
+	 */
+	inline bool pop_back(value_t& value) { return pop<false>(value); }
+
+	inline bool empty() const { return nodes_.counter() < 1; }
+	inline std::size_t size() const { return 2 * nodes_.counter() - half_; }
+
+private:
+	static const std::size_t ROOT = 1;
+
+	// Child of node on the path to the deeper node target
+	static inline std::size_t child_towards(std::size_t node, std::size_t target)
+	{
+		int shift = 0;
+		while((target >> (shift + 1)) >= node) ++shift;
+		return target >> (shift - 1);
+	}
+
+	/**
+	 *	grow:	Allocates the next level of the heap, called with heap_lock
+	 *			held once no other thread is in the heap.
+	 */
+	void grow()
+	{
+		while(thread_count_.load(std::memory_order_acquire) != 0) do_nothing();
+
+		// A full heap has 2^k nodes including the dummy, add the next level
+		std::size_t level = heap_.size();
+		for(std::size_t i = 0; i < level; ++i)
+			heap_.push_back(node_t());
+	}
+
+	// The element of the heap with highest (max) or lowest priority
+	template< bool max >
+	bool pop(value_t& value)
+	{
+		heap_lock.lock();
+		atomic_increment(thread_count_, std::memory_order_relaxed);
+
+		if(empty())
+		{
+			heap_lock.unlock();
+			atomic_decrement(thread_count_, std::memory_order_release);
+			return false;
+		}
+
+		// Take an element from the last node, once its inserts arrived
+		std::size_t bottom = nodes_.last();
+		while(heap_[bottom].pending()) do_nothing();
+
+		heap_[bottom].lock();
+
+		if(bottom == ROOT)
+		{
+			// The root is the only node, the element is at hand
+			value = (max ? heap_[ROOT].remove_hi() : heap_[ROOT].remove_lo()).value;
+			remove_slot();
+			heap_[ROOT].unlock();
+			heap_lock.unlock();
+
+			atomic_decrement(thread_count_, std::memory_order_release);
+			return true;
+		}
+
+		entry_t entry = heap_[bottom].remove_hi();
+		remove_slot();
+		heap_[bottom].unlock();
+		heap_lock.unlock();
+
+		node_t& root = heap_[ROOT];
+		root.lock();
+
+		// Other pops emptied the rest of the heap in the meantime, the element
+		// at hand may be the answer
+		if(root.size() == 0 || 
+		   (root.size() == 1 && !better<max>(end<max>(root).priority, entry.priority)))
+		{
+			value = entry.value;
+			root.unlock();
+			atomic_decrement(thread_count_, std::memory_order_release);
+			return true;
+		}
+
+		value = end<max>(root).value;
+		end<max>(root) = entry;
+		root.order();
+
+		sift_down<max>(ROOT);
+
+		atomic_decrement(thread_count_, std::memory_order_release);
+		return true;
+	}
+
+	// Called with heap_lock and the lock of the last node held
+	inline void remove_slot()
+	{
+		if(half_)
+			nodes_.decrement();
+		half_ = !half_;
+	}
+
+	// hi for the max side, lo for the min side
+	template< bool max >
+	static inline entry_t& end(node_t& node) { return max ? node.hi() : node.lo(); }
+
+	// Priority a is preferred to b on the given side
+	template< bool max >
+	static inline bool better(std::size_t a, std::size_t b) { return max ? a > b : a < b; }
+
+	/**
+	 *	sift_down: 	Lets the end element of the locked node sink on its side
+	 *				of the heap and unlocks the node where it stopped.
+	 */
+	template< bool max >
+	void sift_down(std::size_t parent)
+	{
+		while(2 * parent <= heap_.size() - 1)
+		{
+			std::size_t left = parent << 1;
+			std::size_t right = left + 1;
+
+			heap_[left].lock();
+			heap_[right].lock();
+
+			node_t& l = heap_[left];
+			node_t& r = heap_[right];
+
+			if(l.size() == 0 && r.size() == 0)
+			{
+				r.unlock();
+				l.unlock();
+				break;
+			}
+
+			std::size_t child;
+			if(r.size() == 0 || (l.size() > 0 && !better<max>(end<max>(r).priority, end<max>(l).priority)))
+			{
+				r.unlock();
+				child = left;
+			}
+			else
+			{
+				l.unlock();
+				child = right;
+			}
+
+			node_t& c = heap_[child];
+			node_t& p = heap_[parent];
+
+			if(!better<max>(end<max>(c).priority, end<max>(p).priority))
+			{
+				c.unlock();
+				break;
+			}
+
+			std::swap(end<max>(c), end<max>(p));
+			c.order();
+
+			p.unlock();
+			parent = child;
+		}
+
+		heap_[parent].unlock();
+	}
+
+	std::vector<node_t> heap_;
+	counter_t nodes_;
+	bool half_;				// the last node holds a single element
+	lock_t heap_lock;
+
+	// Number of threads inside the heap, see CPQ
+	std::atomic<int> thread_count_;
+};
+
+#endif // INTERVAL_CPQ_HPP
@@ -6,6 +6,8 @@
 #ifndef NODE_HPP
 #define NODE_HPP
 
+#include <atomic>
+
 #include "locks.hpp"
 
 /* Tag:	-1 	: EMPTY
@@ -16,6 +18,13 @@
 const int EMPTY		= -1;
 const int AVAILABLE = -2;
 
+/* Nodes whose lock allows optimistic (version validated) reads */
+template<class lock_t>
+struct has_optimistic_reads { static const bool value = false; };
+
+template<>
+struct has_optimistic_reads<versioned_lock> { static const bool value = true; };
+
 template<typename value_t, class lock_t>
 class Node
 {
@@ -33,7 +42,8 @@ public:
 		tag_ 		= pid;
 	}
 	
-	inline void lock() { lock_.lock(); }
+	// Returns the tag, read under the lock
+	inline int lock() { lock_.lock(); return tag_; }
 	
 	inline void unlock() { lock_.unlock(); }
 	
@@ -67,4 +77,125 @@ private:
 	lock_t lock_;
 };
 
+/*	Node specialization for the tagged_lock: the tag is stored in the lock word
+	which saves the separate tag and one atomic operation per lock/tag check.
+*/
+template<typename value_t>
+class Node<value_t, tagged_lock>
+{
+public:
+
+	/* Constructor */
+	Node() 
+		: value_(0.0), priority_(0), lock_(EMPTY)
+	{}
+		
+	inline void init(value_t value, std::size_t priority, int pid)
+	{
+		value_ 		= value;
+		priority_	= priority;
+		lock_.set_tag(pid);
+	}
+	
+	// The tag comes with the lock word, no separate load
+	inline int lock() { return lock_.lock(); }
+	
+	inline void unlock() { lock_.unlock(); }
+	
+	inline void swap(Node<value_t, tagged_lock>& N)
+	{
+		value_t tmp_value		 = value_;
+		std::size_t tmp_priority = priority_;
+		int tmp_tag			 	 = lock_.tag();
+		
+		value_	  = N.value();
+		priority_ = N.priority();
+		lock_.set_tag(N.tag());
+		
+		N.set_value(tmp_value);
+		N.set_priority(tmp_priority);
+		N.set_tag(tmp_tag);
+	}
+	
+	inline void set_value(value_t value) { value_ = value; }
+	inline void set_priority(std::size_t priority) { priority_ = priority; }
+	inline void set_tag(int tag) { lock_.set_tag(tag); }
+	
+	inline std::size_t priority() const { return priority_; }
+	inline value_t value() const { return value_; }
+	inline int tag() const { return lock_.tag(); }
+
+private:
+	value_t value_;
+	std::size_t priority_;
+	tagged_lock lock_;
+};
+
+/*	Node specialization for the versioned_lock: priority and tag can be read
+	optimistically (and are therefore relaxed atomics), the reads have to be
+	enclosed by read_begin() and read_validate().
+*/
+template<typename value_t>
+class Node<value_t, versioned_lock>
+{
+public:
+
+	/* Constructor */
+	Node() 
+		: value_(0.0), priority_(0), tag_(EMPTY), lock_()
+	{}
+	
+	Node(const Node<value_t, versioned_lock>& N)
+		: value_(N.value()), priority_(N.priority()), tag_(N.tag()), lock_()
+	{}
+		
+	inline void init(value_t value, std::size_t priority, int pid)
+	{
+		value_ = value;
+		set_priority(priority);
+		set_tag(pid);
+	}
+	
+	inline int lock() { lock_.lock(); return tag(); }
+	
+	inline void unlock() { lock_.unlock(); }
+	
+	// Optimistic reads
+	inline unsigned read_begin() const { return lock_.read_begin(); }
+	inline bool read_validate(unsigned version) const { return lock_.read_validate(version); }
+	inline bool try_lock(unsigned version) { return lock_.try_lock(version); }
+	
+	inline void swap(Node<value_t, versioned_lock>& N)
+	{
+		value_t tmp_value		 = value_;
+		std::size_t tmp_priority = priority();
+		int tmp_tag			 	 = tag();
+		
+		value_ = N.value();
+		set_priority(N.priority());
+		set_tag(N.tag());
+		
+		N.set_value(tmp_value);
+		N.set_priority(tmp_priority);
+		N.set_tag(tmp_tag);
+	}
+	
+	inline void set_value(value_t value) { value_ = value; }
+	inline void set_priority(std::size_t priority) 
+	{ 
+		priority_.store(priority, std::memory_order_relaxed); 
+	}
+	inline void set_tag(int tag) { tag_.store(tag, std::memory_order_relaxed); }
+	
+	inline std::size_t priority() const { return priority_.load(std::memory_order_relaxed); }
+	inline value_t value() const { return value_; }
+	inline int tag() const { return tag_.load(std::memory_order_relaxed); }
+
+private:
+	value_t value_;
+	std::atomic<std::size_t> priority_;
+	std::atomic<int> tag_;
+	versioned_lock lock_;
+};
+
 #endif
@@ -0,0 +1,156 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	Concurrent bounded top-K
+ *
+ *	Keeps the K elements of highest priority of a stream in a fixed-capacity
+ *	min-heap, the element of lowest priority is at the root. Once the heap is
+ *	full, the priority of the root is the threshold an element has to beat
+ *	to get in. The lowest priority which gets in (threshold + 1, 0 while the
+ *	heap is not full) is published in an atomic, so an insert below it, 
+ *	including a tie with the threshold, is rejected with a single relaxed 
+ *	load, without locking and without writing to a shared cacheline.
+ *
+ *	The threshold only rises, a stale (lower) value only makes an insert
+ *	take the lock, where it is checked again against the heap. Ties with the
+ *	threshold are rejected, i.e the first K elements of equal priority stay.
+ */
+
+#ifndef TOPK_HPP
+#define TOPK_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "locks.hpp"
+
+template< class value_t, class lock_t = omp_lock >
+class TopK
+{
+public:
+	typedef std::pair<std::size_t, value_t> entry_t;	// (priority, value)
+
+	/* Constructor */
+	explicit TopK(std::size_t capacity)
+		: heap_(capacity), size_(0), admit_(0)
+	{}
+
+	/**
+	 *	insert:	Offers the element (value, priority), returns true if it is
+	 *			among the top K seen so far.
+	 */
+	inline bool insert(value_t value, std::size_t priority)
+	{
+		if(priority < admit_.load(std::memory_order_relaxed))
+			return false;
+		return insert_locked(value, priority);
+	}
+
+	inline std::size_t capacity() const { return heap_.size(); }
+	inline std::size_t size() const { return size_.load(std::memory_order_relaxed); }
+	inline bool empty() const { return size() == 0; }
+
+	/* Priority an element has to exceed, 0 while the heap is not full */
+	inline std::size_t threshold() const 
+	{ 
+		std::size_t admit = admit_.load(std::memory_order_relaxed);
+		return admit ? admit - 1 : 0; 
+	}
+
+	/* The elements by decreasing priority */
+	std::vector<entry_t> sorted()
+	{
+		lock_.lock();
+		std::vector<entry_t> entries(heap_.begin(), heap_.begin() + size());
+		lock_.unlock();
+
+		std::sort(entries.begin(), entries.end(), higher);
+		return entries;
+	}
+
+	void clear()
+	{
+		lock_.lock();
+		size_.store(0, std::memory_order_relaxed);
+		admit_.store(0, std::memory_order_relaxed);
+		lock_.unlock();
+	}
+
+private:
+	static inline bool higher(const entry_t& a, const entry_t& b) { return a.first > b.first; }
+
+	// Called with the lock held on a full heap. A threshold of the largest
+	// priority wraps to 0, such inserts take the lock and are rejected there.
+	inline void publish() { admit_.store(heap_[0].first + 1, std::memory_order_relaxed); }
+
+	bool insert_locked(value_t value, std::size_t priority)
+	{
+		lock_.lock();
+
+		std::size_t size = size_.load(std::memory_order_relaxed);
+		if(size < heap_.size())
+		{
+			// Sift up the new leaf
+			std::size_t child = size++;
+			size_.store(size, std::memory_order_relaxed);
+			while(child > 0 && heap_[(child - 1) / 2].first > priority)
+			{
+				heap_[child] = heap_[(child - 1) / 2];
+				child = (child - 1) / 2;
+			}
+			heap_[child] = entry_t(priority, value);
+
+			if(size == heap_.size())
+				publish();
+
+			lock_.unlock();
+			return true;
+		}
+
+		if(heap_.empty() || priority <= heap_[0].first)
+		{
+			lock_.unlock();
+			return false;
+		}
+
+		// Replace the root and let the new element sink
+		std::size_t parent = 0;
+		for(;;)
+		{
+			std::size_t child = 2 * parent + 1;
+			if(child >= size) break;
+			if(child + 1 < size && heap_[child + 1].first < heap_[child].first)
+				++child;
+			if(heap_[child].first >= priority) break;
+
+			heap_[parent] = heap_[child];
+			parent = child;
+		}
+		heap_[parent] = entry_t(priority, value);
+
+		publish();
+
+		lock_.unlock();
+		return true;
+	}
+
+	std::vector<entry_t> heap_;
+
+	// Written with the lock held, read without it (relaxed, size() is exact
+	// once the inserts are done)
+	std::atomic<std::size_t> size_;
+
+	// Lowest priority which gets in, written with the lock held, read 
+	// without it. On a cacheline of its own, hence the rejected inserts only
+	// share it in read mode.
+	char pad1_[64];
+	std::atomic<std::size_t> admit_;
+	char pad2_[64];
+
+	lock_t lock_;
+};
+
+#endif // TOPK_HPP
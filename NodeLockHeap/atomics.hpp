@@ -1,52 +1,56 @@
-/**	
- *	CPQ, version 1.0  
+/**
+ *	CPQ, version 1.0
  * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
  *
- *	Implementing various atomic operations
+ *	Implementing various atomic operations on top of std::atomic. Every
+ *	operation takes the memory order its call site needs, sequential
+ *	consistency is only the default.
  */
 
 #ifndef ATOMICS_HPP
 #define ATOMICS_HPP
 
-inline void atomic_increment(volatile int* ptr)
+#include <atomic>
+
+inline void atomic_increment(std::atomic<int>& x,
+							 std::memory_order order = std::memory_order_seq_cst)
+{
+	x.fetch_add(1, order);
+}
+
+inline void atomic_decrement(std::atomic<int>& x,
+							 std::memory_order order = std::memory_order_seq_cst)
 {
-	asm __volatile__(	"lock; addl %1, %0"
-		    		 	: "+m" (*ptr)
-		     		 	: "ir" (1)
-		     		 	: "memory");
+	x.fetch_sub(1, order);
 }
 
-inline void atomic_decrement(volatile int* ptr)
+// Strongest order a failed compare-exchange may use for a given success order
+inline std::memory_order cmpxchg_failure_order(std::memory_order order)
 {
-	asm __volatile__(	"lock; subl %1, %0"
-		    		 	: "+m" (*ptr)
-		     		 	: "ir" (1)
-		     		 	: "memory");
+	if(order == std::memory_order_acq_rel) return std::memory_order_acquire;
+	if(order == std::memory_order_release) return std::memory_order_relaxed;
+	return order;
 }
 
-inline unsigned atomic_cmpxchgl(int* ptr, int old_val, int new_val )
-{ 
-  	volatile int * __ptr = (volatile int *)(ptr);
-  	int ret_val; 
-  	asm __volatile__( 	"lock; cmpxchgl %2,%1"
-    					: "=a" (ret_val), "+m" (*__ptr)
-    					: "r" (new_val), "0" (old_val)
-    					: "memory");
-	return ret_val;
+// Returns the value of x before the operation (old_val on success)
+inline int atomic_cmpxchgl(std::atomic<int>& x, int old_val, int new_val,
+						   std::memory_order order = std::memory_order_seq_cst)
+{
+	x.compare_exchange_strong(old_val, new_val, order, cmpxchg_failure_order(order));
+	return old_val;
 }
 
-inline unsigned atomic_xchgl(int *ptr, int val)
+inline int atomic_xchgl(std::atomic<int>& x, int val,
+						std::memory_order order = std::memory_order_seq_cst)
 {
-	asm __volatile__(	"xchgl %0,%1"
-						:"=r" (val)
-						:"m" (*(volatile int *)ptr), "0" (val)
-						:"memory");
-	return val;
+	return x.exchange(val, order);
 }
 
-inline void do_nothing() 
-{ 
-	asm __volatile__("nop");
+// Spin-wait hint: saves power and avoids the memory order mis-speculation
+// penalty when leaving the spin loop
+inline void do_nothing()
+{
+	asm __volatile__("pause" : : : "memory");
 }
 
 #endif // ATOMICS_HPP
@@ -1,274 +1,691 @@
-/**	
- *	CPQ, version 1.0  
+/**
+ *	CPQ, version 1.0
  * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
  *
- *  Insert only, delete only and mixed benchmarks for concurrent priority queues 
+ *  Insert only, delete only and mixed benchmarks for concurrent priority queues
  *
  *	The problem size is fixed while the number of concurrent threads changes.
  *	The priorities are chosen randomly and a constant seed guarantees that the exact
  *	same sequence of operations is repeated.
+ *
+ *	Every (queue, lock, counter) combination is instantiated once and stored in
+ *	a registry, the combinations to run are selected on the command line:
+ *
+ *		./benchmark --queue CPQ,STL --lock omp,MCS --counter bitrev \
+ *					--threads 1-7:2 --format csv > output/benchmark.csv
+ *
+ *	With --latency every push and pop is timed with Latency_clock and the
+ *	p50/p99/p99.9/max latencies (in ns) of all repetitions are reported.
+ *
+ *	With --rank-error every operation is logged with a TSC time stamp and the
+ *	rank error of every pop (elements of higher priority present in the
+ *	linearization, see rank_error.hpp) is reported as a distribution.
+ *	Logging disturbs the timing, hence it can not be combined with --latency.
+ *
+ *	With --perf every thread counts cycles, instructions, LLC and dTLB misses
+ *	(and the raw event given by --perf-raw) of its share of the timed loop,
+ *	reported per operation. Events perf can not open are written as null.
+ *
+ *	With --trace FILE the "replay" benchmark drives the queues with a trace
+ *	recorded by Recording_queue (see trace.hpp) instead of random operations.
+ *	The queue is still filled with init-size random elements beforehand.
+ *
+ *	The "scenario" benchmark models producer and consumer thread pools, e.g.
+ *
+ *		./benchmark --benchmark scenario --split 1:3 --insert-ratio 0.5 \
+ *					--burst 64:100000 --distribution zipf --trajectory size.csv
+ *
+ *	splits the threads 1:3 into producers and consumers, the producers insert
+ *	zipf distributed priorities in bursts of 64 every 100us (see scenario.hpp).
+ *	With --trajectory (or --sample-interval) a sampler thread records the queue
+ *	size every sample-interval us, the samples of every repetition are written
+ *	to the trajectory file and every row gets the sustained throughput and the
+ *	size range. Sampling can not be combined with --latency or --rank-error.
+ *
+ *	The benchmark_stats binary is built with -DCPQ_STATS and appends the
+ *	contention counters of the CPQ (see cpq_stats.hpp) to every row, summed
+ *	over the timed parts of all repetitions. Cycles are TSC ticks.
+ *
+ *	With --pin the threads of every team are pinned to the CPUs read from /sys
+ *	(see topology.hpp), several policies are run one after the other and
+ *	--threads sweep runs 1 to all CPUs plus 1.5x and 2x oversubscription:
+ *
+ *		./benchmark --pin compact,scatter,smt-first,socket-fill --threads sweep
+ *
+ *	--topology prints the detected CPUs and the order of every policy.
+ *
+ *	The benchmark_timeline binary is built with -DCPQ_TRACE. With --timeline
+ *	FILE it writes the operations, the waits for and holds of heap_lock and
+ *	the root lock and the growth events of every timed CPQ run as Chrome
+ *	trace-event JSON (see tracer.hpp), one process per run. Open the file in
+ *	Perfetto; keep the problem size small, every thread keeps its last 2^16
+ *	events only.
+ *
+ *	Run ./benchmark --help for all options and --list for all registered
+ *	combinations. Queues which do not depend on the lock or the counter are
+ *	registered once with lock and counter "-".
  */
 
 #include "benchmark.hpp"
+#include "options.hpp"
 
-int main(int argc , char* argv[])
+#include <map>
+#include <memory>
+#include <set>
+
+typedef void (*benchmark_fn)(const std::string& benchmark, const Benchmark_config& config,
+							 Result_writer& out, const Result_row& labels);
+
+/****************************
+ * 		  Registry 			*
+ ****************************/
+template< class queue_t >
+void run_benchmark(const std::string& benchmark, const Benchmark_config& config,
+				   Result_writer& out, const Result_row& labels)
 {
-	std::size_t max_nthreads = 7;
-	std::size_t nreps = 2;
-	
-	std::size_t problem_size = 1 << 15;
-	std::size_t init_size = 1 << 17;
-	
-	std::size_t seed = 1;
-
-	std::ofstream fout_insert;
-	std::ofstream fout_delete;
-	std::ofstream fout_mixed;
-	
-	std::string output = "output/";
-		
-#ifdef _CPQ
-	fout_insert.open(output+"insert_omp.dat");
-	fout_delete.open(output+"delete_omp.dat");
-	fout_mixed.open(output+"mixed_omp.dat");
-#elif defined(_Intel)
-	fout_insert.open(output+"insert_Intel.dat");
-	fout_delete.open(output+"delete_Intel.dat");
-	fout_mixed.open(output+"mixed_Intel.dat");
-#elif defined(_STL)
-	fout_insert.open(output+"insert_STL.dat");
-	fout_delete.open(output+"delete_STL.dat");
-	fout_mixed.open(output+"mixed_STL.dat");
-#endif	
-
-	 benchmark_insert_operations<std::size_t, omp_lock, Bit_reversed_counter>
-	 	(problem_size, init_size, nreps, seed, max_nthreads, fout_insert);
-	
-	 benchmark_delete_operations<std::size_t, omp_lock, Bit_reversed_counter>
-	 	(problem_size, init_size, nreps, seed, max_nthreads, fout_delete);
-	
-	  benchmark_mixed_operations<std::size_t, omp_lock, Bit_reversed_counter>
-	  	(problem_size, init_size, nreps, seed, max_nthreads, fout_mixed );
-	 
-	fout_insert.close();
-	fout_delete.close();
-	fout_mixed.close();
-	
-	return 0;	
+	if(benchmark == Insert_workload::name())
+		benchmark_operations<queue_t, Insert_workload>(config, out, labels);
+	else if(benchmark == Delete_workload::name())
+		benchmark_operations<queue_t, Delete_workload>(config, out, labels);
+	else if(benchmark == Mixed_workload::name())
+		benchmark_operations<queue_t, Mixed_workload>(config, out, labels);
+	else if(benchmark == Replay_workload::name())
+		benchmark_operations<queue_t, Replay_workload>(config, out, labels);
+	else if(benchmark == Scenario_workload::name())
+		benchmark_operations<queue_t, Scenario_workload>(config, out, labels);
+	else
+		throw std::invalid_argument("unknown benchmark '" + benchmark + "'");
 }
 
-/****************************/
-/*			Insert 			*/
-/****************************/
-template <class value_t, class lock_t, class counter_t, class ostream_t>
-void benchmark_insert_operations(const std::size_t problem_size, const std::size_t init_size,
-								 const std::size_t nreps, const std::size_t seed, 
-								 const std::size_t max_nthreads, ostream_t& out)
+class Registry
 {
-	out << "Problem size:\t" << problem_size << std::endl;
-	out << "Init size:\t" << init_size << std::endl;
-	out << "Repetitions:\t" << nreps << std::endl;
-	
-	for (std::size_t nthreads=1; nthreads <= max_nthreads; nthreads+=2)
+public:
+	template< class queue_t >
+	void add(const std::string& queue, const std::string& lock, const std::string& counter)
 	{
-		double sum_time = 0;
-		double sum_time2 = 0;
+		entries_[key(queue, lock, counter)] = &run_benchmark<queue_t>;
+	}
 
-		Timer timer;
+	// Returns 0 if the combination is not registered
+	benchmark_fn find(const std::string& queue, const std::string& lock,
+					  const std::string& counter) const
+	{
+		std::map<std::string, benchmark_fn>::const_iterator it;
+		it = entries_.find(key(queue, lock, counter));
+		return it == entries_.end() ? 0 : it->second;
+	}
 
-		for (std::size_t n=0; n<nreps; ++n)
-		{
-			
-#ifdef _CPQ
-			queue_CPQ<value_t, lock_t, counter_t> queue;
-#elif defined(_Intel)
-			queue_Intel<value_t, lock_t, counter_t> queue;
-#elif defined(_STL)
-			queue_STL<value_t, lock_t, counter_t> queue;
+	void list(std::ostream& out) const
+	{
+		std::map<std::string, benchmark_fn>::const_iterator it;
+		for(it = entries_.begin(); it != entries_.end(); ++it)
+			out << it->first << std::endl;
+	}
+
+	static std::string key(const std::string& queue, const std::string& lock,
+						   const std::string& counter)
+	{
+		return queue + "/" + lock + "/" + counter;
+	}
+
+private:
+	std::map<std::string, benchmark_fn> entries_;
+};
+
+template< class lock_t >
+void register_CPQ(Registry& registry, const std::string& lock)
+{
+	registry.add< queue_CPQ<std::size_t, lock_t, Bit_reversed_counter> >("CPQ", lock, "bitrev");
+	registry.add< queue_CPQ<std::size_t, lock_t, Linear_counter> >("CPQ", lock, "linear");
+	registry.add< queue_Adaptive<std::size_t, lock_t, Bit_reversed_counter> >("Adaptive", lock, "bitrev");
+	registry.add< queue_Adaptive<std::size_t, lock_t, Linear_counter> >("Adaptive", lock, "linear");
+}
+
+void register_all(Registry& registry)
+{
+	// All locks which can be stored in a Node
+	register_CPQ<omp_lock>(registry, "omp");
+	register_CPQ<TAS_lock>(registry, "TAS");
+	register_CPQ<TATAS_lock>(registry, "TATAS");
+	register_CPQ<TASexpbo_lock>(registry, "TASexpbo");
+	register_CPQ<ticket_lock>(registry, "ticket");
+	register_CPQ<MCS_lock>(registry, "MCS");
+	register_CPQ<CLH_lock>(registry, "CLH");
+	register_CPQ<tagged_lock>(registry, "tagged");
+	register_CPQ<versioned_lock>(registry, "versioned");
+#ifdef __linux__
+	register_CPQ<futex_lock>(registry, "futex");
+	register_CPQ<adaptive_lock<pause_backoff> >(registry, "adaptive_pause");
+	register_CPQ<adaptive_lock<exp_backoff<> > >(registry, "adaptive_exp");
+	register_CPQ<adaptive_lock<rand_backoff<> > >(registry, "adaptive_rand");
+	register_CPQ<adaptive_lock<yield_backoff> >(registry, "adaptive_yield");
 #endif
-			
-			std::default_random_engine rng(seed);
 
-			for (std::size_t i=0; i<init_size; ++i)
+	registry.add< queue_Intel<std::size_t> >("Intel", "-", "-");
+	registry.add< queue_STL<std::size_t, STL_lock> >("STL", "-", "-");
+	registry.add< queue_Bucket<std::size_t> >("Bucket", "-", "-");
+	registry.add< queue_External<std::size_t> >("External", "omp", "bitrev");
+	registry.add< queue_Interval<std::size_t> >("Interval", "omp", "bitrev");
+	registry.add< queue_Buffered<std::size_t> >("Buffered", "omp", "bitrev");
+	registry.add< queue_CPQ<std::size_t, omp_lock, Bit_reversed_counter, B_heap_layout<> > >
+		("BHeap", "omp", "bitrev");
+}
+
+void print_usage(std::ostream& out)
+{
+	out << "Usage: ./benchmark [options]\n"
+		<< "  --benchmark LIST      insert,delete,mixed,replay,scenario\n"
+		<< "                        (default: insert,delete,mixed)\n"
+		<< "  --queue LIST          CPQ,Adaptive,Intel,STL,Bucket,External,\n"
+		<< "                        Interval,Buffered,BHeap (CPQ with B-heap layout)\n"
+		<< "                        (default: CPQ, External keeps 1 MiB in RAM)\n"
+		<< "  --lock LIST           lock types of the CPQs (default: omp)\n"
+		<< "  --counter LIST        bitrev,linear (default: bitrev)\n"
+		<< "  --threads LIST        e.g 1,2,4 or 1-8 or 1-7:2 (default: 1-7:2) or sweep\n"
+		<< "                        (1 to all CPUs, 1.5x and 2x oversubscribed)\n"
+		<< "  --pin LIST            none,compact,scatter,smt-first,socket-fill (default: none)\n"
+		<< "  --problem-size N      operations per run (default: 2^15)\n"
+		<< "  --init-size N         elements inserted before the run (default: 2^17)\n"
+		<< "  --reps N              repetitions per thread count (default: 2)\n"
+		<< "  --seed N              seed of the random priorities (default: 1)\n"
+		<< "  --latency             report push/pop latency percentiles (ns)\n"
+		<< "  --rank-error          report the rank error distribution of the pops\n"
+		<< "  --perf                report hardware counters per operation\n"
+		<< "  --perf-raw CONFIG     raw perf event counting cache-line transfers (hex)\n"
+		<< "  --trace FILE          replay the trace FILE (default benchmark: replay)\n"
+		<< "  --trace-delays        wait for the recorded inter-arrival delays\n"
+		<< "  --split P:C           producer:consumer thread split of the scenario\n"
+		<< "                        (default: 0:0, every thread does both)\n"
+		<< "  --insert-ratio R      fraction of inserts of the scenario (default: 0.5)\n"
+		<< "  --burst N:NS          producers pause NS ns after N inserts (default: off)\n"
+		<< "  --distribution NAME   uniform,zipf,increasing,nearly-sorted (default: uniform)\n"
+		<< "  --zipf-s S            exponent of the zipf distribution (default: 1.0)\n"
+		<< "  --zipf-keys N         distinct zipf priorities (default: 2^20)\n"
+		<< "  --disorder N          displacement of nearly-sorted (default: 1024)\n"
+		<< "  --sample-interval US  sample the queue size every US us (default: 1000\n"
+		<< "                        with --trajectory, off otherwise)\n"
+		<< "  --trajectory FILE     write the queue size samples to FILE\n"
+		<< "  --timeline FILE       write a Chrome trace of every CPQ run to FILE\n"
+		<< "                        (benchmark_timeline only)\n"
+		<< "  --format csv|json     output format (default: csv)\n"
+		<< "  --output FILE         write the results to FILE (default: stdout)\n"
+		<< "  --list                print all registered queue/lock/counter combinations\n"
+		<< "  --topology            print the CPU topology and the pinning orders\n";
+}
+
+int main(int argc , char* argv[])
+{
+	Registry registry;
+	register_all(registry);
+
+	try
+	{
+		Options options(argc, argv);
+
+		if(options.has("help"))
+		{
+			print_usage(std::cout);
+			return 0;
+		}
+
+		if(options.has("list"))
+		{
+			registry.list(std::cout);
+			return 0;
+		}
+
+		Topology topology;
+
+		if(options.has("topology"))
+		{
+			topology.print(std::cout);
+			for(int p = Topology::COMPACT; p <= Topology::SOCKET_FILL; ++p)
 			{
-				std::size_t priority = rng();
-				queue.push(priority, priority);
+				std::vector<int> order = topology.order(Topology::Policy(p));
+				std::cout << Topology::name(Topology::Policy(p)) << ":";
+				for(std::size_t i = 0; i < order.size(); ++i)
+					std::cout << " " << order[i];
+				std::cout << std::endl;
 			}
+			return 0;
+		}
 
-			timer.tic();
+		Benchmark_config config;
+		config.problem_size = options.get_size("problem-size", 1 << 15);
+		config.init_size = options.get_size("init-size", 1 << 17);
+		config.nreps = options.get_size("reps", 2);
+		config.seed = options.get_size("seed", 1);
+		config.nthreads = options.get("threads", "") == "sweep" ? topology.sweep()
+						: options.get_range("threads", "1-7:2");
+		config.latency = options.has("latency");
+		config.rank_error = options.has("rank-error");
+		config.perf = options.has("perf") || options.has("perf-raw");
 
-			#pragma omp parallel private(rng) shared(queue) num_threads(nthreads)
-			{
-				rng.seed(seed + omp_get_thread_num()+1);
-				std::size_t priority;
+		if(config.latency && config.rank_error)
+			throw std::invalid_argument("--latency and --rank-error can not be combined");
+		config.perf_raw = std::strtoull(options.get("perf-raw", "0").c_str(), 0, 16);
+
+		if(config.perf)
+		{
+			Perf_counters probe(config.perf_raw);
+			for(int i = 0; i < Perf_counters::NEVENTS; ++i)
+				if(!probe.available(i) && (i != Perf_counters::XFERS || config.perf_raw))
+					std::cerr << "*** Warning *** : perf event " << Perf_counters::name(i)
+							  << " is not available" << std::endl;
+		}
+
+		if(config.nreps == 0 || config.nthreads.empty())
+			throw std::invalid_argument("--reps and --threads must not be empty");
+
+		std::unique_ptr<Trace_reader> trace;
+		if(options.has("trace"))
+			trace.reset(new Trace_reader(options.get("trace", "")));
+		config.trace = trace.get();
+		config.trace_delays = options.has("trace-delays");
+
+		Scenario_config& scenario = config.scenario;
+		std::pair<std::size_t, std::size_t> split = options.get_pair("split", "0:0");
+		std::pair<std::size_t, std::size_t> burst = options.get_pair("burst", "0:0");
+		scenario.producer_share = split.first;
+		scenario.consumer_share = split.second;
+		scenario.insert_ratio = options.get_double("insert-ratio", 0.5);
+		scenario.burst_size = burst.first;
+		scenario.burst_gap_ns = burst.second;
+		scenario.distribution = Scenario_config::parse_distribution(
+			options.get("distribution", "uniform"));
+		scenario.zipf_exponent = options.get_double("zipf-s", 1.0);
+		scenario.zipf_keys = options.get_size("zipf-keys", 1 << 20);
+		scenario.disorder = options.get_size("disorder", 1024);
+
+		if(scenario.insert_ratio < 0 || scenario.insert_ratio > 1)
+			throw std::invalid_argument("--insert-ratio must be in [0, 1]");
+		if(scenario.zipf_exponent <= 0 || scenario.zipf_keys == 0)
+			throw std::invalid_argument("--zipf-s and --zipf-keys must be positive");
+
+		config.sample_interval_us = options.get_size("sample-interval",
+			options.has("trajectory") ? 1000 : 0);
+		if(config.sample_interval_us && (config.latency || config.rank_error))
+			throw std::invalid_argument("sampling can not be combined with --latency or --rank-error");
+
+		std::vector<std::string> benchmarks = options.get_list("benchmark",
+			trace ? "replay" : "insert,delete,mixed");
 
-				#pragma omp for
-				for (std::size_t i=0; i<problem_size; ++i)
+		for(std::size_t b = 0; b < benchmarks.size(); ++b)
+			if(benchmarks[b] == Replay_workload::name() && !trace)
+				throw std::invalid_argument("the replay benchmark needs --trace");
+			else if(benchmarks[b] != Insert_workload::name() &&
+					benchmarks[b] != Delete_workload::name() &&
+					benchmarks[b] != Mixed_workload::name() &&
+					benchmarks[b] != Replay_workload::name() &&
+					benchmarks[b] != Scenario_workload::name())
+				throw std::invalid_argument("unknown benchmark '" + benchmarks[b] + "'");
+		std::vector<std::string> queues = options.get_list("queue", "CPQ");
+		std::vector<std::string> locks = options.get_list("lock", "omp");
+		std::vector<std::string> counters = options.get_list("counter", "bitrev");
+		std::vector<std::string> pinnings = options.get_list("pin", "none");
+
+		std::vector<Topology::Policy> policies;
+		for(std::size_t p = 0; p < pinnings.size(); ++p)
+			policies.push_back(Topology::parse_policy(pinnings[p]));
+
+		// Resolve the whole matrix before running anything
+		std::vector<std::pair<Result_row, benchmark_fn> > runs;
+		std::set<std::string> seen;
+
+		for(std::size_t q = 0; q < queues.size(); ++q)
+			for(std::size_t l = 0; l < locks.size(); ++l)
+				for(std::size_t c = 0; c < counters.size(); ++c)
 				{
-					priority = rng();
-					queue.push(priority, priority);
+					std::string lock = locks[l], counter = counters[c];
+					benchmark_fn fn = registry.find(queues[q], lock, counter);
+
+					if(!fn)
+					{
+						lock = counter = "-";
+						fn = registry.find(queues[q], lock, counter);
+					}
+
+					if(!fn)
+						throw std::invalid_argument("combination '" +
+							Registry::key(queues[q], locks[l], counters[c]) +
+							"' is not registered (see --list)");
+
+					if(!seen.insert(Registry::key(queues[q], lock, counter)).second)
+						continue;
+
+					Result_row labels;
+					labels.add("queue", queues[q]).add("lock", lock).add("counter", counter);
+					runs.push_back(std::make_pair(labels, fn));
 				}
-			}
 
-			double elapsed_time = timer.toc();
-			sum_time += elapsed_time;
-			sum_time2 += elapsed_time*elapsed_time;
+		std::ofstream fout;
+		if(options.has("output"))
+		{
+			fout.open(options.get("output", "").c_str());
+			if(!fout)
+				throw std::invalid_argument("cannot open '" + options.get("output", "") + "'");
 		}
 
-		double mean_time = sum_time / nreps;
-		double sigma_time = std::sqrt(1./(nreps-1)*(sum_time2/nreps - mean_time*mean_time));
+		Result_writer::Format format = Result_writer::parse_format(options.get("format", "csv"));
+		Result_writer out(fout.is_open() ? fout : std::cout, format);
+
+		std::ofstream ftrajectory;
+		std::unique_ptr<Result_writer> trajectory;
+		if(options.has("trajectory"))
+		{
+			ftrajectory.open(options.get("trajectory", "").c_str());
+			if(!ftrajectory)
+				throw std::invalid_argument("cannot open '" + options.get("trajectory", "") + "'");
+			trajectory.reset(new Result_writer(ftrajectory, format));
+		}
+		config.trajectory = trajectory.get();
+
+		std::ofstream ftimeline;
+		std::unique_ptr<Timeline_writer> timeline;
+		if(options.has("timeline"))
+		{
+			if(!CPQ_TRACE_ENABLED)
+				throw std::invalid_argument("--timeline needs the benchmark_timeline binary");
+
+			ftimeline.open(options.get("timeline", "").c_str());
+			if(!ftimeline)
+				throw std::invalid_argument("cannot open '" + options.get("timeline", "") + "'");
+			timeline.reset(new Timeline_writer(ftimeline));
+		}
+		config.timeline = timeline.get();
+
+		for(std::size_t r = 0; r < runs.size(); ++r)
+			for(std::size_t p = 0; p < policies.size(); ++p)
+			{
+				Result_row labels(runs[r].first);
+				labels.add("pinning", Topology::name(policies[p]));
+				config.cpus = topology.order(policies[p]);
 
-		out.precision(8);
-		out << std::fixed;
-		out << std::right << std::setw(20) << nthreads;
-		out << std::right << std::setw(20) << mean_time;
-		out << std::right << std::setw(20) << sigma_time << std::endl;
+				for(std::size_t b = 0; b < benchmarks.size(); ++b)
+					runs[r].second(benchmarks[b], config, out, labels);
+			}
+	}
+	catch(const std::invalid_argument& e)
+	{
+		std::cerr << "*** Error *** : " << e.what() << "\n\n";
+		print_usage(std::cerr);
+		return 1;
+	}
+	catch(const std::runtime_error& e)
+	{
+		std::cerr << "*** Error *** : " << e.what() << std::endl;
+		return 1;
 	}
+
+	return 0;
 }
-	
+
+/****************************/
+/*		  Benchmark 		*/
 /****************************/
-/*			Delete 			*/
-/****************************/	
-template <class value_t, class lock_t, class counter_t, class ostream_t>
-void benchmark_delete_operations(const std::size_t problem_size, const std::size_t init_size,
-								 const std::size_t nreps, const std::size_t seed, 
-								 const std::size_t max_nthreads, ostream_t& out)
+// Append the latency percentiles of a histogram (in ns) to the row
+void add_latency(Result_row& row, const std::string& op, const Latency_histogram& hist)
+{
+	double ns_per_tick = Latency_clock::ns_per_tick();
+
+	row.add(op + "_count", hist.count())
+	   .add(op + "_p50_ns", hist.percentile(50) * ns_per_tick)
+	   .add(op + "_p99_ns", hist.percentile(99) * ns_per_tick)
+	   .add(op + "_p999_ns", hist.percentile(99.9) * ns_per_tick)
+	   .add(op + "_max_ns", hist.max() * ns_per_tick);
+}
+
+// Accumulate the sustained rate and the size range of a sampled repetition
+void add_samples(const Progress& progress, std::size_t rep, double& sustained_ops,
+				 double& sustained_time, std::int64_t& size_min, std::int64_t& size_max,
+				 std::int64_t& size_final, std::size_t& failed_pops)
+{
+	const std::vector<Progress::Sample>& samples = progress.samples();
+
+	double ops, seconds;
+	if (progress.sustained(ops, seconds))
+	{
+		sustained_ops += ops;
+		sustained_time += seconds;
+	}
+
+	for (std::size_t i=0; i<samples.size(); ++i)
+	{
+		if (rep == 0 && i == 0)
+			size_min = size_max = samples[i].size;
+		size_min = std::min(size_min, samples[i].size);
+		size_max = std::max(size_max, samples[i].size);
+	}
+
+	size_final = samples.back().size;
+	failed_pops += samples.back().failed;
+}
+
+void write_trajectory(Result_writer& out, const Progress& progress, const Result_row& labels,
+					  const std::string& benchmark, std::size_t nthreads, std::size_t rep)
 {
-	
-	out << "Problem size:\t" << problem_size << std::endl;
-	out << "Init size:\t" << init_size << std::endl;
-	out << "Repetitions:\t" << nreps << std::endl;
-	
-	for (std::size_t nthreads=1; nthreads <= max_nthreads; nthreads+=2)
+	const std::vector<Progress::Sample>& samples = progress.samples();
+
+	for (std::size_t i=0; i<samples.size(); ++i)
+	{
+		Result_row row;
+		row.add(labels)
+		   .add("benchmark", benchmark)
+		   .add("nthreads", nthreads)
+		   .add("rep", rep)
+		   .add("time", samples[i].time)
+		   .add("pushes", samples[i].pushes)
+		   .add("pops", samples[i].pops)
+		   .add("failed_pops", samples[i].failed)
+		   .add("size", samples[i].size);
+		out.write(row);
+	}
+}
+
+template <class queue_t, class workload_t>
+void benchmark_operations(const Benchmark_config& config, Result_writer& out,
+						  const Result_row& labels)
+{
+	for (std::size_t t=0; t<config.nthreads.size(); ++t)
 	{
+		std::size_t nthreads = config.nthreads[t];
 
 		double sum_time = 0;
 		double sum_time2 = 0;
 
 		Timer timer;
+		Latency_histogram push_hist, pop_hist, rank_hist;
+		std::size_t rank_unmatched = 0;
+		double sustained_ops = 0, sustained_time = 0;
+		std::int64_t size_min = 0, size_max = 0, size_final = 0;
+		std::size_t failed_pops = 0;
+		CPQ_stats stats;
+		double perf_counts[Perf_counters::NEVENTS] = {};
 
-		for (std::size_t n=0; n<nreps; ++n)
+		for (std::size_t n=0; n<config.nreps; ++n)
 		{
-			
-#ifdef _CPQ
-			queue_CPQ<value_t, lock_t, counter_t> queue;
-#elif defined(_Intel)
-			queue_Intel<value_t, lock_t, counter_t> queue;
-#elif defined(_STL)
-			queue_STL<value_t, lock_t, counter_t> queue;
-#endif
-			
+			queue_t queue;
+			Rank_recorder ranks(config.rank_error ? nthreads : 0);
+			Progress progress(config.sample_interval_us ? nthreads : 0, config.init_size);
 
-			std::default_random_engine rng(seed);
+			std::default_random_engine rng(config.seed);
 
-			for (std::size_t i=0; i<init_size; ++i)
+			for (std::size_t i=0; i<config.init_size; ++i)
 			{
 				std::size_t priority = rng();
 				queue.push(priority, priority);
+				if (config.rank_error)
+					ranks.initial(priority);
 			}
 
-			timer.tic();
+			// Only count the timed part
+			stats -= queue_stats(queue);
+
+			if (config.sample_interval_us)
+				progress.start(config.sample_interval_us);
+
+			std::uint64_t run_start = 0;
+			double elapsed_time = 0;
 
-			#pragma omp parallel private(rng) shared(queue) num_threads(nthreads)
+			#pragma omp parallel shared(queue, timer, run_start, elapsed_time) num_threads(nthreads)
 			{
-				rng.seed(seed + omp_get_thread_num()+1);
-				std::size_t priority;
+				workload_t workload;
 
-				#pragma omp for
-				for (std::size_t i=0; i<problem_size; ++i)
+				if (!config.cpus.empty())
+					Topology::pin(config.cpus[omp_get_thread_num() % config.cpus.size()]);
+
+				// Opened and started by every thread for itself before the clock
+				// runs, the workloads do not wait for each other so the counters
+				// stop before the barrier
+				Perf_counters* perf = 0;
+				if (config.perf)
 				{
-					priority = rng();
-					queue.pop(priority);
+					perf = new Perf_counters(config.perf_raw);
+					perf->start();
+				}
+
+				// The threads leave the barrier together once the clock runs
+				#pragma omp single
+				{
+					run_start = Latency_clock::now();
+					timer.tic();
+				}
+
+				if (config.latency)
+				{
+					// Thread private histograms, merged once at the end
+					Latency_histogram thread_push, thread_pop;
+					Timed_queue<queue_t> timed_queue(queue, thread_push, thread_pop);
+
+					workload.run(timed_queue, config);
+
+					#pragma omp critical
+					{
+						push_hist.merge(thread_push);
+						pop_hist.merge(thread_pop);
+					}
+				}
+				else if (config.rank_error)
+				{
+					Rank_queue<queue_t> rank_queue(queue, ranks);
+					workload.run(rank_queue, config);
+				}
+				else if (config.sample_interval_us)
+				{
+					Counting_queue<queue_t> counting_queue(queue, progress);
+					workload.run(counting_queue, config);
+				}
+				else
+					workload.run(queue, config);
+
+				if (perf)
+					perf->stop();
+
+				#pragma omp barrier
+				#pragma omp single
+				elapsed_time = timer.toc();
+
+				if (perf)
+				{
+					#pragma omp critical
+					perf->read(perf_counts);
+					delete perf;
 				}
 			}
 
-			double elapsed_time = timer.toc();
+			stats += queue_stats(queue);
+
+			if (config.timeline)
+			{
+				std::ostringstream name;
+				for (std::size_t i=0; i<labels.entries().size(); ++i)
+					name << labels.entries()[i].value << "/";
+				name << workload_t::name() << " " << nthreads << " threads rep " << n;
+				queue_timeline(queue, *config.timeline, name.str(), run_start);
+			}
+
+			if (config.sample_interval_us)
+			{
+				progress.stop();
+				add_samples(progress, n, sustained_ops, sustained_time,
+							size_min, size_max, size_final, failed_pops);
+
+				if (config.trajectory)
+					write_trajectory(*config.trajectory, progress, labels,
+									 workload_t::name(), nthreads, n);
+			}
+
+			if (config.rank_error)
+				rank_unmatched += ranks.analyze(rank_hist);
 			sum_time += elapsed_time;
 			sum_time2 += elapsed_time*elapsed_time;
 		}
 
+		std::size_t nreps = config.nreps;
+		std::size_t nops = workload_t().operations(config);
 		double mean_time = sum_time / nreps;
-		double sigma_time = std::sqrt(1./(nreps-1)*(sum_time2/nreps - mean_time*mean_time));
+		double sigma_time = nreps < 2 ? 0.0 :
+			std::sqrt(std::max(0.0, 1./(nreps-1)*(sum_time2 - nreps*mean_time*mean_time)));
 
-		out.precision(8);
-		out << std::fixed;
-		out << std::right << std::setw(20) << nthreads;
-		out << std::right << std::setw(20) << mean_time;
-		out << std::right << std::setw(20) << sigma_time << std::endl;
-	}
-}
+		Result_row row;
+		row.add(labels)
+		   .add("benchmark", workload_t::name())
+		   .add("nthreads", nthreads)
+		   .add("problem_size", nops)
+		   .add("init_size", config.init_size)
+		   .add("reps", nreps)
+		   .add("mean_time", mean_time)
+		   .add("sigma_time", sigma_time)
+		   .add("throughput", nops / mean_time);
 
-/****************************/
-/*			Mixed 			*/
-/****************************/
-template <class value_t, class lock_t, class counter_t, class ostream_t>
-void benchmark_mixed_operations(const std::size_t problem_size, const std::size_t init_size, 
-								const std::size_t nreps, const std::size_t seed, 
-								const std::size_t max_nthreads, ostream_t& out)
-{
-	out << "Problem size:\t" << problem_size << std::endl;
-	out << "Init size:\t" << init_size << std::endl;
-	out << "Repetitions:\t" << nreps << std::endl;
-	
-	for (std::size_t nthreads=1; nthreads <= max_nthreads; nthreads+=2)
-	{
-		double sum_time = 0;  
-		double sum_time2 = 0;
-	
-		Timer timer;
-	
-		for (std::size_t n=0; n<nreps; ++n)
+		if (config.latency)
 		{
+			add_latency(row, "push", push_hist);
+			add_latency(row, "pop", pop_hist);
+		}
 
-#ifdef _CPQ
-			queue_CPQ<value_t, lock_t, counter_t> queue;
-#elif defined(_Intel)
-			queue_Intel<value_t, lock_t, counter_t> queue;
-#elif defined(_STL)
-			queue_STL<value_t, lock_t, counter_t> queue;
-#endif
-	
-			std::default_random_engine rng(seed);
-	
-			for (std::size_t i=0; i<init_size; ++i)
-			{
-				std::size_t priority = rng();
-				queue.push(priority, priority);
-			}
-	
-			timer.tic();
+		if (config.rank_error)
+		{
+			row.add("rank_pops", rank_hist.count())
+			   .add("rank_mean", rank_hist.mean())
+			   .add("rank_p50", rank_hist.percentile(50))
+			   .add("rank_p99", rank_hist.percentile(99))
+			   .add("rank_p999", rank_hist.percentile(99.9))
+			   .add("rank_max", rank_hist.max())
+			   .add("rank_unmatched", rank_unmatched);
+		}
+
+		if (config.sample_interval_us)
+		{
+			if (sustained_time > 0)
+				row.add("sustained_throughput", sustained_ops / sustained_time);
+			else
+				row.add_missing("sustained_throughput");
+
+			row.add("failed_pops", failed_pops)
+			   .add("size_min", size_min)
+			   .add("size_max", size_max)
+			   .add("size_final", size_final);
+		}
 
-			#pragma omp parallel private(rng) shared(queue) num_threads(nthreads)
+		if (config.perf)
+		{
+			Perf_counters probe(config.perf_raw);
+
+			for (int i=0; i<Perf_counters::NEVENTS; ++i)
 			{
-				rng.seed(seed + omp_get_thread_num()+1);
-				std::size_t priority, value;
-		
-				#pragma omp for	
-				for (std::size_t i=0; i<problem_size; ++i)
-				{
-					if (rng() % 2)
-					{
-						priority = rng();
-						queue.push(priority, priority);
-					}
-					else
-						queue.pop(value);
-				} 
+				std::string key = std::string(Perf_counters::name(i)) + "_per_op";
+				if (probe.available(i))
+					row.add(key, perf_counts[i] / (double(nops) * nreps));
+				else
+					row.add_missing(key);
 			}
-	
-			double elapsed_time = timer.toc();
-			sum_time += elapsed_time;
-			sum_time2 += elapsed_time*elapsed_time;
 		}
-	
-		double mean_time = sum_time / nreps;
-		double sigma_time = std::sqrt(1./(nreps-1)*(sum_time2/nreps - mean_time*mean_time));
-	
- 		out.precision(8);
-		out << std::fixed;
-		out << std::right 	<< std::setw(20) << nthreads
-					 		<< std::setw(20) << mean_time
-							<< std::setw(20) << sigma_time << std::endl;
+
+		if (CPQ_STATS_ENABLED)
+			for (int i=0; i<CPQ_stats::NCOUNTERS; ++i)
+				row.add(CPQ_stats::name(i), stats.counts[i]);
+
+		out.write(row);
 	}
 }
-
@@ -7,6 +7,9 @@
  *	The problem size is fixed while the number of concurrent threads changes.
  *	The priorities are chosen randomly and a constant seed guarantees that the exact
  *	same sequence of operations is repeated.
+ *
+ *	The queues are accessed through small adaptors with a common push/pop
+ *	interface, hence every benchmark is a template over the adaptor.
  */
 
 #ifndef BENCHMARK_HPP
@@ -21,38 +24,320 @@
 #include <omp.h>
 #include <cmath>
 #include <string>
+#include <vector>
 
 #include "CPQ.hpp"
+#include "Adaptive_CPQ.hpp"
+#include "Buffered_CPQ.hpp"
+#include "Interval_CPQ.hpp"
+#include "bucket_queue.hpp"
+#include "external_PQ.hpp"
 #include "tbb/concurrent_priority_queue.h"
 #include "timer.hpp"
+#include "report.hpp"
+#include "histogram.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
+#include "rank_error.hpp"
+#include "scenario.hpp"
+#include "topology.hpp"
+
+/****************************
+ * 	   Configuration 		*
+ ****************************/
+struct Benchmark_config
+{
+	std::size_t problem_size;
+	std::size_t init_size;
+	std::size_t nreps;
+	std::size_t seed;
+	std::vector<std::size_t> nthreads;
+	std::vector<int> cpus;	// thread i runs on cpus[i % size] (empty: not pinned)
+	bool latency;		// record per-operation latency histograms
+	bool rank_error;	// log operations and measure the rank error of pops
+	bool perf;			// count hardware events with perf_event_open
+	std::uint64_t perf_raw;	// raw event for cache-line transfers (0: none)
+	const Trace_reader* trace;	// replayed by the "replay" benchmark
+	bool trace_delays;	// honour the recorded inter-arrival delays
+	Scenario_config scenario;	// run by the "scenario" benchmark
+	std::size_t sample_interval_us;	// sample the queue size (0: off)
+	Result_writer* trajectory;	// receives the samples (may be 0)
+	Timeline_writer* timeline;	// receives the CPQ timelines (may be 0)
+};
+
+/****************************
+ * 		Workloads 			*
+ ****************************/
+// A workload runs its share of the timed loop in every thread of the parallel
+// region (run) and knows how many operations the loop performs in total.
+
+// The synthetic workloads share problem_size random operations among the
+// threads, every operation is called with the thread private rng
+template< class op_t >
+struct Random_workload
+{
+	static const char* name() { return op_t::name(); }
+
+	inline std::size_t operations(const Benchmark_config& config) const
+	{
+		return config.problem_size;
+	}
+
+	template< class queue_t >
+	inline void run(queue_t& queue, const Benchmark_config& config) const
+	{
+		std::default_random_engine rng(config.seed + omp_get_thread_num()+1);
+		op_t op;
+
+		#pragma omp for nowait
+		for (std::size_t i=0; i<config.problem_size; ++i)
+			op(queue, rng);
+	}
+};
+
+struct Insert_op
+{
+	static const char* name() { return "insert"; }
+
+	template< class queue_t, class rng_t >
+	inline void operator()(queue_t& queue, rng_t& rng) const
+	{
+		std::size_t priority = rng();
+		queue.push(priority, priority);
+	}
+};
+
+struct Delete_op
+{
+	static const char* name() { return "delete"; }
+
+	template< class queue_t, class rng_t >
+	inline void operator()(queue_t& queue, rng_t& rng) const
+	{
+		std::size_t value;
+		queue.pop(value);
+	}
+};
+
+struct Mixed_op
+{
+	static const char* name() { return "mixed"; }
+
+	template< class queue_t, class rng_t >
+	inline void operator()(queue_t& queue, rng_t& rng) const
+	{
+		if (rng() % 2)
+		{
+			std::size_t priority = rng();
+			queue.push(priority, priority);
+		}
+		else
+		{
+			std::size_t value;
+			queue.pop(value);
+		}
+	}
+};
+
+typedef Random_workload<Insert_op> Insert_workload;
+typedef Random_workload<Delete_op> Delete_workload;
+typedef Random_workload<Mixed_op> Mixed_workload;
+
+// Replays the streams of config.trace. Stream s is replayed by thread
+// s % nthreads, hence surplus threads stay idle and surplus streams are
+// replayed one after the other. With config.trace_delays every thread
+// busy-waits for the recorded inter-arrival delay before an operation.
+struct Replay_workload
+{
+	static const char* name() { return "replay"; }
+
+	inline std::size_t operations(const Benchmark_config& config) const
+	{
+		return config.trace->total_records();
+	}
+
+	template< class queue_t >
+	void run(queue_t& queue, const Benchmark_config& config) const
+	{
+		const Trace_reader& trace = *config.trace;
+		std::size_t value;
+
+		for (std::size_t s=omp_get_thread_num(); s<trace.streams(); s+=omp_get_num_threads())
+		{
+			const Trace_record* records = trace.stream(s);
+			std::size_t nrecords = trace.records(s);
+
+			for (std::size_t i=0; i<nrecords; ++i)
+			{
+				if (config.trace_delays && records[i].delay_ns)
+				{
+					std::uint64_t until = Latency_clock::monotonic_ns() + records[i].delay_ns;
+					while (Latency_clock::monotonic_ns() < until) do_nothing();
+				}
 
-template <class value_t, class lock_t, class counter_t, class ostream_t = std::ostream >
-void benchmark_insert_operations(const std::size_t problem_size, const std::size_t init_size,
-								 const std::size_t nreps, const std::size_t seed, 
-								 const std::size_t max_nthreads, ostream_t& out = std::cout);
+				if (records[i].op == Trace_record::INSERT)
+					queue.push(records[i].priority, records[i].priority);
+				else
+					queue.pop(value);
+			}
+		}
+	}
+};
+
+// Runs config.scenario: problem_size operations of which a fraction of
+// insert_ratio are inserts. With a producer:consumer split the producers
+// share the inserts and the consumers share the pops, otherwise every thread
+// inserts with probability insert_ratio. Inserts come in bursts of burst_size
+// followed by a busy-wait of burst_gap_ns.
+struct Scenario_workload
+{
+	static const char* name() { return "scenario"; }
+
+	inline std::size_t operations(const Benchmark_config& config) const
+	{
+		return config.problem_size;
+	}
 
-template <class value_t, class lock_t, class counter_t, class ostream_t = std::ostream >
-void benchmark_delete_operations(const std::size_t problem_size, const std::size_t init_size, 
-								 const std::size_t nreps, const std::size_t seed, 
-								 const std::size_t max_nthreads, ostream_t& out = std::cout);
+	template< class queue_t >
+	void run(queue_t& queue, const Benchmark_config& config) const
+	{
+		const Scenario_config& scenario = config.scenario;
+		std::size_t tid = omp_get_thread_num();
+		std::size_t nthreads = omp_get_num_threads();
+		std::size_t nproducers = scenario.producers(nthreads);
+
+		std::default_random_engine rng(config.seed + tid+1);
+		Priority_generator priority(scenario, tid, nthreads);
+		std::size_t inserts = 0;
+		std::size_t value;
+
+		if (nproducers == 0)
+		{
+			std::bernoulli_distribution insert(scenario.insert_ratio);
+
+			#pragma omp for nowait
+			for (std::size_t i=0; i<config.problem_size; ++i)
+				if (insert(rng))
+					push(queue, priority(rng), inserts, scenario);
+				else
+					queue.pop(value);
+		}
+		else
+		{
+			std::size_t ninserts = std::size_t(scenario.insert_ratio * config.problem_size + 0.5);
+			ninserts = std::min(ninserts, config.problem_size);
+
+			if (tid < nproducers)
+			{
+				for (std::size_t i=share(ninserts, tid, nproducers); i>0; --i)
+					push(queue, priority(rng), inserts, scenario);
+			}
+			else
+			{
+				std::size_t nconsumers = nthreads - nproducers;
+				for (std::size_t i=share(config.problem_size - ninserts, tid - nproducers, nconsumers); i>0; --i)
+					queue.pop(value);
+			}
+		}
+	}
+
+private:
+	// Number of the n operations done by worker i of nworkers
+	static inline std::size_t share(std::size_t n, std::size_t i, std::size_t nworkers)
+	{
+		return n*(i+1)/nworkers - n*i/nworkers;
+	}
+
+	template< class queue_t >
+	static inline void push(queue_t& queue, std::size_t priority, std::size_t& inserts,
+							const Scenario_config& scenario)
+	{
+		queue.push(priority, priority);
+
+		if (scenario.burst_size && ++inserts % scenario.burst_size == 0)
+		{
+			std::uint64_t until = Latency_clock::monotonic_ns() + scenario.burst_gap_ns;
+			while (Latency_clock::monotonic_ns() < until) do_nothing();
+		}
+	}
+};
 
-template <class value_t, class lock_t, class counter_t, class ostream_t = std::ostream >
-void benchmark_mixed_operations(const std::size_t problem_size, const std::size_t init_size, 
-								const std::size_t nreps, const std::size_t seed, 
-								const std::size_t max_nthreads, ostream_t& out = std::cout);
+/**
+ *	benchmark_operations: 	Runs the workload for every thread count of the
+ *							configuration and writes one row per thread count.
+ *							The row starts with the given labels (queue, lock, ...)
+ */
+template <class queue_t, class workload_t>
+void benchmark_operations(const Benchmark_config& config, Result_writer& out,
+						  const Result_row& labels);
 
 /****************************
  * 			CPQ 	 		*
  ****************************/
 template< 	class value_t,  class lock_t = omp_lock, 
-			class counter_t = Bit_reversed_counter> 
+			class counter_t = Bit_reversed_counter, class layout_t = Heap_layout> 
 class queue_CPQ
 {
+public:
+	inline void push(value_t val, std::size_t priority) { queue_.insert(val, priority); }
+	inline bool pop(value_t& val) { return queue_.pop_front(val); }
+	inline CPQ_stats stats() const { return queue_.stats(); }
+	inline void write_timeline(Timeline_writer& out, const std::string& name,
+							   std::uint64_t since) const
+	{
+		queue_.write_timeline(out, name, since);
+	}
+private:
+	CPQ<value_t,lock_t,counter_t,Vector_storage,layout_t> queue_;
+};
+
+/****************************
+ * 		Adaptive CPQ 		*
+ ****************************/
+template< 	class value_t,  class lock_t = omp_lock, 
+			class counter_t = Bit_reversed_counter> 
+class queue_Adaptive
+{
+public:
+	inline void push(value_t val, std::size_t priority) { queue_.insert(val, priority); }
+	inline bool pop(value_t& val) { return queue_.pop_front(val); }
+	inline CPQ_stats stats() const { return queue_.stats(); }
+	inline void write_timeline(Timeline_writer& out, const std::string& name,
+							   std::uint64_t since) const
+	{
+		queue_.write_timeline(out, name, since);
+	}
+private:
+	Adaptive_CPQ<value_t,lock_t,counter_t> queue_;
+};
+
+/****************************
+ * 		Buffered CPQ 		*
+ ****************************/
+template< 	class value_t,  class lock_t = omp_lock, 
+			class counter_t = Bit_reversed_counter> 
+class queue_Buffered
+{
+public:
+	inline void push(value_t val, std::size_t priority) { queue_.insert(val, priority); }
+	inline bool pop(value_t& val) { return queue_.pop_front(val); }
+private:
+	Buffered_CPQ<value_t,lock_t,counter_t> queue_;
+};
+
+/****************************
+ * 		Interval CPQ 		*
+ ****************************/
+// Pops from the front only, like the other queues
+template< 	class value_t,  class lock_t = omp_lock, 
+			class counter_t = Bit_reversed_counter> 
+class queue_Interval
+{
 public:
 	inline void push(value_t val, std::size_t priority) { queue_.insert(val, priority); }
 	inline bool pop(value_t& val) { return queue_.pop_front(val); }
 private:
-	CPQ<value_t,lock_t,counter_t> queue_;
+	Interval_CPQ<value_t,lock_t,counter_t> queue_;
 };
 
 /****************************
@@ -69,6 +354,37 @@ private:
 	tbb::concurrent_priority_queue<std::size_t> queue_;
 };
 
+/****************************
+ * 		Bucket Queue		*
+ ****************************/
+// The random priorities of the benchmarks are folded into the priority levels
+template< 	class value_t,  class lock_t = omp_lock, 
+			class counter_t = Bit_reversed_counter, std::size_t nlevels = 256> 
+class queue_Bucket
+{
+public:
+	inline void push(value_t val, std::size_t priority) { queue_.insert(val, priority % nlevels); }
+	inline bool pop(value_t& val) { return queue_.pop_front(val); }
+private:
+	Bucket_queue<value_t, nlevels> queue_;
+};
+
+/****************************
+ * 	External memory Queue	*
+ ****************************/
+// Keeps about budget_kib KiB in memory, the rest is spilled to runs in /tmp
+template< 	class value_t,  class lock_t = omp_lock, 
+			class counter_t = Bit_reversed_counter, std::size_t budget_kib = 1024> 
+class queue_External
+{
+public:
+	queue_External() : queue_(budget_kib << 10) {}
+	inline void push(value_t val, std::size_t priority) { queue_.insert(val, priority); }
+	inline bool pop(value_t& val) { return queue_.pop_front(val); }
+private:
+	External_PQ<value_t, lock_t, counter_t> queue_;
+};
+
 /****************************
  * 			STL Queue 		*
  ****************************/
@@ -105,4 +421,41 @@ private:
 	std::priority_queue<std::size_t> queue_;
 };
 
+/****************************
+ * 		  Statistics 		*
+ ****************************/
+// Contention statistics of the queue, only the CPQs collect them
+template< class queue_t >
+inline CPQ_stats queue_stats(const queue_t&) { return CPQ_stats(); }
+
+template< class value_t, class lock_t, class counter_t, class layout_t >
+inline CPQ_stats queue_stats(const queue_CPQ<value_t, lock_t, counter_t, layout_t>& queue)
+{
+	return queue.stats();
+}
+
+template< class value_t, class lock_t, class counter_t >
+inline CPQ_stats queue_stats(const queue_Adaptive<value_t, lock_t, counter_t>& queue)
+{
+	return queue.stats();
+}
+
+// Timeline of the queue since a time stamp, only the CPQs record one
+template< class queue_t >
+inline void queue_timeline(const queue_t&, Timeline_writer&, const std::string&, std::uint64_t) {}
+
+template< class value_t, class lock_t, class counter_t, class layout_t >
+inline void queue_timeline(const queue_CPQ<value_t, lock_t, counter_t, layout_t>& queue,
+						   Timeline_writer& out, const std::string& name, std::uint64_t since)
+{
+	queue.write_timeline(out, name, since);
+}
+
+template< class value_t, class lock_t, class counter_t >
+inline void queue_timeline(const queue_Adaptive<value_t, lock_t, counter_t>& queue,
+						   Timeline_writer& out, const std::string& name, std::uint64_t since)
+{
+	queue.write_timeline(out, name, since);
+}
+
 #endif // BENCHMARK_HPP
@@ -1,6 +1,32 @@
 #!/bin/sh
-rm -f output/*.dat
+# Sweep all queues and all locks/counters of the CPQs, see ./benchmark --help
+mkdir -p output
+rm -f output/benchmark.csv
 
-./benchmark_CPQ
-./benchmark_STL
-./benchmark_Intel
+./benchmark --queue CPQ,Adaptive,STL,Intel,Bucket \
+			--lock omp,TAS,TATAS,TASexpbo,ticket,MCS,CLH,tagged,versioned,futex,adaptive_pause,adaptive_exp,adaptive_rand,adaptive_yield \
+			--counter bitrev,linear \
+			--threads 1-7:2 \
+			--format csv --output output/benchmark.csv
+
+# Application kernels (SSSP, event simulation, branch-and-bound)
+rm -f output/apps.csv
+./benchmark_apps --queue CPQ,Intel,STL --lock omp,TATAS,MCS,versioned \
+				 --threads 1,2,4 --format csv --output output/apps.csv
+
+# Producer/consumer scenario: 1 producer per 3 consumers, bursty zipf inserts
+rm -f output/scenario.csv output/scenario_size.csv
+./benchmark --benchmark scenario --queue CPQ,STL,Intel --lock omp,TATAS,MCS \
+			--split 1:3 --burst 64:100000 --distribution zipf --threads 2-8:2 \
+			--trajectory output/scenario_size.csv --format csv --output output/scenario.csv
+
+# Topology sweep: 1 to all hardware threads and oversubscribed, every pinning
+rm -f output/pinning.csv
+./benchmark --queue CPQ --lock omp,TATAS,MCS --threads sweep \
+			--pin compact,scatter,smt-first,socket-fill \
+			--format csv --output output/pinning.csv
+
+# Lock microbenchmarks: latency, handoff, contended throughput and fairness
+rm -f output/locks.csv
+./benchmark_locks --threads sweep --cs 0,100 --pin compact,scatter \
+				  --format csv --output output/locks.csv
@@ -0,0 +1,837 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	Application benchmarks for concurrent priority queues
+ *
+ *	Raw insert/pop_front throughput does not show how the ordering quality
+ *	of a concurrent queue affects the total work of an application. These
+ *	kernels run on top of the queue adaptors of benchmark.hpp:
+ *
+ *		sssp		parallel label-correcting Dijkstra on an R-MAT or a grid
+ *					graph. With --delta D the priority is dist/D, hence all
+ *					vertices of a bucket are equal (Delta-stepping order).
+ *		des			PHOLD-like discrete event simulation, the priority is the
+ *					timestamp of the event.
+ *		knapsack	best-first branch-and-bound for 0/1 knapsack, the priority
+ *					is the fractional upper bound of a node.
+ *
+ *	Every kernel reports its end-to-end time and the wasted work caused by
+ *	popping elements out of order:
+ *
+ *		sssp		stale pops (vertex already expanded with a shorter or equal
+ *					distance) plus re-expansions of a vertex
+ *		des			stragglers, i.e events whose timestamp is smaller than the
+ *					local clock of their logical process (they would trigger a
+ *					rollback in an optimistic simulator)
+ *		knapsack	pops of pruned nodes plus expansions of nodes whose bound is
+ *					below the optimum (a sequential best-first search never
+ *					expands them)
+ *
+ *	and whether the result matches a sequential reference. The TBB and STL
+ *	adaptors only store priorities, so every kernel packs its payload into
+ *	the low bits of the priority and decodes the popped value.
+ *
+ *		./benchmark_apps --app sssp,des,knapsack --queue CPQ,Intel,STL \
+ *						 --threads 1,2,4 --format csv
+ *
+ *	Run ./benchmark_apps --help for all options.
+ */
+
+#include "benchmark.hpp"
+#include "options.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+
+/****************************
+ * 		 Termination 		*
+ ****************************/
+// Number of pushed elements whose processing has not finished yet. A thread
+// may stop once its pop fails and no element is pending anymore.
+class Pending_work
+{
+public:
+	Pending_work() : pending_(0) {}
+
+	inline void add() { pending_.fetch_add(1, std::memory_order_relaxed); }
+	inline void done() { pending_.fetch_sub(1, std::memory_order_release); }
+	inline bool finished() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+	std::atomic<long> pending_;
+};
+
+// Counters of one run, summed over all threads
+struct App_counters
+{
+	App_counters() : pushes(0), pops(0), wasted(0), correct(true) {}
+
+	std::size_t pushes;
+	std::size_t pops;
+	std::size_t wasted;
+	bool correct;
+};
+
+static const std::uint64_t LOW_MASK = 0xffffffffull;
+
+// Smaller keys first: the queues return the largest priority
+inline std::size_t encode_min(std::uint64_t key, std::uint64_t payload, unsigned bits)
+{
+	return ((((std::uint64_t(1) << (64 - bits)) - 1 - key) << bits) | payload);
+}
+
+/****************************
+ * 		   Graphs 			*
+ ****************************/
+struct Graph
+{
+	std::string name;
+	std::uint32_t nvertices;
+	std::vector<std::size_t> offsets;		// CSR, nvertices + 1 entries
+	std::vector<std::uint32_t> targets;
+	std::vector<std::uint32_t> weights;
+};
+
+// Sort an edge list into CSR
+void build_csr(Graph& g, std::vector<std::pair<std::uint32_t, std::uint32_t> >& edges,
+			   std::default_random_engine& rng, std::uint32_t max_weight)
+{
+	std::sort(edges.begin(), edges.end());
+
+	g.offsets.assign(g.nvertices + 1, 0);
+	g.targets.resize(edges.size());
+	g.weights.resize(edges.size());
+
+	for(std::size_t e = 0; e < edges.size(); ++e)
+	{
+		g.offsets[edges[e].first + 1]++;
+		g.targets[e] = edges[e].second;
+		g.weights[e] = 1 + rng() % max_weight;
+	}
+
+	for(std::uint32_t v = 0; v < g.nvertices; ++v)
+		g.offsets[v + 1] += g.offsets[v];
+}
+
+// R-MAT graph (a, b, c, d) = (0.57, 0.19, 0.19, 0.05) with 2^scale vertices
+Graph make_rmat(unsigned scale, std::size_t edge_factor, std::size_t seed)
+{
+	Graph g;
+	g.name = "rmat" + std::to_string(scale);
+	g.nvertices = std::uint32_t(1) << scale;
+
+	std::default_random_engine rng(seed);
+	std::uniform_real_distribution<double> coin(0.0, 1.0);
+
+	std::vector<std::pair<std::uint32_t, std::uint32_t> > edges;
+	edges.reserve(edge_factor * g.nvertices);
+
+	for(std::size_t e = 0; e < edge_factor * g.nvertices; ++e)
+	{
+		std::uint32_t u = 0, v = 0;
+		for(unsigned bit = 0; bit < scale; ++bit)
+		{
+			double r = coin(rng);
+			if(r < 0.57) {}
+			else if(r < 0.76) v |= 1u << bit;
+			else if(r < 0.95) u |= 1u << bit;
+			else { u |= 1u << bit; v |= 1u << bit; }
+		}
+		edges.push_back(std::make_pair(u, v));
+	}
+
+	build_csr(g, edges, rng, 255);
+	return g;
+}
+
+// Square grid with 4-neighbourhood and edges in both directions
+Graph make_grid(std::uint32_t side, std::size_t seed)
+{
+	Graph g;
+	g.name = "grid" + std::to_string(side);
+	g.nvertices = side * side;
+
+	std::default_random_engine rng(seed);
+	std::vector<std::pair<std::uint32_t, std::uint32_t> > edges;
+
+	for(std::uint32_t y = 0; y < side; ++y)
+		for(std::uint32_t x = 0; x < side; ++x)
+		{
+			std::uint32_t v = y * side + x;
+			if(x + 1 < side) { edges.push_back(std::make_pair(v, v + 1)); edges.push_back(std::make_pair(v + 1, v)); }
+			if(y + 1 < side) { edges.push_back(std::make_pair(v, v + side)); edges.push_back(std::make_pair(v + side, v)); }
+		}
+
+	build_csr(g, edges, rng, 255);
+	return g;
+}
+
+static const std::uint32_t INF = 0xffffffffu;
+
+std::vector<std::uint32_t> dijkstra_reference(const Graph& g, std::uint32_t source)
+{
+	typedef std::pair<std::uint32_t, std::uint32_t> entry_t;
+	std::priority_queue<entry_t, std::vector<entry_t>, std::greater<entry_t> > queue;
+	std::vector<std::uint32_t> dist(g.nvertices, INF);
+
+	dist[source] = 0;
+	queue.push(entry_t(0, source));
+
+	while(!queue.empty())
+	{
+		entry_t top = queue.top();
+		queue.pop();
+		if(top.first > dist[top.second]) continue;
+
+		for(std::size_t e = g.offsets[top.second]; e < g.offsets[top.second + 1]; ++e)
+		{
+			std::uint32_t nd = top.first + g.weights[e];
+			if(nd < dist[g.targets[e]])
+			{
+				dist[g.targets[e]] = nd;
+				queue.push(entry_t(nd, g.targets[e]));
+			}
+		}
+	}
+	return dist;
+}
+
+/****************************
+ * 			SSSP 			*
+ ****************************/
+struct Sssp_instance
+{
+	Graph graph;
+	std::uint32_t delta;
+	std::vector<std::uint32_t> reference;
+};
+
+template< class queue_t >
+App_counters run_sssp(const Sssp_instance& instance, std::size_t nthreads)
+{
+	const Graph& g = instance.graph;
+	std::unique_ptr<std::atomic<std::uint32_t>[]> dist(new std::atomic<std::uint32_t>[g.nvertices]);
+	std::unique_ptr<std::atomic<std::uint32_t>[]> expanded(new std::atomic<std::uint32_t>[g.nvertices]);
+
+	for(std::uint32_t v = 0; v < g.nvertices; ++v)
+	{
+		dist[v].store(INF, std::memory_order_relaxed);
+		expanded[v].store(INF, std::memory_order_relaxed);
+	}
+
+	queue_t queue;
+	Pending_work work;
+	App_counters counters;
+	std::size_t expansions = 0, stale = 0, pushes = 1, pops = 0;
+
+	dist[0].store(0);
+	work.add();
+	queue.push(encode_min(0, 0, 32), encode_min(0, 0, 32));
+
+	#pragma omp parallel num_threads(nthreads) reduction(+:expansions, stale, pushes, pops)
+	{
+		std::size_t code;
+
+		for(;;)
+		{
+			if(!queue.pop(code))
+			{
+				if(work.finished()) break;
+				do_nothing();
+				continue;
+			}
+
+			pops++;
+			std::uint32_t v = code & LOW_MASK;
+			std::uint32_t d = dist[v].load(std::memory_order_acquire);
+			std::uint32_t last = expanded[v].load(std::memory_order_relaxed);
+
+			// Expand every vertex at most once per distance
+			if(last <= d || !expanded[v].compare_exchange_strong(last, d))
+			{
+				stale++;
+				work.done();
+				continue;
+			}
+
+			expansions++;
+			for(std::size_t e = g.offsets[v]; e < g.offsets[v + 1]; ++e)
+			{
+				std::uint32_t u = g.targets[e];
+				std::uint32_t nd = d + g.weights[e];
+				std::uint32_t cur = dist[u].load(std::memory_order_relaxed);
+
+				while(nd < cur)
+					if(dist[u].compare_exchange_weak(cur, nd))
+					{
+						std::size_t priority = encode_min(nd / instance.delta, u, 32);
+						work.add();
+						queue.push(priority, priority);
+						pushes++;
+						break;
+					}
+			}
+			work.done();
+		}
+	}
+
+	std::size_t reached = 0;
+	for(std::uint32_t v = 0; v < g.nvertices; ++v)
+	{
+		if(dist[v].load() != INF) reached++;
+		if(dist[v].load() != instance.reference[v]) counters.correct = false;
+	}
+
+	counters.pushes = pushes;
+	counters.pops = pops;
+	counters.wasted = stale + (expansions - reached);
+	return counters;
+}
+
+/****************************
+ * 	 Discrete events (PHOLD)	*
+ ****************************/
+struct Des_instance
+{
+	std::uint32_t nlps;				// logical processes, at most 2^20
+	std::uint32_t events_per_lp;	// initial events
+	std::uint64_t end_time;
+	std::uint64_t mean_increment;
+	std::size_t grain;				// busy work per event
+	std::size_t seed;
+	std::size_t reference;			// events processed sequentially
+};
+
+static const unsigned LP_BITS = 20;
+
+// The children of an event only depend on the event itself, hence every
+// processing order simulates the same set of events
+inline std::uint64_t mix(std::uint64_t x)
+{
+	x ^= x >> 33; x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ull;
+	return x ^ (x >> 33);
+}
+
+inline void next_event(const Des_instance& instance, std::uint64_t ts, std::uint32_t lp,
+					   std::uint64_t& next_ts, std::uint32_t& next_lp)
+{
+	std::uint64_t h = mix(instance.seed ^ mix(ts * instance.nlps + lp));
+	next_ts = ts + 1 + h % (2 * instance.mean_increment);
+	next_lp = (h >> 32) % instance.nlps;
+}
+
+volatile std::uint64_t des_sink;
+
+inline std::uint64_t simulate_work(std::uint64_t x, std::size_t grain)
+{
+	for(std::size_t i = 0; i < grain; ++i) x = mix(x + i);
+	return x;
+}
+
+std::size_t des_reference(const Des_instance& instance)
+{
+	std::size_t processed = 0;
+	std::vector<std::pair<std::uint64_t, std::uint32_t> > stack;
+
+	for(std::uint32_t lp = 0; lp < instance.nlps; ++lp)
+		for(std::uint32_t k = 0; k < instance.events_per_lp; ++k)
+			stack.push_back(std::make_pair(k, lp));
+
+	// The event tree does not depend on the order, a stack is enough
+	while(!stack.empty())
+	{
+		std::uint64_t ts = stack.back().first;
+		std::uint32_t lp = stack.back().second;
+		stack.pop_back();
+		processed++;
+
+		std::uint64_t next_ts;
+		std::uint32_t next_lp;
+		next_event(instance, ts, lp, next_ts, next_lp);
+		if(next_ts < instance.end_time)
+			stack.push_back(std::make_pair(next_ts, next_lp));
+	}
+	return processed;
+}
+
+template< class queue_t >
+App_counters run_des(const Des_instance& instance, std::size_t nthreads)
+{
+	std::unique_ptr<std::atomic<std::uint64_t>[]> clock(new std::atomic<std::uint64_t>[instance.nlps]);
+	for(std::uint32_t lp = 0; lp < instance.nlps; ++lp)
+		clock[lp].store(0, std::memory_order_relaxed);
+
+	queue_t queue;
+	Pending_work work;
+	App_counters counters;
+	std::size_t stragglers = 0, pushes = 0, pops = 0;
+	std::uint64_t checksum = 0;
+
+	for(std::uint32_t lp = 0; lp < instance.nlps; ++lp)
+		for(std::uint32_t k = 0; k < instance.events_per_lp; ++k)
+		{
+			std::size_t priority = encode_min(k, lp, LP_BITS);
+			work.add();
+			queue.push(priority, priority);
+			pushes++;
+		}
+
+	#pragma omp parallel num_threads(nthreads) reduction(+:stragglers, pushes, pops, checksum)
+	{
+		std::size_t code;
+
+		for(;;)
+		{
+			if(!queue.pop(code))
+			{
+				if(work.finished()) break;
+				do_nothing();
+				continue;
+			}
+
+			pops++;
+			std::uint32_t lp = code & ((1u << LP_BITS) - 1);
+			std::uint64_t ts = ((std::uint64_t(1) << (64 - LP_BITS)) - 1) - (code >> LP_BITS);
+
+			// Advance the local clock of the logical process
+			std::uint64_t now = clock[lp].load(std::memory_order_relaxed);
+			while(now < ts && !clock[lp].compare_exchange_weak(now, ts)) {}
+			if(ts < now)
+				stragglers++;
+
+			checksum += simulate_work(ts ^ lp, instance.grain);
+
+			std::uint64_t next_ts;
+			std::uint32_t next_lp;
+			next_event(instance, ts, lp, next_ts, next_lp);
+			if(next_ts < instance.end_time)
+			{
+				std::size_t priority = encode_min(next_ts, next_lp, LP_BITS);
+				work.add();
+				queue.push(priority, priority);
+				pushes++;
+			}
+			work.done();
+		}
+	}
+
+	// Keep the busy work alive
+	des_sink = checksum;
+
+	counters.pushes = pushes;
+	counters.pops = pops;
+	counters.wasted = stragglers;
+	counters.correct = pops == instance.reference;
+	return counters;
+}
+
+/****************************
+ * 	 Branch-and-bound 		*
+ ****************************/
+struct Knapsack_instance
+{
+	std::vector<std::uint32_t> weights;		// sorted by decreasing value density
+	std::vector<std::uint32_t> values;
+	std::uint32_t capacity;
+	std::size_t max_nodes;
+	std::uint64_t optimum;					// dynamic programming reference
+};
+
+Knapsack_instance make_knapsack(std::size_t nitems, std::size_t max_nodes, std::size_t seed)
+{
+	Knapsack_instance instance;
+	std::default_random_engine rng(seed);
+
+	// Strongly correlated instance (value = weight + 100), the bounds prune
+	// badly and the search expands many nodes
+	std::vector<std::pair<double, std::pair<std::uint32_t, std::uint32_t> > > items;
+	std::uint64_t total_weight = 0;
+	for(std::size_t i = 0; i < nitems; ++i)
+	{
+		std::uint32_t w = 1 + rng() % 1000;
+		std::uint32_t v = w + 100;
+		items.push_back(std::make_pair(-double(v) / w, std::make_pair(w, v)));
+		total_weight += w;
+	}
+	std::sort(items.begin(), items.end());
+
+	for(std::size_t i = 0; i < nitems; ++i)
+	{
+		instance.weights.push_back(items[i].second.first);
+		instance.values.push_back(items[i].second.second);
+	}
+	instance.capacity = total_weight / 2;
+	instance.max_nodes = max_nodes;
+
+	std::vector<std::uint64_t> best(instance.capacity + 1, 0);
+	for(std::size_t i = 0; i < nitems; ++i)
+		for(std::uint32_t c = instance.capacity; c >= instance.weights[i]; --c)
+			best[c] = std::max(best[c], best[c - instance.weights[i]] + instance.values[i]);
+	instance.optimum = best[instance.capacity];
+
+	return instance;
+}
+
+struct Bb_node
+{
+	std::uint32_t level;		// items [0, level) are decided
+	std::uint32_t weight;
+	std::uint32_t value;
+	std::uint32_t bound;
+	bool expanded;
+};
+
+// Fractional (Dantzig) upper bound of the subtree
+inline std::uint32_t knapsack_bound(const Knapsack_instance& instance, std::uint32_t level,
+									std::uint32_t weight, std::uint32_t value)
+{
+	double bound = value;
+	std::uint32_t room = instance.capacity - weight;
+
+	for(std::size_t i = level; i < instance.weights.size(); ++i)
+	{
+		if(instance.weights[i] <= room)
+		{
+			room -= instance.weights[i];
+			bound += instance.values[i];
+		}
+		else
+		{
+			bound += double(instance.values[i]) * room / instance.weights[i];
+			break;
+		}
+	}
+	return std::uint32_t(bound);
+}
+
+template< class queue_t >
+App_counters run_knapsack(const Knapsack_instance& instance, std::size_t nthreads)
+{
+	std::vector<Bb_node> nodes(instance.max_nodes);
+	std::atomic<std::size_t> nnodes(1);
+	std::atomic<std::uint64_t> best(0);
+	std::atomic<bool> overflow(false);
+
+	queue_t queue;
+	Pending_work work;
+	App_counters counters;
+	std::size_t pruned = 0, pushes = 1, pops = 0;
+	std::uint32_t nitems = instance.weights.size();
+
+	Bb_node root = { 0, 0, 0, knapsack_bound(instance, 0, 0, 0), false };
+	nodes[0] = root;
+	work.add();
+	queue.push(std::size_t(root.bound) << 32, std::size_t(root.bound) << 32);
+
+	#pragma omp parallel num_threads(nthreads) reduction(+:pruned, pushes, pops)
+	{
+		std::size_t code;
+
+		for(;;)
+		{
+			if(!queue.pop(code))
+			{
+				if(work.finished()) break;
+				do_nothing();
+				continue;
+			}
+
+			pops++;
+			Bb_node& node = nodes[code & LOW_MASK];
+
+			if(node.bound <= best.load(std::memory_order_relaxed))
+			{
+				pruned++;
+				work.done();
+				continue;
+			}
+			node.expanded = true;
+
+			// Children: take item node.level (if it fits) or leave it
+			for(int take = 1; take >= 0; --take)
+			{
+				std::uint32_t weight = node.weight + take * instance.weights[node.level];
+				std::uint32_t value = node.value + take * instance.values[node.level];
+				if(weight > instance.capacity)
+					continue;
+
+				// Every partial solution is feasible
+				std::uint64_t incumbent = best.load(std::memory_order_relaxed);
+				while(value > incumbent && !best.compare_exchange_weak(incumbent, value)) {}
+
+				std::uint32_t level = node.level + 1;
+				std::uint32_t bound = knapsack_bound(instance, level, weight, value);
+				if(level == nitems || bound <= best.load(std::memory_order_relaxed))
+					continue;
+
+				std::size_t index = nnodes.fetch_add(1, std::memory_order_relaxed);
+				if(index >= instance.max_nodes)
+				{
+					overflow.store(true, std::memory_order_relaxed);
+					continue;
+				}
+
+				Bb_node child = { level, weight, value, bound, false };
+				nodes[index] = child;
+
+				std::size_t priority = (std::size_t(bound) << 32) | index;
+				work.add();
+				queue.push(priority, priority);
+				pushes++;
+			}
+			work.done();
+		}
+	}
+
+	std::size_t useless = 0;
+	std::size_t used = std::min<std::size_t>(nnodes.load(), instance.max_nodes);
+	for(std::size_t i = 0; i < used; ++i)
+		if(nodes[i].expanded && nodes[i].bound < instance.optimum)
+			useless++;
+
+	counters.pushes = pushes;
+	counters.pops = pops;
+	counters.wasted = pruned + useless;
+	counters.correct = !overflow.load() && best.load() == instance.optimum;
+	return counters;
+}
+
+/****************************
+ * 		  Driver 			*
+ ****************************/
+struct App_config
+{
+	std::size_t nreps;
+	std::vector<std::size_t> nthreads;
+};
+
+struct App_instances
+{
+	std::vector<Sssp_instance> sssp;
+	Des_instance des;
+	Knapsack_instance knapsack;
+};
+
+template< class queue_t, class instance_t >
+void time_app(App_counters (*app)(const instance_t&, std::size_t), const instance_t& instance,
+			  const std::string& name, const App_config& config, Result_writer& out,
+			  const Result_row& labels)
+{
+	for(std::size_t t = 0; t < config.nthreads.size(); ++t)
+	{
+		double sum_time = 0, sum_time2 = 0;
+		App_counters total;
+		Timer timer;
+
+		for(std::size_t n = 0; n < config.nreps; ++n)
+		{
+			timer.tic();
+			App_counters counters = app(instance, config.nthreads[t]);
+			double elapsed_time = timer.toc();
+
+			sum_time += elapsed_time;
+			sum_time2 += elapsed_time*elapsed_time;
+			total.pushes += counters.pushes;
+			total.pops += counters.pops;
+			total.wasted += counters.wasted;
+			total.correct = total.correct && counters.correct;
+		}
+
+		std::size_t nreps = config.nreps;
+		double mean_time = sum_time / nreps;
+		double sigma_time = nreps < 2 ? 0.0 :
+			std::sqrt(std::max(0.0, 1./(nreps-1)*(sum_time2 - nreps*mean_time*mean_time)));
+
+		Result_row row;
+		row.add(labels)
+		   .add("instance", name)
+		   .add("nthreads", config.nthreads[t])
+		   .add("reps", nreps)
+		   .add("mean_time", mean_time)
+		   .add("sigma_time", sigma_time)
+		   .add("pushes", total.pushes / nreps)
+		   .add("pops", total.pops / nreps)
+		   .add("wasted", total.wasted / nreps)
+		   .add("wasted_fraction", total.pops ? double(total.wasted) / total.pops : 0.0)
+		   .add("correct", total.correct ? "yes" : "no");
+		out.write(row);
+	}
+}
+
+typedef void (*app_fn)(const std::string& app, const App_instances& instances,
+					   const App_config& config, Result_writer& out, const Result_row& labels);
+
+template< class queue_t >
+void run_app(const std::string& app, const App_instances& instances,
+			 const App_config& config, Result_writer& out, const Result_row& labels)
+{
+	Result_row row;
+	row.add(labels).add("app", app);
+
+	if(app == "sssp")
+		for(std::size_t i = 0; i < instances.sssp.size(); ++i)
+		{
+			const Sssp_instance& instance = instances.sssp[i];
+			std::string name = instance.graph.name + "/delta" + std::to_string(instance.delta);
+			time_app<queue_t>(&run_sssp<queue_t>, instance, name, config, out, row);
+		}
+	else if(app == "des")
+		time_app<queue_t>(&run_des<queue_t>, instances.des,
+						  "phold" + std::to_string(instances.des.nlps), config, out, row);
+	else if(app == "knapsack")
+		time_app<queue_t>(&run_knapsack<queue_t>, instances.knapsack,
+						  "knapsack" + std::to_string(instances.knapsack.weights.size()),
+						  config, out, row);
+	else
+		throw std::invalid_argument("unknown app '" + app + "'");
+}
+
+void print_usage(std::ostream& out)
+{
+	out << "Usage: ./benchmark_apps [options]\n"
+		<< "  --app LIST            sssp,des,knapsack (default: all)\n"
+		<< "  --queue LIST          CPQ,Intel,STL (default: all)\n"
+		<< "  --lock LIST           omp,TATAS,MCS,versioned (CPQ only, default: omp)\n"
+		<< "  --threads LIST        e.g 1,2,4 or 1-8 (default: 1,2,4)\n"
+		<< "  --reps N              repetitions per thread count (default: 2)\n"
+		<< "  --seed N              seed of the generated instances (default: 1)\n"
+		<< "  --graph LIST          rmat,grid (default: both)\n"
+		<< "  --scale N             R-MAT graph with 2^N vertices (default: 14)\n"
+		<< "  --edge-factor N       R-MAT edges per vertex (default: 8)\n"
+		<< "  --grid-side N         grid graph with N^2 vertices (default: 128)\n"
+		<< "  --delta LIST          SSSP bucket widths, 1 is Dijkstra (default: 1,64)\n"
+		<< "  --lps N               logical processes of the simulation (default: 1024)\n"
+		<< "  --end-time N          simulated time (default: 10000)\n"
+		<< "  --grain N             busy work per simulated event (default: 100)\n"
+		<< "  --items N             knapsack items (default: 40)\n"
+		<< "  --max-nodes N         branch-and-bound node pool (default: 2^20)\n"
+		<< "  --format csv|json     output format (default: csv)\n"
+		<< "  --output FILE         write the results to FILE (default: stdout)\n";
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, app_fn> queues;
+	queues["CPQ/omp"] = &run_app< queue_CPQ<std::size_t, omp_lock> >;
+	queues["CPQ/TATAS"] = &run_app< queue_CPQ<std::size_t, TATAS_lock> >;
+	queues["CPQ/MCS"] = &run_app< queue_CPQ<std::size_t, MCS_lock> >;
+	queues["CPQ/versioned"] = &run_app< queue_CPQ<std::size_t, versioned_lock> >;
+	queues["Intel"] = &run_app< queue_Intel<std::size_t> >;
+	queues["STL"] = &run_app< queue_STL<std::size_t, STL_lock> >;
+
+	try
+	{
+		Options options(argc, argv);
+
+		if(options.has("help"))
+		{
+			print_usage(std::cout);
+			return 0;
+		}
+
+		App_config config;
+		config.nreps = options.get_size("reps", 2);
+		config.nthreads = options.get_range("threads", "1,2,4");
+		std::size_t seed = options.get_size("seed", 1);
+
+		if(config.nreps == 0 || config.nthreads.empty())
+			throw std::invalid_argument("--reps and --threads must not be empty");
+
+		std::vector<std::string> apps = options.get_list("app", "sssp,des,knapsack");
+		std::vector<std::string> queue_names = options.get_list("queue", "CPQ,Intel,STL");
+		std::vector<std::string> locks = options.get_list("lock", "omp");
+
+		// Generate all instances (and their references) before timing anything
+		App_instances instances;
+
+		if(std::find(apps.begin(), apps.end(), "sssp") != apps.end())
+		{
+			std::vector<std::string> graphs = options.get_list("graph", "rmat,grid");
+			std::vector<std::size_t> deltas = options.get_range("delta", "1,64");
+
+			for(std::size_t i = 0; i < graphs.size(); ++i)
+			{
+				Sssp_instance instance;
+				if(graphs[i] == "rmat")
+					instance.graph = make_rmat(options.get_size("scale", 14),
+											   options.get_size("edge-factor", 8), seed);
+				else if(graphs[i] == "grid")
+					instance.graph = make_grid(options.get_size("grid-side", 128), seed);
+				else
+					throw std::invalid_argument("unknown graph '" + graphs[i] + "'");
+
+				instance.reference = dijkstra_reference(instance.graph, 0);
+
+				for(std::size_t d = 0; d < deltas.size(); ++d)
+				{
+					if(deltas[d] == 0)
+						throw std::invalid_argument("--delta must be positive");
+					instance.delta = deltas[d];
+					instances.sssp.push_back(instance);
+				}
+			}
+		}
+
+		if(std::find(apps.begin(), apps.end(), "des") != apps.end())
+		{
+			Des_instance& des = instances.des;
+			des.nlps = options.get_size("lps", 1024);
+			des.events_per_lp = 4;
+			des.end_time = options.get_size("end-time", 10000);
+			des.mean_increment = 100;
+			des.grain = options.get_size("grain", 100);
+			des.seed = seed;
+
+			if(des.nlps == 0 || des.nlps > (1u << LP_BITS))
+				throw std::invalid_argument("--lps must be in [1, 2^20]");
+			des.reference = des_reference(des);
+		}
+
+		if(std::find(apps.begin(), apps.end(), "knapsack") != apps.end())
+			instances.knapsack = make_knapsack(options.get_size("items", 40),
+											   options.get_size("max-nodes", 1 << 20), seed);
+
+		std::ofstream fout;
+		if(options.has("output"))
+		{
+			fout.open(options.get("output", "").c_str());
+			if(!fout)
+				throw std::invalid_argument("cannot open '" + options.get("output", "") + "'");
+		}
+
+		Result_writer out(fout.is_open() ? fout : std::cout,
+						  Result_writer::parse_format(options.get("format", "csv")));
+
+		for(std::size_t q = 0; q < queue_names.size(); ++q)
+			for(std::size_t l = 0; l < locks.size(); ++l)
+			{
+				bool is_CPQ = queue_names[q] == "CPQ";
+				std::string key = is_CPQ ? "CPQ/" + locks[l] : queue_names[q];
+
+				// The lock only matters for the CPQ
+				if(!is_CPQ && l > 0) continue;
+
+				if(!queues.count(key))
+					throw std::invalid_argument("unknown queue '" + key + "'");
+
+				Result_row labels;
+				labels.add("queue", queue_names[q]).add("lock", is_CPQ ? locks[l] : "-");
+
+				for(std::size_t a = 0; a < apps.size(); ++a)
+					queues[key](apps[a], instances, config, out, labels);
+			}
+	}
+	catch(const std::invalid_argument& e)
+	{
+		std::cerr << "*** Error *** : " << e.what() << "\n\n";
+		print_usage(std::cerr);
+		return 1;
+	}
+
+	return 0;
+}
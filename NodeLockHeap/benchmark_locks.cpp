@@ -0,0 +1,445 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	Microbenchmarks of the locks in locks.hpp, independent of the CPQ
+ *
+ *		uncontended		lock/unlock pairs of a single thread, reported as the
+ *						mean time of one pair
+ *		handoff			two pinned threads pass the lock back and forth: the
+ *						next owner waits in lock() while the current owner
+ *						releases it. Reported is the time from the release to
+ *						the acquisition by the other thread (p50/p99/max).
+ *		contended		nthreads pinned threads acquire the lock in a loop for
+ *						--duration ms, the critical section increments --cs
+ *						words of shared data. Reported are the acquisitions per
+ *						second, the fairness of the per-thread acquisition
+ *						counts (Jain's index, 1 is perfectly fair) and the
+ *						smallest/largest count relative to the mean.
+ *
+ *	Every critical section also increments a plain shared counter, which must
+ *	match the number of acquisitions ("correct" column).
+ *
+ *		./benchmark_locks --lock TAS,TATAS,MCS,futex --threads sweep \
+ *						  --cs 0,100 --pin compact,scatter --format csv
+ *
+ *	Time is measured with Latency_clock (see histogram.hpp) and the threads
+ *	are pinned as in ./benchmark (see topology.hpp). All tests write the
+ *	same columns, the ones which do not apply to a test are missing.
+ *	Run ./benchmark_locks --help for all options.
+ */
+
+#include "benchmark.hpp"
+#include "options.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+
+/****************************
+ * 		Configuration 		*
+ ****************************/
+struct Lock_config
+{
+	std::size_t nreps;
+	std::vector<std::size_t> nthreads;
+	std::vector<std::size_t> cs_lengths;
+	std::size_t iterations;		// lock/unlock pairs of uncontended
+	std::size_t handoffs;		// handoffs of handoff
+	std::size_t duration_ms;	// length of one contended run
+	std::vector<int> cpus;		// pinning order (empty: not pinned)
+};
+
+// Data protected by the lock, away from the lock itself
+struct Shared_data
+{
+	static const std::size_t NWORDS = 64;
+
+	Shared_data() : counter(0)
+	{
+		for(std::size_t i = 0; i < NWORDS; ++i) words[i] = 0;
+	}
+
+	char pad0[64];
+	volatile std::size_t counter;
+	volatile std::size_t words[NWORDS];
+	char pad1[64];
+};
+
+inline void critical_section(Shared_data& data, std::size_t length)
+{
+	data.counter = data.counter + 1;
+	for(std::size_t i = 0; i < length; ++i)
+		data.words[i % Shared_data::NWORDS] = data.words[i % Shared_data::NWORDS] + 1;
+}
+
+inline void pin_thread(const Lock_config& config)
+{
+	if(!config.cpus.empty())
+		Topology::pin(config.cpus[omp_get_thread_num() % config.cpus.size()]);
+}
+
+// Columns shared by all tests
+Result_row make_row(const Result_row& labels, const std::string& test, std::size_t nthreads,
+					std::size_t cs_length, std::size_t nreps)
+{
+	Result_row row;
+	row.add(labels)
+	   .add("test", test)
+	   .add("nthreads", nthreads)
+	   .add("cs_length", cs_length)
+	   .add("reps", nreps);
+	return row;
+}
+
+double sigma(double sum, double sum2, std::size_t n)
+{
+	double mean = sum / n;
+	return n < 2 ? 0.0 : std::sqrt(std::max(0.0, 1./(n-1)*(sum2 - n*mean*mean)));
+}
+
+/****************************
+ * 		  Uncontended 		*
+ ****************************/
+template< class lock_t >
+void test_uncontended(const Lock_config& config, Result_writer& out, const Result_row& labels)
+{
+	double sum = 0, sum2 = 0;
+	bool correct = true;
+
+	for(std::size_t n = 0; n < config.nreps; ++n)
+	{
+		lock_t lock;
+		Shared_data data;
+		double ns = 0;
+
+		#pragma omp parallel num_threads(1)
+		{
+			pin_thread(config);
+
+			std::uint64_t start = Latency_clock::now();
+			for(std::size_t i = 0; i < config.iterations; ++i)
+			{
+				lock.lock();
+				critical_section(data, 0);
+				lock.unlock();
+			}
+			ns = (Latency_clock::now() - start) * Latency_clock::ns_per_tick() / config.iterations;
+		}
+
+		sum += ns;
+		sum2 += ns*ns;
+		correct = correct && data.counter == config.iterations;
+	}
+
+	Result_row row = make_row(labels, "uncontended", 1, 0, config.nreps);
+	row.add("mean_ns", sum / config.nreps)
+	   .add("sigma_ns", sigma(sum, sum2, config.nreps))
+	   .add_missing("p50_ns").add_missing("p99_ns").add_missing("max_ns")
+	   .add("throughput", 1e9 * config.nreps / sum)
+	   .add_missing("fairness").add_missing("min_share").add_missing("max_share")
+	   .add("correct", correct ? "yes" : "no");
+	out.write(row);
+}
+
+/****************************
+ * 		    Handoff 		*
+ ****************************/
+template< class lock_t >
+void test_handoff(const Lock_config& config, Result_writer& out, const Result_row& labels)
+{
+	Latency_histogram hist;
+	bool correct = true;
+
+	for(std::size_t n = 0; n < config.nreps; ++n)
+	{
+		lock_t lock;
+		Shared_data data;
+		std::atomic<int> turn(0);
+		std::uint64_t released = 0;		// written under the lock
+
+		#pragma omp parallel num_threads(2)
+		{
+			pin_thread(config);
+
+			int me = omp_get_thread_num();
+			Latency_histogram thread_hist;
+
+			for(std::size_t i = me; i < config.handoffs; i += 2)
+			{
+				// The other thread sets our turn while holding the lock, so
+				// we usually enter lock() before it is released
+				while(turn.load(std::memory_order_acquire) != me) do_nothing();
+
+				lock.lock();
+				std::uint64_t acquired = Latency_clock::now();
+				if(i > 0)
+					thread_hist.record(acquired - released);
+
+				critical_section(data, 0);
+				turn.store(1 - me, std::memory_order_release);
+				released = Latency_clock::now();
+				lock.unlock();
+			}
+
+			#pragma omp critical
+			hist.merge(thread_hist);
+		}
+
+		correct = correct && data.counter == config.handoffs;
+	}
+
+	double ns_per_tick = Latency_clock::ns_per_tick();
+
+	Result_row row = make_row(labels, "handoff", 2, 0, config.nreps);
+	row.add("mean_ns", hist.mean() * ns_per_tick)
+	   .add_missing("sigma_ns")
+	   .add("p50_ns", hist.percentile(50) * ns_per_tick)
+	   .add("p99_ns", hist.percentile(99) * ns_per_tick)
+	   .add("max_ns", hist.max() * ns_per_tick)
+	   .add_missing("throughput")
+	   .add_missing("fairness").add_missing("min_share").add_missing("max_share")
+	   .add("correct", correct ? "yes" : "no");
+	out.write(row);
+}
+
+/****************************
+ * 		   Contended 		*
+ ****************************/
+template< class lock_t >
+void test_contended(const Lock_config& config, Result_writer& out, const Result_row& labels)
+{
+	for(std::size_t c = 0; c < config.cs_lengths.size(); ++c)
+		for(std::size_t t = 0; t < config.nthreads.size(); ++t)
+		{
+			std::size_t nthreads = config.nthreads[t];
+			std::size_t cs_length = config.cs_lengths[c];
+			std::vector<std::size_t> counts(nthreads, 0);	// summed over all repetitions
+			std::size_t previous = 0;
+			double sum = 0, sum2 = 0;
+			bool correct = true;
+
+			for(std::size_t n = 0; n < config.nreps; ++n)
+			{
+				lock_t lock;
+				Shared_data data;
+				std::uint64_t deadline = 0;
+				double seconds = 0;
+
+				#pragma omp parallel num_threads(nthreads)
+				{
+					pin_thread(config);
+					std::size_t count = 0;
+
+					#pragma omp barrier
+					#pragma omp master
+					deadline = Latency_clock::now() +
+						std::uint64_t(config.duration_ms * 1e6 / Latency_clock::ns_per_tick());
+					#pragma omp barrier
+
+					std::uint64_t start = Latency_clock::now();
+					while(Latency_clock::now() < deadline)
+					{
+						lock.lock();
+						critical_section(data, cs_length);
+						lock.unlock();
+						++count;
+					}
+
+					#pragma omp critical
+					{
+						counts[omp_get_thread_num()] += count;
+						seconds = std::max(seconds,
+							(Latency_clock::now() - start) * Latency_clock::ns_per_tick() * 1e-9);
+					}
+				}
+
+				double throughput = data.counter / seconds;
+				sum += throughput;
+				sum2 += throughput*throughput;
+
+				std::size_t acquisitions = 0;
+				for(std::size_t i = 0; i < nthreads; ++i) acquisitions += counts[i];
+				correct = correct && data.counter == acquisitions - previous;
+				previous = acquisitions;
+			}
+
+			// Jain's fairness index of the acquisitions per thread
+			double total = 0, total2 = 0;
+			std::size_t min_count = counts[0], max_count = counts[0];
+			for(std::size_t i = 0; i < nthreads; ++i)
+			{
+				total += counts[i];
+				total2 += double(counts[i]) * counts[i];
+				min_count = std::min(min_count, counts[i]);
+				max_count = std::max(max_count, counts[i]);
+			}
+			double mean_count = total / nthreads;
+			double throughput = sum / config.nreps;
+
+			Result_row row = make_row(labels, "contended", nthreads, cs_length, config.nreps);
+			row.add("mean_ns", 1e9 / throughput)
+			   .add("sigma_ns", 1e9 / throughput * sigma(sum, sum2, config.nreps) / throughput)
+			   .add_missing("p50_ns").add_missing("p99_ns").add_missing("max_ns")
+			   .add("throughput", throughput)
+			   .add("fairness", total2 > 0 ? total*total / (nthreads * total2) : 0.0)
+			   .add("min_share", mean_count > 0 ? min_count / mean_count : 0.0)
+			   .add("max_share", mean_count > 0 ? max_count / mean_count : 0.0)
+			   .add("correct", correct ? "yes" : "no");
+			out.write(row);
+		}
+}
+
+/****************************
+ * 		  Registry 			*
+ ****************************/
+typedef void (*lock_fn)(const std::string& test, const Lock_config& config,
+						Result_writer& out, const Result_row& labels);
+
+template< class lock_t >
+void run_test(const std::string& test, const Lock_config& config,
+			  Result_writer& out, const Result_row& labels)
+{
+	if(test == "uncontended")
+		test_uncontended<lock_t>(config, out, labels);
+	else if(test == "handoff")
+		test_handoff<lock_t>(config, out, labels);
+	else if(test == "contended")
+		test_contended<lock_t>(config, out, labels);
+	else
+		throw std::invalid_argument("unknown test '" + test + "'");
+}
+
+void register_all(std::map<std::string, lock_fn>& locks)
+{
+	locks["omp"] = &run_test<omp_lock>;
+	locks["STL"] = &run_test<STL_lock>;
+	locks["TAS"] = &run_test<TAS_lock>;
+	locks["TATAS"] = &run_test<TATAS_lock>;
+	locks["TASexpbo"] = &run_test<TASexpbo_lock>;
+	locks["ticket"] = &run_test<ticket_lock>;
+	locks["MCS"] = &run_test<MCS_lock>;
+	locks["CLH"] = &run_test<CLH_lock>;
+	locks["tagged"] = &run_test<tagged_lock>;
+	locks["versioned"] = &run_test<versioned_lock>;
+#ifdef __linux__
+	locks["futex"] = &run_test<futex_lock>;
+	locks["adaptive_pause"] = &run_test<adaptive_lock<pause_backoff> >;
+	locks["adaptive_exp"] = &run_test<adaptive_lock<exp_backoff<> > >;
+	locks["adaptive_rand"] = &run_test<adaptive_lock<rand_backoff<> > >;
+	locks["adaptive_yield"] = &run_test<adaptive_lock<yield_backoff> >;
+#endif
+}
+
+void print_usage(std::ostream& out)
+{
+	out << "Usage: ./benchmark_locks [options]\n"
+		<< "  --lock LIST           locks of locks.hpp (default: all, see --list)\n"
+		<< "  --test LIST           uncontended,handoff,contended (default: all)\n"
+		<< "  --threads LIST        threads of contended, e.g 1,2,4 or 1-8 or sweep\n"
+		<< "                        (default: 1,2,4)\n"
+		<< "  --cs LIST             critical section lengths of contended, in\n"
+		<< "                        shared word increments (default: 0,100)\n"
+		<< "  --pin LIST            none,compact,scatter,smt-first,socket-fill\n"
+		<< "                        (default: compact)\n"
+		<< "  --iterations N        lock/unlock pairs of uncontended (default: 2^20)\n"
+		<< "  --handoffs N          handoffs of handoff (default: 2^14)\n"
+		<< "  --duration MS         length of a contended run (default: 100)\n"
+		<< "  --reps N              repetitions (default: 3)\n"
+		<< "  --format csv|json     output format (default: csv)\n"
+		<< "  --output FILE         write the results to FILE (default: stdout)\n"
+		<< "  --list                print all locks\n";
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, lock_fn> locks;
+	register_all(locks);
+
+	try
+	{
+		Options options(argc, argv);
+
+		if(options.has("help"))
+		{
+			print_usage(std::cout);
+			return 0;
+		}
+
+		if(options.has("list"))
+		{
+			std::map<std::string, lock_fn>::const_iterator it;
+			for(it = locks.begin(); it != locks.end(); ++it)
+				std::cout << it->first << std::endl;
+			return 0;
+		}
+
+		Topology topology;
+
+		Lock_config config;
+		config.nreps = options.get_size("reps", 3);
+		config.nthreads = options.get("threads", "") == "sweep" ? topology.sweep()
+						: options.get_range("threads", "1,2,4");
+		config.cs_lengths = options.get_range("cs", "0,100");
+		config.iterations = options.get_size("iterations", 1 << 20);
+		config.handoffs = options.get_size("handoffs", 1 << 14);
+		config.duration_ms = options.get_size("duration", 100);
+
+		if(config.nreps == 0 || config.nthreads.empty() || config.cs_lengths.empty())
+			throw std::invalid_argument("--reps, --threads and --cs must not be empty");
+		if(config.iterations == 0 || config.handoffs < 2 || config.duration_ms == 0)
+			throw std::invalid_argument("--iterations, --handoffs and --duration are too small");
+		for(std::size_t t = 0; t < config.nthreads.size(); ++t)
+			if(config.nthreads[t] == 0)
+				throw std::invalid_argument("--threads must be positive");
+
+		std::vector<std::string> tests = options.get_list("test", "uncontended,handoff,contended");
+		std::vector<std::string> pinnings = options.get_list("pin", "compact");
+
+		std::string all;
+		for(std::map<std::string, lock_fn>::const_iterator it = locks.begin(); it != locks.end(); ++it)
+			all += (all.empty() ? "" : ",") + it->first;
+		std::vector<std::string> lock_names = options.get_list("lock", all);
+
+		for(std::size_t l = 0; l < lock_names.size(); ++l)
+			if(!locks.count(lock_names[l]))
+				throw std::invalid_argument("unknown lock '" + lock_names[l] + "' (see --list)");
+		for(std::size_t t = 0; t < tests.size(); ++t)
+			if(tests[t] != "uncontended" && tests[t] != "handoff" && tests[t] != "contended")
+				throw std::invalid_argument("unknown test '" + tests[t] + "'");
+
+		std::vector<Topology::Policy> policies;
+		for(std::size_t p = 0; p < pinnings.size(); ++p)
+			policies.push_back(Topology::parse_policy(pinnings[p]));
+
+		std::ofstream fout;
+		if(options.has("output"))
+		{
+			fout.open(options.get("output", "").c_str());
+			if(!fout)
+				throw std::invalid_argument("cannot open '" + options.get("output", "") + "'");
+		}
+
+		Result_writer out(fout.is_open() ? fout : std::cout,
+						  Result_writer::parse_format(options.get("format", "csv")));
+
+		for(std::size_t l = 0; l < lock_names.size(); ++l)
+			for(std::size_t p = 0; p < policies.size(); ++p)
+			{
+				Result_row labels;
+				labels.add("lock", lock_names[l]).add("pinning", Topology::name(policies[p]));
+				config.cpus = topology.order(policies[p]);
+
+				for(std::size_t t = 0; t < tests.size(); ++t)
+					locks[lock_names[l]](tests[t], config, out, labels);
+			}
+	}
+	catch(const std::invalid_argument& e)
+	{
+		std::cerr << "*** Error *** : " << e.what() << "\n\n";
+		print_usage(std::cerr);
+		return 1;
+	}
+
+	return 0;
+}
@@ -63,6 +63,9 @@ public:
 		
 	inline std::size_t counter() const { return counter_; }
 	inline std::size_t high_bit() const { return high_bit_; }
+	
+	// Index returned by the last increment (not yet decremented), 0 if empty
+	inline std::size_t last() const { return counter_ ? reverse_ : 0; }
 
 private:
 	std::size_t counter_;
@@ -95,6 +98,7 @@ public:
 	
 	inline std::size_t counter() const { return counter_; }
 	inline std::size_t high_bit() const { return high_bit_; }
+	inline std::size_t last() const { return counter_; }
     
 private:
     std::size_t counter_;
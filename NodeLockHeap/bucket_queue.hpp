@@ -0,0 +1,329 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Bucket queue for small priority domains (e.g QoS classes). Every priority
+ *	level owns a bounded lock-free FIFO (Vyukov's MPMC ring buffer) and an
+ *	atomic occupancy bitmap records which levels are non-empty. A pop finds
+ *	the highest non-empty level with a single leading-zero count per bitmap
+ *	word, hence insert and pop are O(1) and threads working on different
+ *	levels share almost nothing.
+ *
+ *	Priorities must be in [0, nlevels), insert throws std::out_of_range
+ *	otherwise. Elements with equal priority are returned in FIFO order. If
+ *	the FIFO of a level is full, the level spills into an overflow deque
+ *	under a lock, which takes all inserts of the level until the pops
+ *	drained it. The queue thus grows without bound and an insert never
+ *	waits for a pop.
+ */
+
+#ifndef BUCKET_QUEUE_HPP
+#define BUCKET_QUEUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#include "atomics.hpp"
+#include "locks.hpp"
+
+/****************************
+ * 	 Bounded MPMC FIFO 		*
+ ****************************/
+template< class value_t >
+class MPMC_fifo
+{
+public:
+
+	/* Constructor (capacity is rounded up to the next power of two) */
+	MPMC_fifo(std::size_t capacity)
+		: enqueue_pos_(0), dequeue_pos_(0)
+	{
+		std::size_t size = 2;
+		while(size < capacity) size <<= 1;
+
+		mask_ = size - 1;
+		buffer_ = new Cell[size];
+
+		for(std::size_t i = 0; i < size; ++i)
+			buffer_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	~MPMC_fifo() { delete[] buffer_; }
+
+	/**
+	 *	push: Appends value to the FIFO. Returns false if the FIFO is full.
+	 */
+	inline bool push(const value_t& value)
+	{
+		std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		for(;;)
+		{
+			cell = &buffer_[pos & mask_];
+			std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+			std::intptr_t dif = (std::intptr_t) seq - (std::intptr_t) pos;
+
+			if(dif == 0)
+			{
+				// Sequentially consistent (free on x86) so that it is ordered
+				// with the occupancy check in Bucket_queue::insert
+				if(enqueue_pos_.compare_exchange_weak(pos, pos + 1))
+					break;
+			}
+			else if(dif < 0)
+				return false;
+			else
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+		}
+
+		cell->value = value;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 *	pop: Removes the oldest value of the FIFO. Returns false if the FIFO
+	 *		 is empty.
+	 */
+	inline bool pop(value_t& value)
+	{
+		std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		for(;;)
+		{
+			cell = &buffer_[pos & mask_];
+			std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+			std::intptr_t dif = (std::intptr_t) seq - (std::intptr_t) (pos + 1);
+
+			if(dif == 0)
+			{
+				if(dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+													  std::memory_order_relaxed))
+					break;
+			}
+			else if(dif < 0)
+				return false;
+			else
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+		}
+
+		value = cell->value;
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Number of pushes started which have not yet been popped */
+	inline std::size_t size() const
+	{
+		std::size_t dequeued = dequeue_pos_.load(std::memory_order_seq_cst);
+		std::size_t enqueued = enqueue_pos_.load(std::memory_order_seq_cst);
+		return enqueued > dequeued ? enqueued - dequeued : 0;
+	}
+
+private:
+	MPMC_fifo(const MPMC_fifo&);
+	MPMC_fifo& operator=(const MPMC_fifo&);
+
+	struct Cell
+	{
+		std::atomic<std::size_t> sequence;
+		value_t value;
+	};
+
+	static const std::size_t CACHELINE = 64;
+
+	Cell* buffer_;
+	std::size_t mask_;
+
+	// Producers and consumers work on different cachelines
+	char pad0_[CACHELINE];
+	std::atomic<std::size_t> enqueue_pos_;
+	char pad1_[CACHELINE];
+	std::atomic<std::size_t> dequeue_pos_;
+	char pad2_[CACHELINE];
+};
+
+/****************************
+ * 		Bucket level 		*
+ ****************************/
+// The ring buffer is the fast path. Once it was full the elements go to the
+// overflow deque, until the pops drained it again. The elements in the ring
+// are older than those in the overflow, up to inserts which raced with the
+// first spill, so a pop takes the ring first.
+template< class value_t >
+class Bucket_level
+{
+public:
+
+	/* Constructor */
+	Bucket_level(std::size_t capacity)
+		: fifo_(capacity), overflow_size_(0)
+	{}
+
+	inline void push(const value_t& value)
+	{
+		if(overflow_size_.load(std::memory_order_seq_cst) == 0 && fifo_.push(value))
+			return;
+
+		overflow_lock_.lock();
+		overflow_.push_back(value);
+		overflow_size_.fetch_add(1, std::memory_order_seq_cst);
+		overflow_lock_.unlock();
+	}
+
+	inline bool pop(value_t& value)
+	{
+		if(fifo_.pop(value))
+			return true;
+		if(overflow_size_.load(std::memory_order_seq_cst) == 0)
+			return false;
+
+		bool success = false;
+		overflow_lock_.lock();
+		if(!overflow_.empty())
+		{
+			value = overflow_.front();
+			overflow_.pop_front();
+			overflow_size_.fetch_sub(1, std::memory_order_seq_cst);
+			success = true;
+		}
+		overflow_lock_.unlock();
+		return success;
+	}
+
+	inline std::size_t size() const
+	{
+		return fifo_.size() + overflow_size_.load(std::memory_order_seq_cst);
+	}
+
+private:
+	Bucket_level(const Bucket_level&);
+	Bucket_level& operator=(const Bucket_level&);
+
+	MPMC_fifo<value_t> fifo_;
+
+	// Protected by overflow_lock, the size is read without it
+	TATAS_lock overflow_lock_;
+	std::deque<value_t> overflow_;
+	std::atomic<std::size_t> overflow_size_;
+};
+
+/****************************
+ * 		Bucket queue 		*
+ ****************************/
+template< class value_t, std::size_t nlevels = 256 >
+class Bucket_queue
+{
+public:
+
+	/* Constructor (level_capacity is the size of the ring buffer of a level) */
+	Bucket_queue(std::size_t level_capacity = 1 << 12)
+	{
+		for(std::size_t i = 0; i < NWORDS; ++i)
+			bitmap_[i].store(0, std::memory_order_relaxed);
+
+		levels_.reserve(nlevels);
+		for(std::size_t i = 0; i < nlevels; ++i)
+			levels_.push_back(new Bucket_level<value_t>(level_capacity));
+	}
+
+	~Bucket_queue()
+	{
+		for(std::size_t i = 0; i < nlevels; ++i)
+			delete levels_[i];
+	}
+
+	/**
+	 *	insert: Inserts an element (value, priority) into the priority queue
+	 */
+	void insert(value_t value, std::size_t priority)
+	{
+		if(priority >= nlevels)
+			throw std::out_of_range("Bucket_queue: priority out of range");
+
+		levels_[priority]->push(value);
+
+		// Publish the level after the element is visible in the FIFO. The
+		// RMW is skipped if the bit is already set, which is the common case.
+		std::uint64_t bit = std::uint64_t(1) << (priority % 64);
+		std::atomic<std::uint64_t>& word = bitmap_[priority / 64];
+		if(!(word.load(std::memory_order_seq_cst) & bit))
+			word.fetch_or(bit, std::memory_order_seq_cst);
+	}
+
+	/**
+	 *	pop_front: 	Assigns the value of the first element in the queue to
+	 *				the parameter value. Returns false if the assignement failed.
+	 */
+	bool pop_front(value_t& value)
+	{
+		std::size_t level;
+
+		while(highest_level(level))
+		{
+			if(levels_[level]->pop(value))
+				return true;
+
+			// The level seems to be empty, clear its bit. A concurrent insert
+			// may have pushed in the meantime, in which case we set it again.
+			std::uint64_t bit = std::uint64_t(1) << (level % 64);
+			std::atomic<std::uint64_t>& word = bitmap_[level / 64];
+			word.fetch_and(~bit, std::memory_order_seq_cst);
+
+			if(levels_[level]->size() != 0)
+				word.fetch_or(bit, std::memory_order_seq_cst);
+		}
+
+		return false;
+	}
+
+	inline bool empty() const
+	{
+		for(std::size_t i = 0; i < NWORDS; ++i)
+			if(bitmap_[i].load(std::memory_order_seq_cst)) return false;
+		return true;
+	}
+
+	// Not kept in a shared counter to avoid a contended cacheline, hence O(nlevels)
+	inline std::size_t size() const
+	{
+		std::size_t size = 0;
+		for(std::size_t i = 0; i < nlevels; ++i)
+			size += levels_[i]->size();
+		return size;
+	}
+
+	static std::size_t levels() { return nlevels; }
+
+private:
+	Bucket_queue(const Bucket_queue&);
+	Bucket_queue& operator=(const Bucket_queue&);
+
+	// Find the highest level whose occupancy bit is set
+	inline bool highest_level(std::size_t& level) const
+	{
+		for(std::size_t i = NWORDS; i-- > 0; )
+		{
+			std::uint64_t word = bitmap_[i].load(std::memory_order_seq_cst);
+			if(word)
+			{
+				level = 64*i + 63 - __builtin_clzll(word);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static const std::size_t NWORDS = (nlevels + 63) / 64;
+
+	std::atomic<std::uint64_t> bitmap_[NWORDS];
+	std::vector< Bucket_level<value_t>* > levels_;
+};
+
+#endif // BUCKET_QUEUE_HPP
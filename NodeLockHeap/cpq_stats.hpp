@@ -0,0 +1,191 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Contention instrumentation of the CPQ. Compiling with -DCPQ_STATS makes
+ *	every CPQ count, per thread,
+ *
+ *		- cycles spent waiting for and acquisitions of heap_lock (global),
+ *		  the root lock and all other node locks (interior)
+ *		- levels visited by sift-up (insert) and sift-down (pop_front)
+ *		- swaps of nodes
+ *		- growth events and cycles spent draining the heap before growing
+ *		- tag races in insert (the element was moved by another thread) and
+ *		  failed optimistic reads in the versioned sift-down
+ *
+ *	Without CPQ_STATS the recorder is an empty class whose member functions
+ *	do nothing, hence the instrumentation compiles away completely.
+ *	Cycles are measured with Latency_clock (time stamp counter ticks).
+ */
+
+#ifndef CPQ_STATS_HPP
+#define CPQ_STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <omp.h>
+
+#include "histogram.hpp"
+
+#ifdef CPQ_STATS
+#define CPQ_STATS_ENABLED true
+#else
+#define CPQ_STATS_ENABLED false
+#endif
+
+/****************************
+ * 		   Snapshot 		*
+ ****************************/
+struct CPQ_stats
+{
+	enum Lock_role { GLOBAL, ROOT, INTERIOR };
+
+	enum Counter
+	{
+		GLOBAL_LOCK_WAIT, ROOT_LOCK_WAIT, INTERIOR_LOCK_WAIT,
+		GLOBAL_LOCK_ACQUIRES, ROOT_LOCK_ACQUIRES, INTERIOR_LOCK_ACQUIRES,
+		SIFT_UP_LEVELS, SIFT_DOWN_LEVELS, SWAPS,
+		GROWTH_EVENTS, DRAIN_WAIT,
+		TAG_RETRIES, OPTIMISTIC_RETRIES,
+		NCOUNTERS
+	};
+
+	CPQ_stats()
+	{
+		for(int i = 0; i < NCOUNTERS; ++i) counts[i] = 0;
+	}
+
+	static const char* name(int counter)
+	{
+		static const char* names[NCOUNTERS] =
+		{
+			"global_lock_wait", "root_lock_wait", "interior_lock_wait",
+			"global_lock_acquires", "root_lock_acquires", "interior_lock_acquires",
+			"sift_up_levels", "sift_down_levels", "swaps",
+			"growth_events", "drain_wait",
+			"tag_retries", "optimistic_retries"
+		};
+		return names[counter];
+	}
+
+	CPQ_stats& operator+=(const CPQ_stats& other)
+	{
+		for(int i = 0; i < NCOUNTERS; ++i) counts[i] += other.counts[i];
+		return *this;
+	}
+
+	CPQ_stats& operator-=(const CPQ_stats& other)
+	{
+		for(int i = 0; i < NCOUNTERS; ++i) counts[i] -= other.counts[i];
+		return *this;
+	}
+
+	std::uint64_t counts[NCOUNTERS];
+};
+
+/****************************
+ * 		   Recorder 		*
+ ****************************/
+template< bool enabled >
+class CPQ_stats_recorder;
+
+template<>
+class CPQ_stats_recorder<false>
+{
+public:
+	inline void add(CPQ_stats::Counter, std::uint64_t = 1) {}
+
+	// Passes on what lock() returns (the tag for the nodes)
+	template< class lock_t >
+	inline auto lock(lock_t& lock, CPQ_stats::Lock_role) -> decltype(lock.lock()) 
+	{ 
+		return lock.lock(); 
+	}
+
+	inline std::uint64_t start() const { return 0; }
+	inline void stop(CPQ_stats::Counter, std::uint64_t) {}
+
+	inline CPQ_stats snapshot() const { return CPQ_stats(); }
+};
+
+template<>
+class CPQ_stats_recorder<true>
+{
+public:
+	CPQ_stats_recorder()
+	{
+		for(std::size_t t = 0; t < MAX_THREADS; ++t)
+			for(int i = 0; i < CPQ_stats::NCOUNTERS; ++i)
+				slots_[t].counts[i].store(0, std::memory_order_relaxed);
+	}
+
+	inline void add(CPQ_stats::Counter counter, std::uint64_t n = 1)
+	{
+		slot().counts[counter].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	// The wait is recorded once lock() returned, whatever it returns
+	template< class lock_t >
+	inline auto lock(lock_t& lock, CPQ_stats::Lock_role role) -> decltype(lock.lock())
+	{
+		Lock_wait wait(slot(), role);
+		return lock.lock();
+	}
+
+	inline std::uint64_t start() const { return Latency_clock::now(); }
+
+	inline void stop(CPQ_stats::Counter counter, std::uint64_t t0)
+	{
+		add(counter, Latency_clock::now() - t0);
+	}
+
+	CPQ_stats snapshot() const
+	{
+		CPQ_stats stats;
+		for(std::size_t t = 0; t < MAX_THREADS; ++t)
+			for(int i = 0; i < CPQ_stats::NCOUNTERS; ++i)
+				stats.counts[i] += slots_[t].counts[i].load(std::memory_order_relaxed);
+		return stats;
+	}
+
+private:
+	CPQ_stats_recorder(const CPQ_stats_recorder&);
+	CPQ_stats_recorder& operator=(const CPQ_stats_recorder&);
+
+	static const std::size_t MAX_THREADS = 128;
+
+	// One slot per thread padded to whole cachelines, the relaxed RMWs are uncontended
+	struct Slot
+	{
+		std::atomic<std::uint64_t> counts[CPQ_stats::NCOUNTERS];
+		char pad[64 - (CPQ_stats::NCOUNTERS * sizeof(std::uint64_t)) % 64];
+	};
+
+	inline Slot& slot() { return slots_[omp_get_thread_num() % MAX_THREADS]; }
+
+	// Adds the cycles from its construction to its destruction to the lock wait
+	struct Lock_wait
+	{
+		Lock_wait(Slot& s, CPQ_stats::Lock_role role) 
+			: s(s), role(role), t0(Latency_clock::now()) 
+		{}
+		
+		~Lock_wait()
+		{
+			s.counts[CPQ_stats::GLOBAL_LOCK_WAIT + role].fetch_add(Latency_clock::now() - t0,
+																   std::memory_order_relaxed);
+			s.counts[CPQ_stats::GLOBAL_LOCK_ACQUIRES + role].fetch_add(1, std::memory_order_relaxed);
+		}
+		
+		Slot& s;
+		CPQ_stats::Lock_role role;
+		std::uint64_t t0;
+	};
+
+	Slot slots_[MAX_THREADS];
+};
+
+typedef CPQ_stats_recorder<CPQ_STATS_ENABLED> CPQ_stats_recorder_t;
+
+#endif // CPQ_STATS_HPP
@@ -0,0 +1,380 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	External memory priority queue. The elements of high priority are kept
+ *	in an in-memory CPQ (the hot part), the elements of low priority in
+ *	sorted runs in files (the cold part):
+ *
+ *		- Every cold element has a priority of at most threshold, every hot
+ *		  element of at least threshold. An insert below the threshold goes
+ *		  to an insertion buffer, which is written as a run once it is full.
+ *		- If the hot part outgrows its share of the RAM budget it is popped
+ *		  empty, the upper half is inserted again and the lower half is
+ *		  written as a run. The threshold rises to the top of that run.
+ *		- If the hot part runs empty, the runs and the buffer are merged
+ *		  (k-way) until half of the hot share is inserted again. The
+ *		  threshold drops to the highest remaining cold element.
+ *
+ *	The runs are written with large sequential writes and read back through
+ *	read-only mappings with sequential access advice. A run file is unlinked
+ *	as soon as it is created, so the space is returned once the run is used
+ *	up or the queue is destroyed, even if the process crashes.
+ *
+ *	The hot part is a concurrent CPQ. Spilling and merging need it quiescent:
+ *	the cold part is protected by cold_lock, and the thread holding it waits
+ *	(like the growth of the CPQ) until no operation is in the hot part
+ *	before it moves elements. The RAM budget is approximate, it bounds the
+ *	number of elements in the hot part and in the buffer.
+ */
+
+#ifndef EXTERNAL_PQ_HPP
+#define EXTERNAL_PQ_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "CPQ.hpp"
+
+template< class value_t,  class lock_t = omp_lock,
+		  class counter_t = Bit_reversed_counter>
+class External_PQ
+{
+public:
+	static_assert(std::is_trivially_copyable<value_t>::value, "values are written to files");
+
+	/* Keeps about ram_budget bytes in memory, the runs are created in directory */
+	explicit External_PQ(std::size_t ram_budget, const std::string& directory = "/tmp")
+		: directory_(directory),
+		  hot_limit_(std::max<std::size_t>(16, ram_budget * 3/4 / sizeof(Node<value_t, lock_t>))),
+		  buffer_limit_(std::max<std::size_t>(16, ram_budget / 4 / sizeof(Entry))),
+		  threshold_(0), active_(0), exclusive_(false), cold_size_(0),
+		  spills_(0), refills_(0)
+	{}
+
+	~External_PQ()
+	{
+		for(std::size_t i = 0; i < runs_.size(); ++i)
+			munmap(runs_[i].map, runs_[i].bytes);
+	}
+
+	/**
+	 *	insert: Inserts an element (value, priority) into the priority queue
+	 */
+	void insert(value_t value, std::size_t priority)
+	{
+		for(;;)
+		{
+			enter();
+			if(priority >= threshold_.load(std::memory_order_relaxed))
+			{
+				hot_.insert(value, priority);
+				bool full = hot_.size() >= hot_limit_;
+				leave();
+
+				if(full) spill_hot();
+				return;
+			}
+			leave();
+
+			// The threshold only changes with cold_lock held
+			cold_lock_.lock();
+			if(priority < threshold_.load(std::memory_order_relaxed))
+			{
+				// Spill before the element is added, an insert which throws
+				// leaves the queue as it was
+				if(buffer_.size() + 1 >= buffer_limit_)
+				{
+					try { spill_buffer(); }
+					catch(...) { cold_lock_.unlock(); throw; }
+				}
+
+				Entry entry = { priority, value };
+				buffer_.push_back(entry);
+				cold_size_.fetch_add(1, std::memory_order_relaxed);
+
+				cold_lock_.unlock();
+				return;
+			}
+			cold_lock_.unlock();
+		}
+	}
+
+	/**
+	 *	pop_front: 	Assigns the value of the first element in the queue to
+	 *				the parameter value. Returns false if the assignement failed.
+	 */
+	bool pop_front(value_t& value)
+	{
+		for(;;)
+		{
+			enter();
+			bool success = hot_.pop_front(value);
+			leave();
+
+			if(success) return true;
+			if(!refill()) return false;
+		}
+	}
+
+	inline bool empty() const { return size() == 0; }
+	inline std::size_t size() const
+	{
+		return hot_.size() + cold_size_.load(std::memory_order_relaxed);
+	}
+
+	/* Elements on disk or in the insertion buffer */
+	inline std::size_t cold_size() const { return cold_size_.load(std::memory_order_relaxed); }
+
+	inline std::size_t runs() const { return runs_.size(); }
+	inline std::size_t spills() const { return spills_; }
+	inline std::size_t refills() const { return refills_; }
+
+private:
+	External_PQ(const External_PQ&);
+	External_PQ& operator=(const External_PQ&);
+
+	struct Entry
+	{
+		std::size_t priority;
+		value_t value;
+	};
+
+	// Sorted by decreasing priority, next is the first element not merged yet
+	struct Run
+	{
+		void* map;
+		std::size_t bytes;
+		std::size_t size;
+		std::size_t next;
+
+		inline const Entry* entries() const { return static_cast<const Entry*>(map); }
+		inline bool done() const { return next == size; }
+	};
+
+	static inline bool higher(const Entry& a, const Entry& b) { return a.priority > b.priority; }
+
+	/* Shared access to the hot part, excluded while elements are moved */
+	inline void enter()
+	{
+		for(;;)
+		{
+			while(exclusive_.load(std::memory_order_acquire)) do_nothing();
+			active_.fetch_add(1, std::memory_order_seq_cst);
+			if(!exclusive_.load(std::memory_order_seq_cst)) return;
+			active_.fetch_sub(1, std::memory_order_release);
+		}
+	}
+
+	inline void leave() { active_.fetch_sub(1, std::memory_order_release); }
+
+	// Called with cold_lock held
+	inline void exclude()
+	{
+		exclusive_.store(true, std::memory_order_seq_cst);
+		while(active_.load(std::memory_order_acquire) != 0) do_nothing();
+	}
+
+	inline void admit() { exclusive_.store(false, std::memory_order_release); }
+
+	/* Writes the lower half of the hot part as a run */
+	void spill_hot()
+	{
+		cold_lock_.lock();
+		exclude();
+
+		// Another thread might have spilled in the meantime
+		if(hot_.size() >= hot_limit_)
+		{
+			std::vector<Entry> entries(hot_.size());
+			std::size_t n = 0;
+			while(n < entries.size() && hot_.pop_front(entries[n].value, entries[n].priority))
+				++n;
+			entries.resize(n);
+
+			std::size_t keep = n / 2;
+			for(std::size_t i = 0; i < keep; ++i)
+				hot_.insert(entries[i].value, entries[i].priority);
+
+			if(keep < n)
+			{
+				try { write_run(&entries[keep], n - keep); }
+				catch(...)
+				{
+					// Nothing is lost, the hot part is over its budget though
+					for(std::size_t i = keep; i < n; ++i)
+						hot_.insert(entries[i].value, entries[i].priority);
+					admit();
+					cold_lock_.unlock();
+					throw;
+				}
+				cold_size_.fetch_add(n - keep, std::memory_order_relaxed);
+				threshold_.store(std::max(threshold_.load(std::memory_order_relaxed),
+										  entries[keep].priority), std::memory_order_relaxed);
+			}
+			++spills_;
+		}
+
+		admit();
+		cold_lock_.unlock();
+	}
+
+	// Called with cold_lock held, the elements are below the threshold. The
+	// buffer is kept if the run can not be written.
+	void spill_buffer()
+	{
+		std::sort(buffer_.begin(), buffer_.end(), higher);
+		write_run(&buffer_[0], buffer_.size());
+		buffer_.clear();
+		++spills_;
+	}
+
+	/**
+	 *	refill:	Merges the top of the cold part into the empty hot part.
+	 *			Returns false if the whole queue is empty.
+	 */
+	bool refill()
+	{
+		cold_lock_.lock();
+		exclude();
+
+		bool nonempty = !hot_.empty();
+		if(!nonempty && cold_size_.load(std::memory_order_relaxed) > 0)
+		{
+			merge(hot_limit_ / 2);
+			nonempty = true;
+			++refills_;
+		}
+
+		admit();
+		cold_lock_.unlock();
+		return nonempty;
+	}
+
+	// k-way merge of the runs and the buffer into the hot part
+	void merge(std::size_t batch)
+	{
+		std::sort(buffer_.begin(), buffer_.end(), higher);
+		std::size_t buffer_next = 0;
+
+		// (priority, source), the buffer is source runs_.size()
+		typedef std::pair<std::size_t, std::size_t> head_t;
+		std::priority_queue<head_t> heads;
+
+		for(std::size_t r = 0; r < runs_.size(); ++r)
+			if(!runs_[r].done())
+				heads.push(head_t(runs_[r].entries()[runs_[r].next].priority, r));
+		if(!buffer_.empty())
+			heads.push(head_t(buffer_[0].priority, runs_.size()));
+
+		std::size_t moved = 0;
+		for(; moved < batch && !heads.empty(); ++moved)
+		{
+			std::size_t source = heads.top().second;
+			heads.pop();
+
+			const Entry* entry;
+			bool more;
+			if(source == runs_.size())
+			{
+				entry = &buffer_[buffer_next++];
+				more = buffer_next < buffer_.size();
+				if(more) heads.push(head_t(buffer_[buffer_next].priority, source));
+			}
+			else
+			{
+				Run& run = runs_[source];
+				entry = &run.entries()[run.next++];
+				more = !run.done();
+				if(more) heads.push(head_t(run.entries()[run.next].priority, source));
+			}
+			hot_.insert(entry->value, entry->priority);
+		}
+
+		cold_size_.fetch_sub(moved, std::memory_order_relaxed);
+		threshold_.store(heads.empty() ? 0 : heads.top().first, std::memory_order_relaxed);
+
+		buffer_.erase(buffer_.begin(), buffer_.begin() + buffer_next);
+
+		// Release the runs which are used up
+		std::size_t kept = 0;
+		for(std::size_t r = 0; r < runs_.size(); ++r)
+			if(runs_[r].done())
+				munmap(runs_[r].map, runs_[r].bytes);
+			else
+				runs_[kept++] = runs_[r];
+		runs_.resize(kept);
+	}
+
+	// Writes the sorted entries to an (already unlinked) file and maps it
+	void write_run(const Entry* entries, std::size_t n)
+	{
+		std::string path = directory_ + "/cpq_run_XXXXXX";
+		std::vector<char> name(path.begin(), path.end());
+		name.push_back('\0');
+
+		int fd = mkstemp(&name[0]);
+		if(fd < 0)
+			throw std::runtime_error("cannot create run file in '" + directory_ + "'");
+		unlink(&name[0]);
+
+		const char* data = reinterpret_cast<const char*>(entries);
+		std::size_t bytes = n * sizeof(Entry);
+
+		for(std::size_t written = 0; written < bytes; )
+		{
+			std::size_t remaining = bytes - written;
+			ssize_t chunk = write(fd, data + written, remaining < WRITE_CHUNK ? remaining : WRITE_CHUNK);
+			if(chunk <= 0)
+			{
+				close(fd);
+				throw std::runtime_error("failed to write run file in '" + directory_ + "'");
+			}
+			written += chunk;
+		}
+
+		void* map = mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(map == MAP_FAILED)
+			throw std::runtime_error("cannot map run file in '" + directory_ + "'");
+		madvise(map, bytes, MADV_SEQUENTIAL);
+
+		Run run = { map, bytes, n, 0 };
+		runs_.push_back(run);
+	}
+
+	static const std::size_t WRITE_CHUNK = std::size_t(1) << 20;
+
+	CPQ<value_t, lock_t, counter_t> hot_;
+
+	std::string directory_;
+	std::size_t hot_limit_;
+	std::size_t buffer_limit_;
+
+	// Written with cold_lock held while the hot part is excluded
+	std::atomic<std::size_t> threshold_;
+
+	std::atomic<int> active_;
+	std::atomic<bool> exclusive_;
+
+	// Protected by cold_lock
+	lock_t cold_lock_;
+	std::vector<Entry> buffer_;
+	std::vector<Run> runs_;
+	std::atomic<std::size_t> cold_size_;
+	std::size_t spills_;
+	std::size_t refills_;
+};
+
+#endif // EXTERNAL_PQ_HPP
@@ -0,0 +1,209 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Per-operation latency measurement for the benchmarks.
+ *
+ *	Latency_clock reads the time stamp counter (x86) or CLOCK_MONOTONIC
+ *	(elsewhere). The TSC rate is calibrated once against CLOCK_MONOTONIC, so
+ *	it assumes a constant/invariant TSC, which holds for all x86 CPUs of the
+ *	last decade.
+ *
+ *	Latency_histogram is a log-linear histogram in the spirit of HdrHistogram:
+ *	values below 2*SUB_BUCKETS are counted exactly, larger values fall into
+ *	SUB_BUCKETS buckets per power of two (relative error < 1/SUB_BUCKETS).
+ *	Recording is a leading-zero count and an increment. Every thread records
+ *	into its own histogram, so nothing is shared, and the histograms are
+ *	merged after the parallel region.
+ */
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <time.h>
+
+/****************************
+ * 		Latency clock 		*
+ ****************************/
+class Latency_clock
+{
+public:
+	// Ticks since an arbitrary origin
+	static inline std::uint64_t now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __builtin_ia32_rdtsc();
+#else
+		return monotonic_ns();
+#endif
+	}
+
+	// Conversion factor of ticks to nanoseconds
+	static double ns_per_tick()
+	{
+		static const double factor = calibrate();
+		return factor;
+	}
+
+	static inline std::uint64_t monotonic_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return std::uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+	}
+
+private:
+	static double calibrate()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		// Busy wait for 10ms, long enough to hide the cost of the clock reads
+		std::uint64_t ns_start = monotonic_ns();
+		std::uint64_t tsc_start = now();
+		std::uint64_t ns_end;
+		do ns_end = monotonic_ns(); while(ns_end - ns_start < 10000000ull);
+		std::uint64_t tsc_end = now();
+
+		return double(ns_end - ns_start) / double(tsc_end - tsc_start);
+#else
+		return 1.0;
+#endif
+	}
+};
+
+/****************************
+ * 	  Latency histogram		*
+ ****************************/
+class Latency_histogram
+{
+public:
+	static const unsigned SUB_BITS = 5;
+	static const std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BITS;
+	static const std::size_t NBUCKETS = 2*SUB_BUCKETS + (63 - SUB_BITS)*SUB_BUCKETS;
+
+	Latency_histogram() { reset(); }
+
+	void reset()
+	{
+		std::memset(counts_, 0, sizeof(counts_));
+		count_ = 0;
+		sum_ = 0;
+		max_ = 0;
+	}
+
+	inline void record(std::uint64_t value)
+	{
+		++counts_[index(value)];
+		++count_;
+		sum_ += value;
+		if(value > max_) max_ = value;
+	}
+
+	void merge(const Latency_histogram& other)
+	{
+		for(std::size_t i = 0; i < NBUCKETS; ++i)
+			counts_[i] += other.counts_[i];
+		count_ += other.count_;
+		sum_ += other.sum_;
+		max_ = std::max(max_, other.max_);
+	}
+
+	inline std::uint64_t count() const { return count_; }
+	inline std::uint64_t max() const { return max_; }
+	inline double mean() const { return count_ ? double(sum_) / count_ : 0.0; }
+
+	/**
+	 *	percentile:	Returns the largest value equivalent to the bucket which
+	 *				contains the p-th percentile (0 < p <= 100), or 0 if the
+	 *				histogram is empty.
+	 */
+	std::uint64_t percentile(double p) const
+	{
+		if(count_ == 0) return 0;
+
+		std::uint64_t rank = std::uint64_t(p / 100.0 * count_ + 0.5);
+		rank = std::max<std::uint64_t>(1, std::min(rank, count_));
+
+		std::uint64_t seen = 0;
+		for(std::size_t i = 0; i < NBUCKETS; ++i)
+		{
+			seen += counts_[i];
+			if(seen >= rank)
+				return std::min(highest_equivalent(i), max_);
+		}
+		return max_;
+	}
+
+	static inline std::size_t index(std::uint64_t value)
+	{
+		if(value < 2*SUB_BUCKETS)
+			return value;
+
+		unsigned msb = 63 - __builtin_clzll(value);
+		unsigned shift = msb - SUB_BITS;
+		return 2*SUB_BUCKETS + (msb - SUB_BITS - 1)*SUB_BUCKETS
+			   + ((value >> shift) - SUB_BUCKETS);
+	}
+
+	static inline std::uint64_t lowest_equivalent(std::size_t i)
+	{
+		if(i < 2*SUB_BUCKETS)
+			return i;
+
+		std::size_t shift = (i - 2*SUB_BUCKETS) / SUB_BUCKETS + 1;
+		std::uint64_t mantissa = (i - 2*SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+		return mantissa << shift;
+	}
+
+	static inline std::uint64_t highest_equivalent(std::size_t i)
+	{
+		return i + 1 < NBUCKETS ? lowest_equivalent(i + 1) - 1 : ~std::uint64_t(0);
+	}
+
+private:
+	std::uint64_t counts_[NBUCKETS];
+	std::uint64_t count_;
+	std::uint64_t sum_;
+	std::uint64_t max_;
+};
+
+/****************************
+ * 		 Timed queue 		*
+ ****************************/
+// Adaptor recording the latency of push and pop of the wrapped queue adaptor
+// in the histograms of the calling thread
+template< class queue_t >
+class Timed_queue
+{
+public:
+	Timed_queue(queue_t& queue, Latency_histogram& push_hist, Latency_histogram& pop_hist)
+		: queue_(queue), push_hist_(push_hist), pop_hist_(pop_hist)
+	{}
+
+	template< class value_t >
+	inline void push(value_t val, std::size_t priority)
+	{
+		std::uint64_t start = Latency_clock::now();
+		queue_.push(val, priority);
+		push_hist_.record(Latency_clock::now() - start);
+	}
+
+	template< class value_t >
+	inline bool pop(value_t& val)
+	{
+		std::uint64_t start = Latency_clock::now();
+		bool success = queue_.pop(val);
+		pop_hist_.record(Latency_clock::now() - start);
+		return success;
+	}
+
+private:
+	queue_t& queue_;
+	Latency_histogram& push_hist_;
+	Latency_histogram& pop_hist_;
+};
+
+#endif // HISTOGRAM_HPP
@@ -10,7 +10,20 @@
  *	- TAS lock
  *	- TATAS lock
  *	- TAS expbo lock
- *	- FUTEX lock (Linux only)
+ *	- Ticket lock
+ *	- MCS lock
+ *	- CLH lock
+ *	- Tagged lock (lock bit and Node tag in one word)
+ *	- Versioned lock (seqlock, allows optimistic reads)
+ *	- FUTEX lock, process private or process-shared (Linux only)
+ *	- Adaptive spin-then-park lock with backoff policies (Linux only)
+ *
+ *	Locks which are stored in every Node of the CPQ have to be copyable as
+ *	the heap is a std::vector. The heap only grows while all locks are 
+ *	released, a copy is therefore a new unlocked lock.
+ *
+ *	Locks which work in memory shared between processes (no pointers, no
+ *	thread local state, no private futexes) are marked by is_process_shared.
  */
 
 #ifndef LOCKS_HPP
@@ -19,11 +32,10 @@
 #include <omp.h>
 #include <mutex>
 #include <vector>
+#include <cassert>
 
 #include "atomics.hpp"
 
-#define USE_INTRINSICS
-
 /****************************
  * 		OpenMP Lock 		*
  ****************************/
@@ -58,29 +70,19 @@ class TAS_lock
 {
 public:
 	TAS_lock() : lock_(0) {}
+	TAS_lock(const TAS_lock&) : lock_(0) {}
 	
 	inline void lock()
 	{
-#ifdef USE_INTRINSICS
-		while (__sync_lock_test_and_set(&lock_, 1)) do_nothing();
-#else
-		register unsigned char res = 1;
-		while (res != 0) 
-			asm __volatile__( "xchg %0,%1" : "+q" (res), "+m" (lock_) : : );
-#endif
+		while (lock_.exchange(1, std::memory_order_acquire)) do_nothing();
 	}
 	
 	inline void unlock()
 	{
-#ifdef USE_INTRINSICS
-		__sync_lock_release(&lock_);
-#else
-    	asm __volatile__("mfence" : : : "memory" );
-        lock_ = 0;
-#endif
-	 }
+		lock_.store(0, std::memory_order_release);
+	}
 private:
-	volatile int lock_;
+	std::atomic<int> lock_;
 };
 
 
@@ -91,31 +93,20 @@ class TATAS_lock
 {
 public:
 	TATAS_lock() : lock_(0) {}
+	TATAS_lock(const TATAS_lock&) : lock_(0) {}
 	
 	inline void lock()
 	{
-#ifdef USE_INTRINSICS
-		while (__sync_lock_test_and_set(&lock_, 1))
-			while (lock_ == 1) do_nothing();
-#else
-    	register unsigned char res = 1;
-    	while (lock_ == 1) do_nothing();
-    	while (res != 0)
-    		asm __volatile__("xchg %0,%1" :"+q" (res), "+m" (lock_) : : );
-#endif
+		while (lock_.exchange(1, std::memory_order_acquire))
+			while (lock_.load(std::memory_order_relaxed) == 1) do_nothing();
 	}
 	
 	inline void unlock()
 	{
-#ifdef USE_INTRINSICS
-		__sync_lock_release(&lock_);
-#else
-    	asm __volatile__("mfence" : : : "memory");
-        lock_ = 0;
-#endif
-	 }
+		lock_.store(0, std::memory_order_release);
+	}
 private:
-	volatile int lock_;
+	std::atomic<int> lock_;
 };
 
 /****************************
@@ -125,54 +116,359 @@ class TASexpbo_lock
 {
 public:
 	TASexpbo_lock() : lock_(0) {}
+	TASexpbo_lock(const TASexpbo_lock&) : lock_(0) {}
 	
 	inline void lock()
 	{
-#ifdef USE_INTRINSICS
 		int time = 1;
-		while (__sync_lock_test_and_set(&lock_, 1))
+		while (lock_.exchange(1, std::memory_order_acquire))
 	    {
-			if(lock_ == 1)
+			if(lock_.load(std::memory_order_relaxed) == 1)
 			{
-				time *= 2;
+				if(time < MAX_BACKOFF) time *= 2;
 				for(int i = 0; i < time; ++i)
 					do_nothing();
 			}
 		}
-#else
-		int time = 1;
-    	register unsigned char res = 1;
-    	while (res != 0)
-    	{
-    		asm __volatile__("xchg %0,%1" :"+q" (res), "+m" (lock_) : : "memory");
+	}
+	
+	inline void unlock()
+	{
+		lock_.store(0, std::memory_order_release);
+	}
+private:
+	static const int MAX_BACKOFF = 1 << 10;
+
+	std::atomic<int> lock_;
+};
+
+/****************************
+ * 		Ticket lock 		*
+ ****************************/
+class ticket_lock
+{
+public:
+	ticket_lock() : next_ticket_(0), now_serving_(0) {}
+	ticket_lock(const ticket_lock&) : next_ticket_(0), now_serving_(0) {}
+	
+	inline void lock()
+	{
+		unsigned ticket = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+		
+		// Back off proportionally to our position in the queue
+		unsigned serving;
+		while ((serving = now_serving_.load(std::memory_order_acquire)) != ticket)
+			for(unsigned i = 0; i < BACKOFF_BASE*(ticket - serving); ++i)
+				do_nothing();
+	}
+	
+	inline void unlock()
+	{
+		// Only the owner writes now_serving_, no RMW needed
+		unsigned next = now_serving_.load(std::memory_order_relaxed) + 1;
+		now_serving_.store(next, std::memory_order_release);
+	}
+private:
+	static const unsigned BACKOFF_BASE = 32;
+
+	std::atomic<unsigned> next_ticket_;
+	std::atomic<unsigned> now_serving_;
+};
+
+/****************************
+ * 			MCS lock 		*
+ ****************************/
+// The queue nodes are not stored in the lock but in a small thread local 
+// pool, hence an MCS lock only costs two pointers per Node. A thread can 
+// hold up to MAX_QNODES MCS locks at the same time from the pool (the CPQ
+// needs three), further queue nodes are allocated on the heap.
+struct MCS_qnode
+{
+	std::atomic<MCS_qnode*> next;
+	std::atomic<int> locked;
+	char pad[64 - sizeof(std::atomic<MCS_qnode*>) - sizeof(std::atomic<int>)];
+};
+
+class MCS_lock
+{
+public:
+	MCS_lock() : tail_(nullptr), owner_(nullptr) {}
+	MCS_lock(const MCS_lock&) : tail_(nullptr), owner_(nullptr) {}
+	
+	inline void lock()
+	{
+		MCS_qnode* node = acquire_qnode();
+		node->next.store(nullptr, std::memory_order_relaxed);
+		node->locked.store(1, std::memory_order_relaxed);
+		
+		// Release publishes the initialized node to our successor, acquire
+		// pairs with the releasing CAS of an uncontended unlock
+		MCS_qnode* pred = tail_.exchange(node, std::memory_order_acq_rel);
+		
+		if(pred)
+		{
+			pred->next.store(node, std::memory_order_release);
+			while(node->locked.load(std::memory_order_acquire)) do_nothing();
+		}
+		owner_ = node;
+	}
+	
+	inline void unlock()
+	{
+		MCS_qnode* node = owner_;
+		MCS_qnode* next = node->next.load(std::memory_order_acquire);
+		
+		if(!next)
+		{
+			// No known successor, try to reset the tail
+			MCS_qnode* expected = node;
+			if(tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release,
+											 std::memory_order_relaxed))
 			{
-				time *= 2;
-				for(int i = 0; i < time; ++i)
-					do_nothing();
+				release_qnode(node);
+				return;
 			}
-    	}
-#endif
+			
+			// A successor is enqueuing, wait until it linked itself
+			while(!(next = node->next.load(std::memory_order_acquire))) do_nothing();
+		}
+		
+		next->locked.store(0, std::memory_order_release);
+		release_qnode(node);
+	}
+private:
+	static const unsigned MAX_QNODES = 8;
+
+	struct qnode_pool
+	{
+		MCS_qnode nodes[MAX_QNODES];
+		unsigned used;
+	};
+
+	static inline qnode_pool& pool()
+	{
+		static thread_local qnode_pool pool_;
+		return pool_;
+	}
+
+	static inline MCS_qnode* acquire_qnode()
+	{
+		qnode_pool& p = pool();
+		if(!(~p.used & ((1u << MAX_QNODES) - 1)))
+			return new MCS_qnode;
+		unsigned idx = __builtin_ctz(~p.used);
+		p.used |= 1u << idx;
+		return &p.nodes[idx];
+	}
+
+	static inline void release_qnode(MCS_qnode* node)
+	{
+		qnode_pool& p = pool();
+		if(node < p.nodes || node >= p.nodes + MAX_QNODES)
+			delete node;
+		else
+			p.used &= ~(1u << (node - p.nodes));
+	}
+
+	std::atomic<MCS_qnode*> tail_;
+	MCS_qnode* owner_;
+};
+
+/****************************
+ * 			CLH lock 		*
+ ****************************/
+// A thread enqueues a node and spins on the node of its predecessor. Once
+// the lock is acquired the predecessor node is free and becomes the spare
+// node of the thread, hence every thread only owns a single node no matter
+// how many CLH locks it holds. An unlocked lock owns the node in tail_.
+struct CLH_qnode
+{
+	CLH_qnode() : locked(0) {}
+
+	std::atomic<int> locked;
+	char pad[64 - sizeof(std::atomic<int>)];
+};
+
+class CLH_lock
+{
+public:
+	CLH_lock() : tail_(new CLH_qnode), owner_(nullptr) {}
+	CLH_lock(const CLH_lock&) : tail_(new CLH_qnode), owner_(nullptr) {}
+	~CLH_lock() { delete tail_.load(std::memory_order_relaxed); }
+	
+	inline void lock()
+	{
+		spare_node& spare = spare_qnode();
+		CLH_qnode* node = spare.node;
+		node->locked.store(1, std::memory_order_relaxed);
+		
+		CLH_qnode* pred = tail_.exchange(node, std::memory_order_acq_rel);
+		while(pred->locked.load(std::memory_order_acquire)) do_nothing();
+		
+		owner_ = node;
+		spare.node = pred;
+	}
+	
+	inline void unlock()
+	{
+		owner_->locked.store(0, std::memory_order_release);
+	}
+private:
+	CLH_lock& operator=(const CLH_lock&);
+
+	struct spare_node
+	{
+		spare_node() : node(new CLH_qnode) {}
+		~spare_node() { delete node; }
+		CLH_qnode* node;
+	};
+
+	static inline spare_node& spare_qnode()
+	{
+		static thread_local spare_node spare_;
+		return spare_;
+	}
+
+	std::atomic<CLH_qnode*> tail_;
+	CLH_qnode* owner_;
+};
+
+/****************************
+ * 		Tagged lock 		*
+ ****************************/
+// TATAS spinlock which stores an int tag in the upper 31 bits of the lock 
+// word. The Node specialization for this lock keeps its tag here, so 
+// acquiring the lock also reads the tag and unlocking is a plain store.
+class tagged_lock
+{
+public:
+	tagged_lock(int tag = 0) : word_(encode(tag)) {}
+	
+	// A copy keeps the tag but is unlocked
+	tagged_lock(const tagged_lock& other) 
+		: word_(other.word_.load(std::memory_order_relaxed) & ~1) 
+	{}
+	
+	// Returns the tag at the time the lock was acquired
+	inline int lock()
+	{
+		for(;;)
+		{
+			int word = word_.load(std::memory_order_relaxed);
+			if(!(word & 1) && word_.compare_exchange_weak(word, word | 1, 
+														  std::memory_order_acquire,
+														  std::memory_order_relaxed))
+				return word >> 1;
+			do_nothing();
+		}
+	}
+	
+	inline void unlock()
+	{
+		// Only the owner writes the lock word, no RMW needed
+		int word = word_.load(std::memory_order_relaxed) & ~1;
+		word_.store(word, std::memory_order_release);
+	}
+	
+	// The tag may only be changed while holding the lock (or serially)
+	inline int tag() const { return word_.load(std::memory_order_relaxed) >> 1; }
+	inline void set_tag(int tag) 
+	{ 
+		int lock_bit = word_.load(std::memory_order_relaxed) & 1;
+		word_.store(encode(tag) | lock_bit, std::memory_order_relaxed); 
+	}
+	
+private:
+	static inline int encode(int tag) { return int(unsigned(tag) << 1); }
+
+	/*
+	 *	bit 0		: lock bit
+	 *	bits 1-31	: tag
+	 */
+	std::atomic<int> word_;
+};
+
+/****************************
+ * 		Versioned lock 		*
+ ****************************/
+// Seqlock style spinlock: the version is odd while the lock is held and every
+// lock/unlock pair advances it by two. Readers can therefore read the data 
+// protected by the lock optimistically and validate afterwards that the 
+// version did not change. try_lock(version) acquires the lock only if nobody
+// locked it since the version was read. The protected data has to be read 
+// and written with (relaxed) atomics.
+class versioned_lock
+{
+public:
+	versioned_lock() : version_(0) {}
+	versioned_lock(const versioned_lock&) : version_(0) {}
+	
+	inline void lock()
+	{
+		for(;;)
+		{
+			unsigned version = version_.load(std::memory_order_relaxed);
+			if(!(version & 1) && try_lock(version))
+				return;
+			do_nothing();
+		}
+	}
+	
+	inline bool try_lock(unsigned version)
+	{
+		if(!version_.compare_exchange_strong(version, version + 1, std::memory_order_acquire,
+											 std::memory_order_relaxed))
+			return false;
+		
+		// Writes to the data must not become visible before the odd version
+		std::atomic_thread_fence(std::memory_order_release);
+		return true;
 	}
 	
 	inline void unlock()
 	{
-#ifdef USE_INTRINSICS
-		__sync_lock_release(&lock_);
-#else
-    	asm __volatile__("mfence" : : : "memory");
-        lock_ = 0;
-#endif
-	 }
+		// Only the owner writes the version, no RMW needed
+		unsigned version = version_.load(std::memory_order_relaxed) + 1;
+		version_.store(version, std::memory_order_release);
+	}
+	
+	// Wait until the lock is free and return the current version
+	inline unsigned read_begin() const
+	{
+		unsigned version;
+		while((version = version_.load(std::memory_order_acquire)) & 1) do_nothing();
+		return version;
+	}
+	
+	// True if the data read since read_begin() is consistent
+	inline bool read_validate(unsigned version) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return version_.load(std::memory_order_relaxed) == version;
+	}
+	
 private:
-	volatile int lock_;
+	std::atomic<unsigned> version_;
 };
  
+/* Locks which can be placed in memory shared between processes */
+template< class lock_t >
+struct is_process_shared { static const bool value = false; };
+
+template<> struct is_process_shared<TAS_lock> { static const bool value = true; };
+template<> struct is_process_shared<TATAS_lock> { static const bool value = true; };
+template<> struct is_process_shared<TASexpbo_lock> { static const bool value = true; };
+template<> struct is_process_shared<ticket_lock> { static const bool value = true; };
+template<> struct is_process_shared<tagged_lock> { static const bool value = true; };
+template<> struct is_process_shared<versioned_lock> { static const bool value = true; };
+ 
 // The following code only works on linux
 // The code is inspired by http://locklessinc.com/articles/mutex_cv_futex/
 #ifdef __linux__ 
 
 #include <linux/futex.h>
 #include <unistd.h>
+#include <sched.h>
 #include <sys/syscall.h>
 
 #include "atomics.hpp"
@@ -183,15 +479,31 @@ inline long sys_futex(	void *addr1, int op, int val1, struct timespec *timeout,
 	return syscall(SYS_futex, addr1, op, val1, timeout, addr2, val3);
 }
 
+// The kernel waits on the int inside the std::atomic<int>
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+
+inline int* futex_word(std::atomic<int>& lock)
+{
+	return reinterpret_cast<int*>(&lock);
+}
+
 /****************************
  * 		FUTEX lock 			*
  ****************************/
-class futex_lock
+// The _PRIVATE futex operations are keyed by the address space of the calling
+// process. A lock in memory shared between processes has to use the plain 
+// FUTEX_WAIT/FUTEX_WAKE, which the kernel keys by the underlying page.
+template< bool process_shared = false >
+class basic_futex_lock
 {
 public:
-	futex_lock(int local_spin_cnt = 100) 
+	basic_futex_lock(int local_spin_cnt = 100) 
 		: lock_(0), local_spin_cnt_(local_spin_cnt) 
 	{}
+	
+	basic_futex_lock(const basic_futex_lock& other) 
+		: lock_(0), local_spin_cnt_(other.local_spin_cnt_) 
+	{}
 
 	inline void lock()
 	{
@@ -200,53 +512,197 @@ public:
 		// First we spin locally for a while and try to get the lock
 		for(int i = 0; i < local_spin_cnt_; i++)
 		{
-			lock_status = atomic_cmpxchgl(&lock_, 0, 1);
+			lock_status = atomic_cmpxchgl(lock_, 0, 1, std::memory_order_acquire);
 			if(!lock_status) return;
 			do_nothing();
 		}
 
 		// The lock is now contended
 		if(lock_status == 1) 
-			lock_status = atomic_xchgl(&lock_, 2);
+			lock_status = atomic_xchgl(lock_, 2, std::memory_order_acquire);
 
 		// We wait in the kernel until we get the lock
 		while(lock_status)
 		{
-			sys_futex(&lock_, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
-			lock_status = atomic_xchgl(&lock_, 2);
+			sys_futex(futex_word(lock_), WAIT, 2, NULL, NULL, 0);
+			lock_status = atomic_xchgl(lock_, 2, std::memory_order_acquire);
 		}
 	}
 	
 	inline void unlock()
 	{
 		// If no one wants the lock just unlock it
-		if(lock_ == 2)
-			lock_ = 0;
-		else if(atomic_xchgl(&lock_, 0) == 1) 
+		if(lock_.load(std::memory_order_relaxed) == 2)
+			lock_.store(0, std::memory_order_release);
+		else if(atomic_xchgl(lock_, 0, std::memory_order_release) == 1) 
 			return;
 
 		// We spin locally for a while in the hope someone takes the lock
 		for(int i = 0; i < 2*local_spin_cnt_; i++)
 		{
-			if (lock_ == 1)
-				if (atomic_cmpxchgl(&lock_, 1, 2)) return;
+			if (lock_.load(std::memory_order_relaxed) == 1)
+				if (atomic_cmpxchgl(lock_, 1, 2, std::memory_order_relaxed)) return;
 			do_nothing();
 		}
 	
 		// Wake someone up 
-		sys_futex(&lock_, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		sys_futex(futex_word(lock_), WAKE, 1, NULL, NULL, 0);
 	}
 
 private:
+	static const int WAIT = process_shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE;
+	static const int WAKE = process_shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE;
+
 	/*
 	 *	The lock variable lock_ can be either
 	 *	0 = unlocked
 	 *	1 = locked
 	 *	2 = contended
 	 */
-	int lock_;
+	std::atomic<int> lock_;
 	int local_spin_cnt_;
 };
+
+typedef basic_futex_lock<false> futex_lock;
+typedef basic_futex_lock<true> shared_futex_lock;
+
+template<> struct is_process_shared<shared_futex_lock> { static const bool value = true; };
+
+/****************************
+ * 	Backoff policies 		*
+ ****************************/
+// A backoff policy object is created per lock acquisition and called once 
+// after every failed attempt.
+
+/* Single pause instruction */
+struct pause_backoff
+{
+	inline void operator()() { do_nothing(); }
+};
+
+/* Exponential backoff, capped at max_spins pauses */
+template< unsigned min_spins = 4, unsigned max_spins = 1024 >
+struct exp_backoff
+{
+	exp_backoff() : limit_(min_spins) {}
+	
+	inline void operator()()
+	{
+		for(unsigned i = 0; i < limit_; ++i) 
+			do_nothing();
+		if(limit_ < max_spins) limit_ <<= 1;
+	}
+private:
+	unsigned limit_;
+};
+
+/* Randomized exponential backoff, desynchronizes the waiting threads */
+template< unsigned min_spins = 4, unsigned max_spins = 1024 >
+struct rand_backoff
+{
+	rand_backoff() : limit_(min_spins), seed_(reinterpret_cast<std::size_t>(this)) {}
+	
+	inline void operator()()
+	{
+		// xorshift
+		seed_ ^= seed_ << 13;
+		seed_ ^= seed_ >> 7;
+		seed_ ^= seed_ << 17;
+		
+		unsigned spins = seed_ % limit_ + 1;
+		for(unsigned i = 0; i < spins; ++i) 
+			do_nothing();
+		if(limit_ < max_spins) limit_ <<= 1;
+	}
+private:
+	unsigned limit_;
+	std::size_t seed_;
+};
+
+/* Give the processor to another thread */
+struct yield_backoff
+{
+	inline void operator()() { sched_yield(); }
+};
+
+/****************************
+ * 		Adaptive lock 		*
+ ****************************/
+// Spin-then-park lock. A contended lock() spins (calling the backoff policy
+// between attempts) for at most 2*spin_budget_ + 10 rounds and then waits in
+// the kernel like the futex_lock. The spin budget is a moving average of the
+// rounds recent acquisitions needed, an acquisition which had to park counts
+// as 0 rounds. Hence it grows on locks which are handed over quickly (e.g the
+// root) and shrinks on locks which are held long.
+// The budget is only updated while holding the lock, the waiters read it
+// without, hence it is a relaxed atomic.
+template< class backoff_t = exp_backoff<> >
+class adaptive_lock
+{
+public:
+	adaptive_lock() : lock_(0), spin_budget_(INIT_SPINS) {}
+	adaptive_lock(const adaptive_lock&) : lock_(0), spin_budget_(INIT_SPINS) {}
+
+	inline void lock()
+	{
+		if(!atomic_cmpxchgl(lock_, 0, 1, std::memory_order_acquire)) return;
+		
+		backoff_t backoff;
+		int max_spins = 2*spin_budget() + 10;
+		if(max_spins > MAX_SPINS) max_spins = MAX_SPINS;
+		
+		int spins = 0;
+		for(; spins < max_spins; ++spins)
+		{
+			backoff();
+			if(lock_.load(std::memory_order_relaxed) == 0 && 
+			   !atomic_cmpxchgl(lock_, 0, 1, std::memory_order_acquire))
+			{
+				update_budget(spins);
+				return;
+			}
+		}
+		
+		// Spin budget used up, park in the kernel
+		int lock_status = atomic_xchgl(lock_, 2, std::memory_order_acquire);
+		while(lock_status)
+		{
+			sys_futex(futex_word(lock_), FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+			lock_status = atomic_xchgl(lock_, 2, std::memory_order_acquire);
+		}
+		
+		// Spinning did not pay off, spin less next time
+		update_budget(0);
+	}
+	
+	inline void unlock()
+	{
+		if(atomic_xchgl(lock_, 0, std::memory_order_release) == 2)
+			sys_futex(futex_word(lock_), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+	
+	inline int spin_budget() const { return spin_budget_.load(std::memory_order_relaxed); }
+
+private:
+	static const int INIT_SPINS = 100;
+	static const int MAX_SPINS 	= 1000;
+
+	// Called with the lock held, the only writer
+	inline void update_budget(int spins)
+	{
+		int budget = spin_budget_.load(std::memory_order_relaxed);
+		spin_budget_.store(budget + (spins - budget) / 8, std::memory_order_relaxed);
+	}
+
+	/*
+	 *	The lock variable lock_ can be either
+	 *	0 = unlocked
+	 *	1 = locked
+	 *	2 = contended (someone might sleep in the kernel)
+	 */
+	std::atomic<int> lock_;
+	std::atomic<int> spin_budget_;
+};
 #endif // __linux__
 
 #endif // LOCKS_HPP
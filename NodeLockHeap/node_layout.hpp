@@ -0,0 +1,173 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Layout policies for the nodes of the CPQ. The CPQ navigates the heap
+ *	by the classic one based indices (parent i/2, children 2i and 2i+1),
+ *	which the layout maps to the position of the node in the storage. The
+ *	layout also grows the storage, while no thread is in the heap:
+ *
+ *		Heap_layout		position = index. A sift down through a large heap
+ *						touches a new page on every level below the first
+ *						few.
+ *		B_heap_layout	the tree is cut into rows of page_levels levels and
+ *						every row into subtrees, each stored contiguously in
+ *						a block of 2^page_levels positions (the first one is
+ *						unused, in the first block it is the dummy node). A
+ *						sift down touches one block per page_levels levels,
+ *						with 32 byte nodes the default blocks are 2 KiB.
+ *
+ *	The blocks of the last row only have the size of the levels which exist
+ *	so far, otherwise a row with one level would take 2^page_levels times
+ *	the memory. Adding a level to the last row moves its blocks apart (from
+ *	the last one), which is linear in the size of the heap like the copy
+ *	of a growing std::vector.
+ */
+
+#ifndef NODE_LAYOUT_HPP
+#define NODE_LAYOUT_HPP
+
+#include <cstddef>
+
+/****************************
+ * 		Heap layout 		*
+ ****************************/
+struct Heap_layout
+{
+	static inline std::size_t parent(std::size_t i) { return i >> 1; }
+	static inline std::size_t left(std::size_t i) { return i << 1; }
+	static inline std::size_t right(std::size_t i) { return (i << 1) + 1; }
+
+	static inline std::size_t position(std::size_t i) { return i; }
+
+	/* Grows the storage to hold the indices below n */
+	template< class storage_t, class node_t >
+	static void resize(storage_t& nodes, std::size_t n, const node_t& empty)
+	{
+		while(nodes.size() < n)
+			nodes.push_back(empty);
+	}
+};
+
+/****************************
+ * 		B-heap layout 		*
+ ****************************/
+template< unsigned page_levels = 6 >
+class B_heap_layout
+{
+public:
+	static_assert(page_levels > 0 && page_levels < 16, "unreasonable number of levels per block");
+
+	/* Constructor (only the dummy node) */
+	B_heap_layout()
+		: nlevels_(0)
+	{}
+
+	static inline std::size_t parent(std::size_t i) { return i >> 1; }
+	static inline std::size_t left(std::size_t i) { return i << 1; }
+	static inline std::size_t right(std::size_t i) { return (i << 1) + 1; }
+
+	inline std::size_t position(std::size_t i) const
+	{
+		if (i == 0) return 0;
+
+		// The bits of i below the depth of the subtree root are the index
+		// within the block, the bits above select the block
+		const Level& level = levels_[depth_of(i)];
+		return level.base + ((i >> level.shift) << level.block_levels) + 
+			   (i & ((std::size_t(1) << level.shift) - 1));
+	}
+
+	/* Grows the storage to hold the indices below n */
+	template< class storage_t, class node_t >
+	void resize(storage_t& nodes, std::size_t n, const node_t& empty)
+	{
+		unsigned levels = n < 2 ? n : depth_of(n - 1) + 1;
+		while (nlevels_ < levels)
+			add_level(nodes, empty);
+	}
+
+private:
+	/* Position of the index 2^depth and the shifts of the level */
+	struct Level
+	{
+		std::size_t base;
+		unsigned shift;
+		unsigned block_levels;
+	};
+
+	static inline unsigned depth_of(std::size_t i)
+	{
+		return 8 * sizeof(unsigned long long) - 1 - __builtin_clzll(i);
+	}
+
+	// The subtree of index i starts at its ancestor i >> shift, which is
+	// block (i >> shift) - 2^(row page_levels) of the row, and i is at
+	// 2^shift + (i & (2^shift - 1)) in the block. base folds the constants.
+	inline void set_row(unsigned row, std::size_t offset, unsigned block_levels)
+	{
+		row_offset_[row] = offset;
+		for (unsigned depth = row * page_levels; depth < nlevels_; ++depth)
+		{
+			Level& level = levels_[depth];
+			level.shift = depth - row * page_levels;
+			level.block_levels = block_levels;
+			level.base = offset - ((std::size_t(1) << (row * page_levels)) << block_levels) 
+						 + (std::size_t(1) << level.shift);
+		}
+	}
+
+	// The nodes with atomic members (versioned_lock) can not be assigned
+	template< class node_t >
+	static inline void copy(node_t& to, const node_t& from)
+	{
+		to.init(from.value(), from.priority(), from.tag());
+	}
+
+	template< class storage_t, class node_t >
+	void add_level(storage_t& nodes, const node_t& empty)
+	{
+		unsigned row = nlevels_ / page_levels;
+		unsigned old_levels = nlevels_ - row * page_levels;
+		std::size_t nblocks = std::size_t(1) << (row * page_levels);
+		++nlevels_;
+
+		if (old_levels == 0)
+		{
+			// A new row of blocks with one level behind the (full) last row
+			std::size_t offset = row == 0 ? 0 :
+				row_offset_[row-1] + ((std::size_t(1) << ((row-1) * page_levels)) << page_levels);
+			set_row(row, offset, 1);
+
+			while (nodes.size() < offset + (nblocks << 1))
+				nodes.push_back(empty);
+			return;
+		}
+
+		// Double the blocks of the last row, the new level is empty
+		std::size_t old_size = std::size_t(1) << old_levels;
+		std::size_t new_size = old_size << 1;
+		std::size_t offset = row_offset_[row];
+		set_row(row, offset, old_levels + 1);
+
+		while (nodes.size() < offset + nblocks * new_size)
+			nodes.push_back(empty);
+
+		// Block b moves onto the old blocks 2b and 2b+1, which moved already
+		for (std::size_t b = nblocks; b-- > 0; )
+		{
+			if (b > 0)
+				for (std::size_t slot = old_size; slot-- > 1; )
+					copy(nodes[offset + b * new_size + slot], nodes[offset + b * old_size + slot]);
+			for (std::size_t slot = old_size; slot < new_size; ++slot)
+				copy(nodes[offset + b * new_size + slot], empty);
+		}
+	}
+
+	unsigned nlevels_;
+	Level levels_[8 * sizeof(std::size_t)];
+	std::size_t row_offset_[8 * sizeof(std::size_t) / page_levels + 1];
+};
+
+#endif // NODE_LAYOUT_HPP
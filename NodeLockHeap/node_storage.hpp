@@ -0,0 +1,107 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Storage policies for the nodes of the CPQ. A storage is an array of nodes
+ *	which only grows at the end (while no thread is in the heap) and knows
+ *	the owner tag of the calling thread:
+ *
+ *		Vector_storage	std::vector in the memory of the process, the tag is
+ *						the OpenMP thread number
+ *		Shared_storage	fixed capacity array in a segment shared between
+ *						processes (see shared_CPQ.hpp). The array is addressed
+ *						by its offset from the storage object, which is the
+ *						same in every process mapping the segment. The tag
+ *						combines the process id and the thread number.
+ */
+
+#ifndef NODE_STORAGE_HPP
+#define NODE_STORAGE_HPP
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <omp.h>
+#include <unistd.h>
+
+/****************************
+ * 		Vector storage 		*
+ ****************************/
+template< class node_t >
+class Vector_storage
+{
+public:
+	inline void push_back(const node_t& node) { nodes_.push_back(node); }
+
+	inline std::size_t size() const { return nodes_.size(); }
+	inline std::size_t max_size() const { return nodes_.max_size(); }
+
+	inline node_t& operator[](std::size_t i) { return nodes_[i]; }
+	inline const node_t& operator[](std::size_t i) const { return nodes_[i]; }
+
+	static inline int owner_tag() { return omp_get_thread_num(); }
+
+private:
+	std::vector<node_t> nodes_;
+};
+
+/****************************
+ * 		Shared storage 		*
+ ****************************/
+template< class node_t >
+class Shared_storage
+{
+public:
+	/* The storage and the capacity nodes have to be in the same mapping */
+	Shared_storage(void* nodes, std::size_t capacity)
+		: offset_(static_cast<char*>(nodes) - reinterpret_cast<char*>(this)),
+		  size_(0), capacity_(capacity)
+	{}
+
+	inline void push_back(const node_t& node)
+	{
+		if(size_ == capacity_)
+			throw std::length_error("shared node storage is full");
+		new (data() + size_) node_t(node);
+		++size_;
+	}
+
+	inline std::size_t size() const { return size_; }
+	inline std::size_t max_size() const { return capacity_; }
+
+	inline node_t& operator[](std::size_t i) { return data()[i]; }
+	inline const node_t& operator[](std::size_t i) const { return data()[i]; }
+
+	// Process ids are below 2^22 (PID_MAX_LIMIT), the tag stays below 2^30
+	// and thus fits the 31 bit tag of the tagged_lock
+	static inline int owner_tag()
+	{
+		return int(getpid()) << THREAD_BITS | (omp_get_thread_num() & ((1 << THREAD_BITS) - 1));
+	}
+
+private:
+	// The offset is relative to this object, a copy would point elsewhere
+	Shared_storage(const Shared_storage&);
+	Shared_storage& operator=(const Shared_storage&);
+
+	static const int THREAD_BITS = 8;
+
+	inline node_t* data()
+	{
+		return reinterpret_cast<node_t*>(reinterpret_cast<char*>(this) + offset_);
+	}
+
+	inline const node_t* data() const
+	{
+		return reinterpret_cast<const node_t*>(reinterpret_cast<const char*>(this) + offset_);
+	}
+
+	std::ptrdiff_t offset_;
+	std::size_t size_;
+	std::size_t capacity_;
+};
+
+#endif // NODE_STORAGE_HPP
@@ -0,0 +1,155 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	Minimal command line parser for the benchmark drivers. Options have the
+ *	form "--name value" or "--name" (a flag). Lists are comma separated and
+ *	integer lists may contain ranges "first-last" or "first-last:step".
+ */
+
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Options
+{
+public:
+	Options(int argc, char* argv[])
+	{
+		for(int i = 1; i < argc; ++i)
+		{
+			std::string arg(argv[i]);
+			if(arg.size() < 3 || arg.compare(0, 2, "--") != 0)
+				throw std::invalid_argument("unexpected argument '" + arg + "'");
+
+			std::string key = arg.substr(2);
+			std::string value;
+
+			std::size_t eq = key.find('=');
+			if(eq != std::string::npos)
+			{
+				value = key.substr(eq + 1);
+				key = key.substr(0, eq);
+			}
+			else if(i + 1 < argc && std::string(argv[i+1]).compare(0, 2, "--") != 0)
+				value = argv[++i];
+
+			options_[key] = value;
+		}
+	}
+
+	inline bool has(const std::string& key) const
+	{
+		return options_.count(key) != 0;
+	}
+
+	std::string get(const std::string& key, const std::string& def) const
+	{
+		std::map<std::string, std::string>::const_iterator it = options_.find(key);
+		return it == options_.end() ? def : it->second;
+	}
+
+	// Accepts plain integers as well as powers of two written as "2^17"
+	std::size_t get_size(const std::string& key, std::size_t def) const
+	{
+		return has(key) ? parse_size(key, get(key, "")) : def;
+	}
+
+	double get_double(const std::string& key, double def) const
+	{
+		if(!has(key)) return def;
+
+		std::string value = get(key, "");
+		char* end = 0;
+		double result = std::strtod(value.c_str(), &end);
+		if(value.empty() || *end != '\0')
+			throw std::invalid_argument("invalid value '" + value + "' for --" + key);
+		return result;
+	}
+
+	// Two sizes separated by a colon, e.g. "1:3"
+	std::pair<std::size_t, std::size_t> get_pair(const std::string& key, const std::string& def) const
+	{
+		std::string value = get(key, def);
+		std::size_t colon = value.find(':');
+		if(colon == std::string::npos)
+			throw std::invalid_argument("invalid value '" + value + "' for --" + key + " (expected a:b)");
+		return std::make_pair(parse_size(key, value.substr(0, colon)),
+							  parse_size(key, value.substr(colon + 1)));
+	}
+
+	std::vector<std::string> get_list(const std::string& key, const std::string& def) const
+	{
+		std::vector<std::string> list;
+		std::istringstream ss(get(key, def));
+		std::string item;
+		while(std::getline(ss, item, ','))
+			if(!item.empty()) list.push_back(item);
+		return list;
+	}
+
+	std::vector<std::size_t> get_range(const std::string& key, const std::string& def) const
+	{
+		std::vector<std::size_t> range;
+		std::vector<std::string> list = get_list(key, def);
+
+		for(std::size_t i = 0; i < list.size(); ++i)
+		{
+			std::string item = list[i];
+			std::size_t step = 1;
+
+			std::size_t colon = item.find(':');
+			if(colon != std::string::npos)
+			{
+				step = parse_size(key, item.substr(colon + 1));
+				item = item.substr(0, colon);
+			}
+
+			std::size_t dash = item.find('-');
+			if(dash == std::string::npos)
+				range.push_back(parse_size(key, item));
+			else
+			{
+				std::size_t first = parse_size(key, item.substr(0, dash));
+				std::size_t last = parse_size(key, item.substr(dash + 1));
+				if(step == 0 || first > last)
+					throw std::invalid_argument("invalid range '" + list[i] + "' for --" + key);
+				for(std::size_t n = first; n <= last; n += step)
+					range.push_back(n);
+			}
+		}
+		return range;
+	}
+
+private:
+	static std::size_t parse_size(const std::string& key, const std::string& value)
+	{
+		char* end = 0;
+		std::size_t caret = value.find('^');
+
+		if(caret != std::string::npos)
+		{
+			std::size_t base = parse_size(key, value.substr(0, caret));
+			std::size_t exp = parse_size(key, value.substr(caret + 1));
+			std::size_t result = 1;
+			while(exp--) result *= base;
+			return result;
+		}
+
+		unsigned long long result = std::strtoull(value.c_str(), &end, 10);
+		if(value.empty() || *end != '\0')
+			throw std::invalid_argument("invalid value '" + value + "' for --" + key);
+		return result;
+	}
+
+	std::map<std::string, std::string> options_;
+};
+
+#endif // OPTIONS_HPP
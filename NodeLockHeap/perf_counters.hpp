@@ -0,0 +1,161 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Hardware performance counters of the calling thread via perf_event_open.
+ *	The events are opened as one group (cycles, instructions, LLC read misses,
+ *	dTLB read misses and optionally a raw event), so they are scheduled onto
+ *	the PMU together and their ratios are consistent. If the kernel had to
+ *	multiplex the group, the counts are scaled by time_enabled/time_running.
+ *
+ *	Counting cache-line transfers needs a model specific raw event, e.g. on
+ *	Intel Skylake MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM is 0x04d2 (umask << 8 |
+ *	event). It is only opened if a non-zero raw config is given.
+ *
+ *	Every event which can not be opened (no PMU in a VM, perf_event_paranoid,
+ *	unknown raw event, not Linux) is reported as unavailable, the others are
+ *	still counted.
+ */
+
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class Perf_counters
+{
+public:
+	enum Event { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, XFERS, NEVENTS };
+
+	static const char* name(int event)
+	{
+		static const char* names[NEVENTS] =
+			{ "cycles", "instructions", "llc_misses", "dtlb_misses", "xfers" };
+		return names[event];
+	}
+
+	/* Opens the group for the calling thread (disabled) */
+	explicit Perf_counters(std::uint64_t raw_config = 0)
+		: leader_(-1), nopen_(0)
+	{
+		for(int i = 0; i < NEVENTS; ++i)
+		{
+			fd_[i] = -1;
+			slot_[i] = -1;
+		}
+
+#ifdef __linux__
+		open_event(CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		open_event(INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		open_event(LLC_MISSES, PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_LL));
+		open_event(DTLB_MISSES, PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_DTLB));
+		if(raw_config)
+			open_event(XFERS, PERF_TYPE_RAW, raw_config);
+#endif
+	}
+
+	~Perf_counters()
+	{
+#ifdef __linux__
+		for(int i = 0; i < NEVENTS; ++i)
+			if(fd_[i] >= 0) close(fd_[i]);
+#endif
+	}
+
+	inline bool available(int event) const { return fd_[event] >= 0; }
+
+	/* Resets and enables all counters of the group */
+	void start()
+	{
+#ifdef __linux__
+		if(leader_ < 0) return;
+		ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	void stop()
+	{
+#ifdef __linux__
+		if(leader_ < 0) return;
+		ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	/**
+	 *	read:	Adds the (scaled) counts since start() to counts. Unavailable
+	 *			events are left untouched.
+	 */
+	void read(double counts[NEVENTS]) const
+	{
+#ifdef __linux__
+		if(leader_ < 0) return;
+
+		// Layout of PERF_FORMAT_GROUP | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING
+		std::uint64_t buffer[3 + NEVENTS];
+		ssize_t bytes = ::read(leader_, buffer, sizeof(buffer));
+		if(bytes < ssize_t(3 * sizeof(std::uint64_t)))
+			return;
+
+		std::uint64_t nr = buffer[0];
+		double scale = buffer[2] ? double(buffer[1]) / double(buffer[2]) : 0.0;
+
+		for(int i = 0; i < NEVENTS; ++i)
+			if(slot_[i] >= 0 && std::uint64_t(slot_[i]) < nr)
+				counts[i] += double(buffer[3 + slot_[i]]) * scale;
+#endif
+	}
+
+private:
+	Perf_counters(const Perf_counters&);
+	Perf_counters& operator=(const Perf_counters&);
+
+#ifdef __linux__
+	static std::uint64_t cache_config(std::uint64_t cache)
+	{
+		return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	}
+
+	// The first event which opens becomes the group leader
+	void open_event(int event, std::uint32_t type, std::uint64_t config)
+	{
+		struct perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = leader_ < 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+						   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+		if(fd < 0)
+			return;
+
+		if(leader_ < 0)
+			leader_ = fd;
+
+		fd_[event] = fd;
+		slot_[event] = nopen_++;
+	}
+#endif
+
+	int fd_[NEVENTS];
+	int slot_[NEVENTS];		// position of the event in the group read
+	int leader_;
+	int nopen_;
+};
+
+#endif // PERF_COUNTERS_HPP
@@ -0,0 +1,194 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Ordering quality of a concurrent priority queue. Every operation of a
+ *	concurrent run is time stamped with Latency_clock (the TSC, which is
+ *	synchronized across cores on every x86 CPU with an invariant TSC) and
+ *	logged per thread. Afterwards the logs are merged into one linearization:
+ *
+ *		insert	takes effect when it returns (the element is surely present)
+ *		pop		takes effect when it is called (every element inserted
+ *				before is surely present)
+ *
+ *	Replaying the linearization with a Fenwick tree over the priorities gives
+ *	the rank error of every successful pop: the number of present elements
+ *	with a strictly higher priority than the popped one. A strict priority
+ *	queue has rank error 0, relaxed queues trade rank error for throughput.
+ *
+ *	A pop whose element was not yet inserted in the linearization (possible
+ *	as insert and pop overlap) is counted as unmatched.
+ *
+ *	The popped value must be the priority, as in all benchmarks.
+ */
+
+#ifndef RANK_ERROR_HPP
+#define RANK_ERROR_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+
+#include "histogram.hpp"
+
+/****************************
+ * 		Rank recorder 		*
+ ****************************/
+class Rank_recorder
+{
+public:
+	struct Event
+	{
+		std::uint64_t time;
+		std::uint64_t priority;
+		bool insert;
+
+		bool operator<(const Event& other) const { return time < other.time; }
+	};
+
+	/* Constructor (one log per OpenMP thread id below nthreads) */
+	Rank_recorder(std::size_t nthreads)
+		: logs_(nthreads)
+	{}
+
+	// Element present before the concurrent run started
+	inline void initial(std::uint64_t priority) { initial_.push_back(priority); }
+
+	inline void log(std::uint64_t time, std::uint64_t priority, bool insert)
+	{
+		Event event = { time, priority, insert };
+		logs_[omp_get_thread_num()].events.push_back(event);
+	}
+
+	/**
+	 *	analyze:	Replays the linearization and records the rank error of
+	 *				every successful pop in ranks. Returns the number of
+	 *				unmatched pops.
+	 */
+	std::size_t analyze(Latency_histogram& ranks) const
+	{
+		std::vector<Event> events;
+		for(std::size_t t = 0; t < logs_.size(); ++t)
+			events.insert(events.end(), logs_[t].events.begin(), logs_[t].events.end());
+		std::stable_sort(events.begin(), events.end());
+
+		// Compress the priorities to the indices of a Fenwick tree
+		std::vector<std::uint64_t> keys(initial_);
+		for(std::size_t i = 0; i < events.size(); ++i)
+			keys.push_back(events[i].priority);
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		Fenwick_tree present(keys.size());
+		for(std::size_t i = 0; i < initial_.size(); ++i)
+			present.add(index(keys, initial_[i]), 1);
+
+		std::size_t unmatched = 0;
+
+		for(std::size_t i = 0; i < events.size(); ++i)
+		{
+			std::size_t k = index(keys, events[i].priority);
+
+			if(events[i].insert)
+				present.add(k, 1);
+			else
+			{
+				if(present.count(k) <= 0)
+					unmatched++;
+				else
+					ranks.record(present.total() - present.prefix(k + 1));
+
+				// The counts may go negative for unmatched pops until the
+				// insert shows up in the linearization
+				present.add(k, -1);
+			}
+		}
+		return unmatched;
+	}
+
+private:
+	static inline std::size_t index(const std::vector<std::uint64_t>& keys, std::uint64_t key)
+	{
+		return std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+	}
+
+	// Counts per priority index with O(log n) prefix sums
+	class Fenwick_tree
+	{
+	public:
+		Fenwick_tree(std::size_t n) : tree_(n + 1, 0), counts_(n, 0), total_(0) {}
+
+		inline void add(std::size_t i, long delta)
+		{
+			counts_[i] += delta;
+			total_ += delta;
+			for(++i; i < tree_.size(); i += i & (~i + 1))
+				tree_[i] += delta;
+		}
+
+		// Sum of the counts of the indices [0, n)
+		inline long prefix(std::size_t n) const
+		{
+			long sum = 0;
+			for(; n > 0; n -= n & (~n + 1))
+				sum += tree_[n];
+			return sum;
+		}
+
+		inline long count(std::size_t i) const { return counts_[i]; }
+		inline long total() const { return total_; }
+
+	private:
+		std::vector<long> tree_;
+		std::vector<long> counts_;
+		long total_;
+	};
+
+	// The logs of different threads must not share a cacheline
+	struct Log
+	{
+		std::vector<Event> events;
+		char pad[64];
+	};
+
+	std::vector<Log> logs_;
+	std::vector<std::uint64_t> initial_;
+};
+
+/****************************
+ * 		  Rank queue 		*
+ ****************************/
+// Adaptor logging the operations of the wrapped queue adaptor
+template< class queue_t >
+class Rank_queue
+{
+public:
+	Rank_queue(queue_t& queue, Rank_recorder& recorder)
+		: queue_(queue), recorder_(recorder)
+	{}
+
+	template< class value_t >
+	inline void push(value_t val, std::size_t priority)
+	{
+		queue_.push(val, priority);
+		recorder_.log(Latency_clock::now(), priority, true);
+	}
+
+	template< class value_t >
+	inline bool pop(value_t& val)
+	{
+		std::uint64_t time = Latency_clock::now();
+		bool success = queue_.pop(val);
+		if(success)
+			recorder_.log(time, val, false);
+		return success;
+	}
+
+private:
+	queue_t& queue_;
+	Rank_recorder& recorder_;
+};
+
+#endif // RANK_ERROR_HPP
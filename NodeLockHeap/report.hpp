@@ -0,0 +1,131 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	Machine-readable benchmark output. A Result_row is an ordered list of
+ *	(key, value) pairs, the Result_writer prints rows either as CSV (the
+ *	header is taken from the first row) or as JSON lines (one object per row).
+ */
+
+#ifndef REPORT_HPP
+#define REPORT_HPP
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+class Result_row
+{
+public:
+	Result_row& add(const std::string& key, const std::string& value)
+	{
+		entries_.push_back(Entry(key, value, true));
+		return *this;
+	}
+
+	Result_row& add(const std::string& key, const char* value)
+	{
+		return add(key, std::string(value));
+	}
+
+	template< class T >
+	Result_row& add(const std::string& key, T value)
+	{
+		std::ostringstream ss;
+		ss << std::setprecision(10) << value;
+		entries_.push_back(Entry(key, ss.str(), false));
+		return *this;
+	}
+
+	// Value which could not be measured, empty in CSV and null in JSON
+	Result_row& add_missing(const std::string& key)
+	{
+		entries_.push_back(Entry(key, "", false));
+		return *this;
+	}
+
+	// Append all entries of another row
+	Result_row& add(const Result_row& row)
+	{
+		entries_.insert(entries_.end(), row.entries_.begin(), row.entries_.end());
+		return *this;
+	}
+
+	struct Entry
+	{
+		Entry(const std::string& k, const std::string& v, bool q)
+			: key(k), value(v), quoted(q)
+		{}
+
+		std::string key;
+		std::string value;
+		bool quoted;
+	};
+
+	inline const std::vector<Entry>& entries() const { return entries_; }
+
+private:
+	std::vector<Entry> entries_;
+};
+
+class Result_writer
+{
+public:
+	enum Format { CSV, JSON };
+
+	Result_writer(std::ostream& out, Format format = CSV)
+		: out_(out), format_(format), header_written_(false)
+	{}
+
+	static Format parse_format(const std::string& format)
+	{
+		if(format == "csv")  return CSV;
+		if(format == "json") return JSON;
+		throw std::invalid_argument("unknown output format '" + format + "'");
+	}
+
+	void write(const Result_row& row)
+	{
+		const std::vector<Result_row::Entry>& entries = row.entries();
+
+		if(format_ == CSV)
+		{
+			if(!header_written_)
+			{
+				for(std::size_t i = 0; i < entries.size(); ++i)
+					out_ << (i ? "," : "") << entries[i].key;
+				out_ << '\n';
+				header_written_ = true;
+			}
+
+			for(std::size_t i = 0; i < entries.size(); ++i)
+				out_ << (i ? "," : "") << entries[i].value;
+			out_ << std::endl;
+		}
+		else
+		{
+			out_ << '{';
+			for(std::size_t i = 0; i < entries.size(); ++i)
+			{
+				out_ << (i ? ", " : "") << '"' << entries[i].key << "\": ";
+				if(entries[i].quoted)
+					out_ << '"' << entries[i].value << '"';
+				else if(entries[i].value.empty())
+					out_ << "null";
+				else
+					out_ << entries[i].value;
+			}
+			out_ << '}' << std::endl;
+		}
+	}
+
+private:
+	std::ostream& out_;
+	Format format_;
+	bool header_written_;
+};
+
+#endif // REPORT_HPP
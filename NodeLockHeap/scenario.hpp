@@ -0,0 +1,382 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Building blocks of the producer/consumer scenarios of the benchmark.
+ *
+ *	Scenario_config describes a scenario: the producer:consumer thread split,
+ *	the fraction of inserts, the burst pattern of the producers and the
+ *	distribution of the priorities (see Priority_generator).
+ *
+ *	Progress counts the pushes and pops of every thread and samples the
+ *	counters from a separate thread every few microseconds, which gives the
+ *	queue size over time and the sustained throughput of a run. The counters
+ *	are written by their owning thread only (no atomic read-modify-write) and
+ *	lie on separate cachelines, so counting is almost free.
+ */
+
+#ifndef SCENARIO_HPP
+#define SCENARIO_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <omp.h>
+
+#include "histogram.hpp"
+
+/****************************
+ * 	  Scenario config 		*
+ ****************************/
+struct Scenario_config
+{
+	enum Distribution { UNIFORM, ZIPF, INCREASING, NEARLY_SORTED };
+
+	static Distribution parse_distribution(const std::string& name)
+	{
+		if(name == "uniform")		return UNIFORM;
+		if(name == "zipf")			return ZIPF;
+		if(name == "increasing")	return INCREASING;
+		if(name == "nearly-sorted")	return NEARLY_SORTED;
+		throw std::invalid_argument("unknown distribution '" + name + "'");
+	}
+
+	std::size_t producer_share;	// producer:consumer split of the threads,
+	std::size_t consumer_share;	// 0:0 lets every thread do both
+	double insert_ratio;		// fraction of the operations which insert
+	std::size_t burst_size;		// inserts per burst (0: no bursts)
+	std::size_t burst_gap_ns;	// pause of a producer between two bursts
+	Distribution distribution;
+	double zipf_exponent;
+	std::size_t zipf_keys;		// number of distinct priorities of ZIPF
+	std::size_t disorder;		// maximal displacement of NEARLY_SORTED
+
+	/**
+	 *	producers:	Number of producer threads out of nthreads, 0 if every
+	 *				thread both inserts and pops. Both roles get at least one
+	 *				thread, a single thread does both.
+	 */
+	std::size_t producers(std::size_t nthreads) const
+	{
+		std::size_t shares = producer_share + consumer_share;
+		if(shares == 0 || nthreads < 2)
+			return 0;
+
+		std::size_t n = (nthreads * producer_share + shares/2) / shares;
+		return std::max<std::size_t>(1, std::min(n, nthreads - 1));
+	}
+};
+
+/****************************
+ * 	 Priority generator		*
+ ****************************/
+// Thread private generator of the priorities of one scenario thread. The
+// queues pop the highest priority first:
+//
+//		uniform			rng()
+//		zipf			Zipf distributed ranks k in [1, zipf_keys], the most
+//						frequent ranks are mapped to the highest priorities
+//		increasing		every insert is above all previous ones (and above
+//						the uniform initial elements), the threads interleave
+//		nearly-sorted	increasing plus a uniform displacement below disorder
+//
+// Zipf ranks are drawn by rejection-inversion (Hörmann and Derflinger, "Rejection-
+// inversion to generate variates from monotone discrete distributions", 1996),
+// which needs O(1) setup and memory for any number of keys.
+class Priority_generator
+{
+public:
+	Priority_generator(const Scenario_config& config, std::size_t tid, std::size_t nthreads)
+		: config_(config), next_(tid), step_(nthreads), s_(config.zipf_exponent),
+		  n_(double(config.zipf_keys))
+	{
+		if(config.distribution == Scenario_config::ZIPF)
+		{
+			h_x1_ = h_integral(1.5) - 1.0;
+			h_n_ = h_integral(n_ + 0.5);
+			threshold_ = 2.0 - h_integral_inverse(h_integral(2.5) - h(2.0));
+		}
+	}
+
+	template< class rng_t >
+	inline std::size_t operator()(rng_t& rng)
+	{
+		switch(config_.distribution)
+		{
+			case Scenario_config::ZIPF:
+				return config_.zipf_keys - zipf(rng);
+			case Scenario_config::INCREASING:
+				return increasing();
+			case Scenario_config::NEARLY_SORTED:
+				return increasing() + (config_.disorder ? rng() % config_.disorder : 0);
+			default:
+				return rng();
+		}
+	}
+
+private:
+	// Above every value of the 31 bit engines of the benchmarks
+	static const std::size_t INCREASING_BASE = std::size_t(1) << 31;
+
+	inline std::size_t increasing()
+	{
+		std::size_t priority = INCREASING_BASE + next_;
+		next_ += step_;
+		return priority;
+	}
+
+	template< class rng_t >
+	std::size_t zipf(rng_t& rng)
+	{
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+		while(true)
+		{
+			double u = h_n_ + uniform(rng) * (h_x1_ - h_n_);
+			double x = h_integral_inverse(u);
+			double k = std::floor(x + 0.5);
+			k = std::max(1.0, std::min(k, n_));
+
+			if(k - x <= threshold_ || u >= h_integral(k + 0.5) - h(k))
+				return std::size_t(k);
+		}
+	}
+
+	inline double h(double x) const { return std::exp(-s_ * std::log(x)); }
+
+	inline double h_integral(double x) const
+	{
+		double log_x = std::log(x);
+		return helper2((1.0 - s_) * log_x) * log_x;
+	}
+
+	inline double h_integral_inverse(double x) const
+	{
+		double t = std::max(-1.0, x * (1.0 - s_));
+		return std::exp(helper1(t) * x);
+	}
+
+	// log(1+x)/x and (exp(x)-1)/x, accurate around 0 (exponent close to 1)
+	static inline double helper1(double x)
+	{
+		return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x*(0.5 - x*(1.0/3.0 - 0.25*x));
+	}
+
+	static inline double helper2(double x)
+	{
+		return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x*0.5*(1.0 + x/3.0*(1.0 + 0.25*x));
+	}
+
+	const Scenario_config& config_;
+	std::size_t next_;
+	std::size_t step_;
+	double s_, n_;
+	double h_x1_, h_n_, threshold_;
+};
+
+/****************************
+ * 	Cacheline allocator 	*
+ ****************************/
+// std::allocator only guarantees the alignment of max_align_t before C++17,
+// the elements of a vector of cacheline aligned types need this one
+template< class T >
+struct Cacheline_allocator
+{
+	typedef T value_type;
+
+	Cacheline_allocator() {}
+	template< class U > Cacheline_allocator(const Cacheline_allocator<U>&) {}
+
+	T* allocate(std::size_t n)
+	{
+		void* p;
+		if(posix_memalign(&p, 64, n * sizeof(T)) != 0)
+			throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, std::size_t) { std::free(p); }
+};
+
+template< class T, class U >
+inline bool operator==(const Cacheline_allocator<T>&, const Cacheline_allocator<U>&) { return true; }
+template< class T, class U >
+inline bool operator!=(const Cacheline_allocator<T>&, const Cacheline_allocator<U>&) { return false; }
+
+/****************************
+ * 		   Progress 		*
+ ****************************/
+class Progress
+{
+public:
+	struct Sample
+	{
+		double time;			// seconds since start()
+		std::uint64_t pushes;
+		std::uint64_t pops;		// successful pops
+		std::uint64_t failed;	// pops on an empty queue
+		std::int64_t size;
+	};
+
+	/* Constructor (one counter per OpenMP thread id below nthreads) */
+	Progress(std::size_t nthreads, std::size_t initial_size)
+		: counters_(nthreads), initial_size_(initial_size), stop_(false)
+	{
+		for(std::size_t i = 0; i < nthreads; ++i)
+		{
+			counters_[i].pushes.store(0, std::memory_order_relaxed);
+			counters_[i].pops.store(0, std::memory_order_relaxed);
+			counters_[i].failed.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	~Progress() { stop(); }
+
+	inline void pushed() { increment(counters_[omp_get_thread_num()].pushes); }
+
+	inline void popped(bool success)
+	{
+		Counter& counter = counters_[omp_get_thread_num()];
+		increment(success ? counter.pops : counter.failed);
+	}
+
+	/* Starts sampling every interval_us microseconds */
+	void start(std::size_t interval_us)
+	{
+		start_ns_ = Latency_clock::monotonic_ns();
+		stop_.store(false);
+		sample();
+		sampler_ = std::thread(&Progress::run, this, interval_us);
+	}
+
+	/* Stops sampling after a last sample */
+	void stop()
+	{
+		if(!sampler_.joinable())
+			return;
+		stop_.store(true);
+		sampler_.join();
+		sample();
+	}
+
+	inline const std::vector<Sample>& samples() const { return samples_; }
+
+	/**
+	 *	sustained:	Operations and seconds between the samples at 10% and
+	 *				90% of all operations, which excludes the ramp-up of the
+	 *				threads and the tail of the slowest thread. Returns false
+	 *				if the run was too short for two samples in between.
+	 */
+	bool sustained(double& operations, double& seconds) const
+	{
+		if(samples_.empty())
+			return false;
+
+		double total = ops(samples_.back());
+		std::size_t first = 0, last = samples_.size();
+
+		while(first < samples_.size() && ops(samples_[first]) < 0.1*total) ++first;
+		while(last > 0 && ops(samples_[last-1]) > 0.9*total) --last;
+
+		if(last == 0 || first >= last - 1)
+			return false;
+
+		operations = ops(samples_[last-1]) - ops(samples_[first]);
+		seconds = samples_[last-1].time - samples_[first].time;
+		return seconds > 0;
+	}
+
+private:
+	Progress(const Progress&);
+	Progress& operator=(const Progress&);
+
+	// Only the owning thread writes, the sampler reads
+	typedef std::atomic<std::uint64_t> counter_t;
+
+	// One cacheline per thread
+	struct alignas(64) Counter
+	{
+		counter_t pushes;
+		counter_t pops;
+		counter_t failed;
+	};
+
+	static inline void increment(counter_t& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	static inline double ops(const Sample& s) { return double(s.pushes + s.pops + s.failed); }
+
+	void run(std::size_t interval_us)
+	{
+		while(!stop_.load())
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+			sample();
+		}
+	}
+
+	void sample()
+	{
+		Sample s = { 1e-9 * (Latency_clock::monotonic_ns() - start_ns_), 0, 0, 0, 0 };
+		for(std::size_t i = 0; i < counters_.size(); ++i)
+		{
+			s.pushes += counters_[i].pushes.load(std::memory_order_relaxed);
+			s.pops += counters_[i].pops.load(std::memory_order_relaxed);
+			s.failed += counters_[i].failed.load(std::memory_order_relaxed);
+		}
+		s.size = std::int64_t(initial_size_) + std::int64_t(s.pushes) - std::int64_t(s.pops);
+		samples_.push_back(s);
+	}
+
+	std::vector<Counter, Cacheline_allocator<Counter> > counters_;
+	std::size_t initial_size_;
+	std::uint64_t start_ns_;
+	std::atomic<bool> stop_;
+	std::thread sampler_;
+	std::vector<Sample> samples_;
+};
+
+/****************************
+ * 		Counting queue 		*
+ ****************************/
+// Adaptor counting the pushes and pops of the wrapped queue adaptor
+template< class queue_t >
+class Counting_queue
+{
+public:
+	Counting_queue(queue_t& queue, Progress& progress)
+		: queue_(queue), progress_(progress)
+	{}
+
+	template< class value_t >
+	inline void push(value_t val, std::size_t priority)
+	{
+		queue_.push(val, priority);
+		progress_.pushed();
+	}
+
+	template< class value_t >
+	inline bool pop(value_t& val)
+	{
+		bool success = queue_.pop(val);
+		progress_.popped(success);
+		return success;
+	}
+
+private:
+	queue_t& queue_;
+	Progress& progress_;
+};
+
+#endif // SCENARIO_HPP
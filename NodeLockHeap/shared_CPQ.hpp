@@ -0,0 +1,213 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	CPQ in a POSIX shared memory segment, hence several processes can insert
+ *	into and pop from the same queue without copying the elements through
+ *	sockets or pipes. One process creates the segment for a maximum number
+ *	of elements, the others open it by its name:
+ *
+ *		Shared_CPQ<std::size_t> queue("/work", 1 << 20);	// creator
+ *		Shared_CPQ<std::size_t> queue("/work");				// every other process
+ *
+ *	A process may open the segment while the creator is still setting it up,
+ *	the opener waits until the segment has its size and the queue is
+ *	constructed. If that takes longer than the timeout (e.g the creator
+ *	died), it throws std::runtime_error.
+ *
+ *	The segment contains a header, the CPQ object and the nodes. The nodes
+ *	are a Shared_storage, addressed by offset, so the segment may be mapped
+ *	at a different address in every process. The capacity is fixed, an insert
+ *	into a full queue throws std::length_error.
+ *
+ *	Requirements:
+ *		- the lock has to work across processes (is_process_shared), e.g
+ *		  shared_futex_lock which waits with FUTEX_WAIT instead of
+ *		  FUTEX_WAIT_PRIVATE, or one of the spin locks
+ *		- the values are copied bytewise between processes and must not
+ *		  contain pointers
+ *		- the timeline tracer (CPQ_TRACE) keeps its buffers in the memory of
+ *		  the process and is not supported
+ *
+ *	The creator removes the name of the segment when it is destroyed, the
+ *	processes which still have it mapped can continue to use it.
+ */
+
+#ifndef SHARED_CPQ_HPP
+#define SHARED_CPQ_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CPQ.hpp"
+
+#ifdef __linux__
+typedef shared_futex_lock default_shared_lock;
+#else
+typedef TATAS_lock default_shared_lock;
+#endif
+
+template< class value_t,  class lock_t = default_shared_lock,
+		  class counter_t = Bit_reversed_counter>
+class Shared_CPQ
+{
+public:
+	typedef CPQ<value_t, lock_t, counter_t, Shared_storage> queue_t;
+	typedef Node<value_t, lock_t> node_t;
+
+	static_assert(is_process_shared<lock_t>::value, "the lock does not work across processes");
+	static_assert(std::is_trivially_copyable<value_t>::value, "values are copied between processes");
+	static_assert(!CPQ_TRACE_ENABLED, "the tracer is local to a process");
+
+	/* Creates the segment name for at most max_size elements */
+	Shared_CPQ(const std::string& name, std::size_t max_size)
+		: name_(name), creator_(true), data_(0), bytes_(0)
+	{
+		// The heap grows by whole levels, the dummy node 0 included
+		std::size_t nnodes = 1;
+		while(nnodes < max_size + 1) nnodes <<= 1;
+
+		bytes_ = nodes_offset() + nnodes * sizeof(node_t);
+
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if(fd < 0)
+			throw std::runtime_error("cannot create shared memory segment '" + name + "'");
+
+		if(ftruncate(fd, bytes_) != 0)
+		{
+			close(fd);
+			shm_unlink(name.c_str());
+			throw std::runtime_error("cannot resize shared memory segment '" + name + "'");
+		}
+
+		map(fd);
+
+		Header* header = new (data_) Header;
+		header->magic = MAGIC;
+		header->bytes = bytes_;
+		new (data_ + QUEUE_OFFSET) queue_t(static_cast<void*>(data_ + nodes_offset()), nnodes);
+		header->ready.store(1, std::memory_order_release);
+	}
+
+	/* Opens the segment name created by another process */
+	explicit Shared_CPQ(const std::string& name, 
+						std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+		: name_(name), creator_(false), data_(0), bytes_(0)
+	{
+		typedef std::chrono::steady_clock clock_t;
+		clock_t::time_point deadline = clock_t::now() + timeout;
+
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if(fd < 0)
+			throw std::runtime_error("cannot open shared memory segment '" + name + "'");
+
+		// The creator resizes the segment after creating it
+		struct stat st;
+		for(;;)
+		{
+			if(fstat(fd, &st) != 0)
+			{
+				close(fd);
+				throw std::runtime_error("cannot stat shared memory segment '" + name + "'");
+			}
+			if(std::size_t(st.st_size) >= nodes_offset())
+				break;
+			if(clock_t::now() > deadline)
+			{
+				close(fd);
+				throw std::runtime_error("shared memory segment '" + name + "' is not initialized");
+			}
+			usleep(100);
+		}
+
+		bytes_ = st.st_size;
+		map(fd);
+
+		const Header& header = *reinterpret_cast<Header*>(data_);
+		while(!header.ready.load(std::memory_order_acquire))
+		{
+			if(clock_t::now() > deadline)
+			{
+				munmap(data_, bytes_);
+				throw std::runtime_error("shared memory segment '" + name + "' is not initialized");
+			}
+			do_nothing();
+		}
+
+		if(header.magic != MAGIC || header.bytes != bytes_)
+		{
+			munmap(data_, bytes_);
+			throw std::runtime_error("'" + name + "' is not a shared CPQ of this type");
+		}
+	}
+
+	~Shared_CPQ()
+	{
+		munmap(data_, bytes_);
+		if(creator_)
+			shm_unlink(name_.c_str());
+	}
+
+	inline void insert(value_t value, std::size_t priority) { queue().insert(value, priority); }
+	inline bool pop_front(value_t& value) { return queue().pop_front(value); }
+
+	inline bool empty() const { return queue().empty(); }
+	inline std::size_t size() const { return queue().size(); }
+
+	inline queue_t& queue() { return *reinterpret_cast<queue_t*>(data_ + QUEUE_OFFSET); }
+	inline const queue_t& queue() const { return *reinterpret_cast<const queue_t*>(data_ + QUEUE_OFFSET); }
+
+private:
+	Shared_CPQ(const Shared_CPQ&);
+	Shared_CPQ& operator=(const Shared_CPQ&);
+
+	struct Header
+	{
+		std::uint64_t magic;
+		std::uint64_t bytes;
+		std::atomic<int> ready;		// set once the queue is constructed
+	};
+
+	// Identifies the segment, the sizes catch most mismatches of the queue type
+	static const std::uint64_t MAGIC = 0x4350512d73686d00ull ^ sizeof(queue_t) ^ (sizeof(node_t) << 32);
+
+	// Header, queue and nodes each start on a cacheline
+	static const std::size_t QUEUE_OFFSET = (sizeof(Header) + 63) / 64 * 64;
+
+	static inline std::size_t nodes_offset()
+	{
+		return (QUEUE_OFFSET + sizeof(queue_t) + 63) / 64 * 64;
+	}
+
+	void map(int fd)
+	{
+		void* data = mmap(0, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if(data == MAP_FAILED)
+		{
+			if(creator_)
+				shm_unlink(name_.c_str());
+			throw std::runtime_error("cannot map shared memory segment '" + name_ + "'");
+		}
+		data_ = static_cast<char*>(data);
+	}
+
+	std::string name_;
+	bool creator_;
+	char* data_;
+	std::size_t bytes_;
+};
+
+#endif // SHARED_CPQ_HPP
@@ -9,15 +9,29 @@
 #include <random>
 #include <chrono>
 #include <cassert>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <sstream>
 #include <omp.h>
+#include <sys/wait.h>
 
 #include <tbb/concurrent_priority_queue.h>
 #include "CPQ.hpp"
+#include "Adaptive_CPQ.hpp"
+#include "Buffered_CPQ.hpp"
+#include "shared_CPQ.hpp"
+#include "external_PQ.hpp"
+#include "Interval_CPQ.hpp"
+#include "TopK.hpp"
+#include "bucket_queue.hpp"
 #include "locks.hpp"
+#include "trace.hpp"
 
 typedef std::size_t test_t;
 
 typedef CPQ<test_t, omp_lock, Bit_reversed_counter> CPQueue;
+typedef Bucket_queue<test_t, 256> BucketQueue;
 
 void compare_concurrent_insert_with_intel(const std::size_t test_size, const std::size_t seed, 
 										  const std::size_t nthreads);
@@ -27,6 +41,33 @@ void verify_heap_properties_insert(const std::size_t problem_size, const std::si
 								   const std::size_t nthreads);
 void verify_heap_properties_mixed(const std::size_t problem_size, const std::size_t initial_size, 
 								  const std::size_t seed, const std::size_t nthreads);
+template< class lock_t >
+void verify_lock_mixed(const std::string& name, const std::size_t problem_size, 
+					   const std::size_t initial_size, const std::size_t seed, 
+					   const std::size_t nthreads);
+void verify_mcs_nested(const std::size_t problem_size, const std::size_t nthreads);
+void verify_adaptive_lock_budget();
+void verify_adaptive_mixed(const std::size_t problem_size, const std::size_t initial_size, 
+						   const std::size_t seed, const std::size_t nthreads);
+void verify_pop_if_mixed(const std::size_t problem_size, const std::size_t initial_size, 
+						 const std::size_t seed, const std::size_t nthreads);
+void verify_pop_if_growth(const std::size_t problem_size, const std::size_t seed);
+void verify_buffered_mixed(const std::size_t problem_size, const std::size_t initial_size, 
+						   const std::size_t seed, const std::size_t nthreads);
+void verify_buffered_insert_during_refill();
+void verify_shared_queue_processes(const std::size_t problem_size, const std::size_t initial_size, 
+								   const std::size_t seed, const std::size_t nprocesses);
+void verify_shared_queue_open_timeout();
+void verify_external_mixed(const std::size_t problem_size, const std::size_t initial_size, 
+						   const std::size_t seed, const std::size_t nthreads);
+void verify_interval_mixed(const std::size_t problem_size, const std::size_t initial_size, 
+						   const std::size_t seed, const std::size_t nthreads);
+void verify_topk_concurrent(const std::size_t problem_size, const std::size_t seed,
+							const std::size_t nthreads);
+void verify_bucket_queue_mixed(const std::size_t problem_size, const std::size_t initial_size, 
+							   const std::size_t seed, const std::size_t nthreads);
+void verify_trace_record_replay(const std::size_t problem_size, const std::size_t seed,
+								const std::size_t nthreads);
 
 int main(int argc, char* argv[])
 {	
@@ -47,6 +88,33 @@ int main(int argc, char* argv[])
 	verify_heap_properties_insert(problem_size, seed, nthreads);
 	verify_heap_properties_mixed(problem_size, initial_size, seed, nthreads);
 	
+	verify_lock_mixed<ticket_lock>("ticket", problem_size, initial_size, seed, nthreads);
+	verify_lock_mixed<MCS_lock>("MCS", problem_size, initial_size, seed, nthreads);
+	verify_mcs_nested(problem_size, nthreads);
+	verify_lock_mixed<CLH_lock>("CLH", problem_size, initial_size, seed, nthreads);
+	verify_lock_mixed<tagged_lock>("tagged", problem_size, initial_size, seed, nthreads);
+	verify_lock_mixed<versioned_lock>("versioned", problem_size, initial_size, seed, nthreads);
+#ifdef __linux__
+	verify_lock_mixed<adaptive_lock<exp_backoff<> > >
+		("adaptive", problem_size, initial_size, seed, nthreads);
+	verify_adaptive_lock_budget();
+#endif
+	
+	verify_adaptive_mixed(problem_size, initial_size, seed, nthreads);
+	verify_pop_if_mixed(problem_size, initial_size, seed, nthreads);
+	verify_pop_if_growth(problem_size, seed);
+	verify_buffered_mixed(problem_size, initial_size, seed, nthreads);
+	verify_buffered_insert_during_refill();
+	verify_shared_queue_processes(problem_size, initial_size, seed, nthreads);
+	verify_shared_queue_open_timeout();
+	verify_external_mixed(problem_size, initial_size, seed, nthreads);
+	verify_interval_mixed(problem_size, initial_size, seed, nthreads);
+	
+	verify_topk_concurrent(problem_size, seed, nthreads);
+	verify_bucket_queue_mixed(problem_size, initial_size, seed, nthreads);
+	
+	verify_trace_record_replay(problem_size, seed, nthreads);
+	
 	return 0;
 }
 
@@ -148,18 +216,20 @@ bool queues_are_equal(CPQueue& queue_CPQ, tbb::concurrent_priority_queue<test_t>
 // This function verifies if the value returned by the delete routine is the
 // greatest of all the items stored in the queue.
 // This assumes the values are equal to the priorities
-bool verifies_heap_properties(CPQueue& queue)
+template< class queue_t >
+bool verifies_heap_properties(queue_t& queue)
 {
 	bool properties_verified = true;
 	
 	test_t value, previous_value;
 	
-	queue.pop_front(previous_value);
+	if (!queue.pop_front(previous_value))
+		return true;
 	
-	while(!queue.empty())
+	// The threads are done, the pops only fail once the queue is empty (the
+	// bucket queue clears its occupancy bits lazily, empty() may lag behind)
+	while(queue.pop_front(value))
 	{
-		queue.pop_front(value);
-		
 		if (value > previous_value) 
 		{
 			std::cout << previous_value << '\t' << value << std::endl;
@@ -198,21 +268,184 @@ void verify_heap_properties_insert(const std::size_t problem_size, const std::si
 		std::cout << "FAILED" << std::endl;
 }
 
+// Run a mixed workload on a queue of type queue_t and verify the heap 
+// properties afterwards
+template< class queue_t >
+bool mixed_operations_keep_heap_properties(const std::size_t problem_size, 
+										   const std::size_t initial_size,
+										   const std::size_t seed, const std::size_t nthreads)
+{
+	queue_t queue;
+	std::default_random_engine rng(seed);
+	
+	for (std::size_t i=0; i<initial_size; ++i)
+	{
+		test_t priority = rng();
+		queue.insert(priority, priority);
+	}
+	
+	#pragma omp parallel private(rng) shared(queue) num_threads(nthreads)
+	{
+		rng.seed(seed + omp_get_thread_num()+1);
+		
+		test_t priority, value;
+		
+		#pragma omp for	
+		for (std::size_t i=0; i<problem_size; ++i)
+		{
+			if (rng() % 2)
+			{
+				priority = rng();
+				queue.insert(priority, priority);
+			}
+			else
+				queue.pop_front(value);
+		} 
+	}
+	
+	return verifies_heap_properties(queue);
+}
+
 void verify_heap_properties_mixed(const std::size_t problem_size, const std::size_t initial_size,
 								  const std::size_t seed, const std::size_t nthreads)
 {
 	std::cout << "Testing PQ properties after concurrent inserts and deletes ... " << std::flush;
 	
-	CPQueue queue;
+	typedef CPQ<test_t, omp_lock, Bit_reversed_counter, Vector_storage, B_heap_layout<3> > B_heap_CPQ;
+	
+	if (mixed_operations_keep_heap_properties<CPQueue>(problem_size, initial_size, seed, nthreads) &&
+		mixed_operations_keep_heap_properties<B_heap_CPQ>(problem_size, initial_size, seed, nthreads))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+template< class lock_t >
+void verify_lock_mixed(const std::string& name, const std::size_t problem_size, 
+					   const std::size_t initial_size, const std::size_t seed, 
+					   const std::size_t nthreads)
+{
+	std::cout << "Testing PQ properties with " << name << " lock ... " << std::flush;
+	
+	typedef CPQ<test_t, lock_t, Bit_reversed_counter> queue_t;
+	
+	// Fair spin locks hand the lock to preempted threads if the machine is
+	// oversubscribed, which makes the test crawl
+	std::size_t nthreads_lock = std::min<std::size_t>(nthreads, omp_get_num_procs());
+	
+	if (mixed_operations_keep_heap_properties<queue_t>(problem_size, initial_size, seed, 
+													   nthreads_lock))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Every thread holds more MCS locks at once than its pool has queue nodes
+void verify_mcs_nested(const std::size_t problem_size, const std::size_t nthreads)
+{
+	std::cout << "Testing nested MCS locks beyond the queue node pool ... " << std::flush;
+	
+	const std::size_t nlocks = 12;
+	std::vector<MCS_lock> locks(nlocks);
+	std::size_t counter = 0;
+	
+	std::size_t nthreads_lock = std::min<std::size_t>(nthreads, omp_get_num_procs());
+	
+	#pragma omp parallel for shared(locks, counter) num_threads(nthreads_lock)
+	for (std::size_t i=0; i<problem_size / 10; ++i)
+	{
+		for (std::size_t l=0; l<nlocks; ++l)
+			locks[l].lock();
+		
+		++counter;
+		
+		for (std::size_t l=nlocks; l-- > 0; )
+			locks[l].unlock();
+	}
+	
+	if (counter == problem_size / 10)
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+#ifdef __linux__
+// The lock is held far longer than the waiter spins, the waiter parks every
+// time and the spin budget has to fall
+void verify_adaptive_lock_budget()
+{
+	std::cout << "Testing the spin budget of the adaptive lock on a long held lock ... " 
+			  << std::flush;
+	
+	adaptive_lock<exp_backoff<> > lock;
+	int initial_budget = lock.spin_budget();
+	
+	#pragma omp parallel shared(lock) num_threads(2)
+	{
+		for (int i=0; i<10; ++i)
+		{
+			if (omp_get_thread_num() == 0)
+				lock.lock();
+			
+			#pragma omp barrier
+			
+			if (omp_get_thread_num() == 0)
+			{
+				usleep(50000);
+				lock.unlock();
+			}
+			else
+			{
+				lock.lock();
+				lock.unlock();
+			}
+			
+			#pragma omp barrier
+		}
+	}
+	
+	if (lock.spin_budget() < initial_budget / 2)
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+#endif
+
+// The operations of the CPQ must not be reachable around the mode switch
+static_assert(!std::is_convertible<Adaptive_CPQ<test_t>*, CPQ<test_t>*>::value,
+			  "Adaptive_CPQ exposes its CPQ base");
+
+// Switches the mode at the end of every window of 16 operations
+struct Flipping_CPQ : public Adaptive_CPQ<test_t>
+{
+	Flipping_CPQ() : Adaptive_CPQ<test_t>(0.0, 1.0, 16) {}
+};
+
+void verify_adaptive_mixed(const std::size_t problem_size, const std::size_t initial_size,
+						   const std::size_t seed, const std::size_t nthreads)
+{
+	std::cout << "Testing adaptive PQ properties after concurrent inserts and deletes ... " 
+			  << std::flush;
+	
+	bool passed = mixed_operations_keep_heap_properties< Adaptive_CPQ<test_t> >
+					(problem_size, initial_size, seed, nthreads);
+	
+	// Mode switches in the middle of the mixed workload, no element may be 
+	// lost or duplicated
+	Flipping_CPQ queue;
 	std::default_random_engine rng(seed);
 	
+	std::size_t ninserted = initial_size;
+	std::size_t npopped = 0;
+	
 	for (std::size_t i=0; i<initial_size; ++i)
 	{
 		test_t priority = rng();
 		queue.insert(priority, priority);
 	}
 	
-	#pragma omp parallel private(rng) shared(queue) num_threads(nthreads)
+	#pragma omp parallel private(rng) shared(queue) num_threads(nthreads) \
+		reduction(+:ninserted, npopped)
 	{
 		rng.seed(seed + omp_get_thread_num()+1);
 		
@@ -225,15 +458,600 @@ void verify_heap_properties_mixed(const std::size_t problem_size, const std::siz
 			{
 				priority = rng();
 				queue.insert(priority, priority);
+				ninserted++;
+			}
+			else if (queue.pop_front(value))
+				npopped++;
+		} 
+	}
+	
+	passed &= queue.switches() >= (initial_size + problem_size) / 16 - 1;
+	passed &= queue.size() == ninserted - npopped;
+	
+	if (passed && verifies_heap_properties(queue))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Run inserts and threshold pops on a queue of type queue_t, the pops may
+// only return elements above the threshold and no element may get lost
+template< class queue_t >
+bool pop_if_keeps_heap_properties(const std::size_t problem_size, 
+								  const std::size_t initial_size,
+								  const std::size_t seed, const std::size_t nthreads)
+{
+	queue_t queue;
+	std::default_random_engine rng(seed);
+	const test_t threshold = std::default_random_engine::max() / 2;
+	
+	std::size_t ninserted = initial_size;
+	std::size_t npopped = 0;
+	bool above_threshold = true;
+	
+	for (std::size_t i=0; i<initial_size; ++i)
+	{
+		test_t priority = rng();
+		queue.insert(priority, priority);
+	}
+	
+	#pragma omp parallel private(rng) shared(queue) num_threads(nthreads) \
+		reduction(+:ninserted, npopped) reduction(&&:above_threshold)
+	{
+		rng.seed(seed + omp_get_thread_num()+1);
+		
+		test_t priority, value;
+		
+		#pragma omp for	
+		for (std::size_t i=0; i<problem_size; ++i)
+		{
+			if (rng() % 2)
+			{
+				priority = rng();
+				queue.insert(priority, priority);
+				ninserted++;
+			}
+			else if (queue.pop_front_if_priority_at_least(threshold, value))
+			{
+				above_threshold = above_threshold && value >= threshold;
+				npopped++;
+			}
+		} 
+	}
+	
+	return above_threshold && queue.size() == ninserted - npopped && 
+		   verifies_heap_properties(queue);
+}
+
+void verify_pop_if_mixed(const std::size_t problem_size, const std::size_t initial_size,
+						 const std::size_t seed, const std::size_t nthreads)
+{
+	std::cout << "Testing PQ properties after concurrent inserts and threshold pops ... " 
+			  << std::flush;
+	
+	if (pop_if_keeps_heap_properties<CPQueue>(problem_size, initial_size, seed, nthreads) &&
+		pop_if_keeps_heap_properties<Flipping_CPQ>(problem_size, initial_size, seed, nthreads))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// One thread fills an empty queue, so the heap grows many times, while the
+// others keep failing threshold pops on the root
+void verify_pop_if_growth(const std::size_t problem_size, const std::size_t seed)
+{
+	std::cout << "Testing threshold pops during the growth of the heap ... " << std::flush;
+	
+	CPQueue queue;
+	std::atomic<bool> done(false);
+	std::size_t npopped = 0;
+	
+	#pragma omp parallel shared(queue, done) num_threads(4) reduction(+:npopped)
+	{
+		test_t value;
+		
+		if (omp_get_thread_num() == 0)
+		{
+			std::default_random_engine rng(seed);
+			for (std::size_t i=0; i<problem_size; ++i)
+			{
+				test_t priority = rng();
+				queue.insert(priority, priority);
+			}
+			done.store(true);
+		}
+		else
+		{
+			while (!done.load())
+				npopped += queue.pop_front_if_priority_at_least(~test_t(0), value);
+		}
+	}
+	
+	if (npopped == 0 && queue.size() == problem_size && verifies_heap_properties(queue))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+void verify_buffered_mixed(const std::size_t problem_size, const std::size_t initial_size,
+						   const std::size_t seed, const std::size_t nthreads)
+{
+	std::cout << "Testing buffered PQ properties after concurrent inserts and deletes ... " 
+			  << std::flush;
+	
+	if (mixed_operations_keep_heap_properties< Buffered_CPQ<test_t> >
+			(problem_size, initial_size, seed, nthreads))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Holds up the next lock() of the thread which armed it until the gate opens,
+// an insert into the buffered queue stops after it chose the heap
+struct Gated_lock : public TATAS_lock
+{
+	static thread_local bool armed;
+	static std::atomic<bool> waiting;
+	static std::atomic<bool> open;
+	
+	inline void lock()
+	{
+		if (armed)
+		{
+			armed = false;
+			waiting.store(true);
+			while (!open.load()) do_nothing();
+		}
+		TATAS_lock::lock();
+	}
+};
+
+thread_local bool Gated_lock::armed = false;
+std::atomic<bool> Gated_lock::waiting(false);
+std::atomic<bool> Gated_lock::open(false);
+
+// An insert which found the buffer empty reaches the heap after a refill:
+// the buffer holds 69..100 and 80 lands in the heap, it must still come out
+// before 79
+void verify_buffered_insert_during_refill()
+{
+	std::cout << "Testing buffered PQ with an insert into the heap during a refill ... " 
+			  << std::flush;
+	
+	Buffered_CPQ<test_t, Gated_lock> queue;
+	for (test_t i=1; i<=100; ++i)
+		queue.insert(i, i);
+	
+	test_t value = 0;
+	#pragma omp parallel shared(queue, value) num_threads(2)
+	{
+		if (omp_get_thread_num() == 0)
+		{
+			Gated_lock::armed = true;
+			queue.insert(80, 80);
+		}
+		else
+		{
+			while (!Gated_lock::waiting.load()) do_nothing();
+			queue.pop_front(value);
+			Gated_lock::open.store(true);
+		}
+	}
+	
+	bool passed = value == 100 && queue.buffered() > 0;
+	std::size_t npopped = 1;
+	test_t prev = value;
+	while (queue.pop_front(value))
+	{
+		passed &= value <= prev;
+		prev = value;
+		npopped++;
+	}
+	
+	if (passed && npopped == 101)
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// External memory queue with a RAM budget far below the queue size
+struct Small_External_PQ : public External_PQ<test_t>
+{
+	Small_External_PQ() : External_PQ<test_t>(64 << 10) {}
+};
+
+void verify_external_mixed(const std::size_t problem_size, const std::size_t initial_size,
+						   const std::size_t seed, const std::size_t nthreads)
+{
+	std::cout << "Testing external memory PQ properties after concurrent inserts and deletes ... " 
+			  << std::flush;
+	
+	if (mixed_operations_keep_heap_properties<Small_External_PQ>(problem_size, initial_size, 
+																 seed, nthreads))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Mixed workload of one (single threaded) process, returns (inserts, pops)
+template< class queue_t >
+std::pair<std::size_t, std::size_t> mixed_operations(queue_t& queue, const std::size_t noperations,
+													 const std::size_t seed)
+{
+	std::default_random_engine rng(seed);
+	std::size_t ninserted = 0, npopped = 0;
+	test_t priority, value;
+	
+	for (std::size_t i=0; i<noperations; ++i)
+	{
+		if (rng() % 2)
+		{
+			priority = rng();
+			queue.insert(priority, priority);
+			ninserted++;
+		}
+		else if (queue.pop_front(value))
+			npopped++;
+	}
+	
+	return std::make_pair(ninserted, npopped);
+}
+
+// The segment of a creator which died before it was set up: the opener has
+// to give up instead of waiting forever, whether the segment was resized or not
+void verify_shared_queue_open_timeout()
+{
+	std::cout << "Testing shared memory PQ opening a segment which is never set up ... " 
+			  << std::flush;
+	
+	typedef Shared_CPQ<test_t> queue_t;
+	
+	std::ostringstream name;
+	name << "/cpq_test_dead_" << getpid();
+	
+	int fd = shm_open(name.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+	{
+		std::cout << "FAILED" << std::endl;
+		return;
+	}
+	
+	bool passed = true;
+	for (int resized = 0; resized < 2; ++resized)
+	{
+		if (resized)
+			passed &= ftruncate(fd, 1 << 20) == 0;
+		
+		bool thrown = false;
+		try { queue_t queue(name.str(), std::chrono::milliseconds(100)); }
+		catch (const std::runtime_error&) { thrown = true; }
+		passed &= thrown;
+	}
+	
+	close(fd);
+	shm_unlink(name.str().c_str());
+	
+	if (passed)
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Every process opens the shared queue by its name and runs a share of a 
+// mixed workload, the counts are sent to the parent through a pipe
+void verify_shared_queue_processes(const std::size_t problem_size, const std::size_t initial_size,
+								   const std::size_t seed, const std::size_t nprocesses)
+{
+	std::cout << "Testing shared memory PQ with " << nprocesses << " processes ... " 
+			  << std::flush;
+	
+	typedef Shared_CPQ<test_t> queue_t;
+	
+	std::ostringstream name;
+	name << "/cpq_test_" << getpid();
+	
+	queue_t queue(name.str(), initial_size + problem_size);
+	std::default_random_engine rng(seed);
+	
+	for (std::size_t i=0; i<initial_size; ++i)
+	{
+		test_t priority = rng();
+		queue.insert(priority, priority);
+	}
+	
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		std::cout << "FAILED" << std::endl;
+		return;
+	}
+	
+	std::size_t noperations = problem_size / nprocesses;
+	std::vector<pid_t> children;
+	
+	for (std::size_t p=1; p<nprocesses; ++p)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(fds[0]);
+			int status = 1;
+			try
+			{
+				queue_t child_queue(name.str());
+				std::pair<std::size_t, std::size_t> counts = 
+					mixed_operations(child_queue, noperations, seed + p);
+				if (write(fds[1], &counts, sizeof(counts)) == sizeof(counts))
+					status = 0;
+			}
+			catch (const std::exception&) {}
+			_exit(status);
+		}
+		children.push_back(pid);
+	}
+	close(fds[1]);
+	
+	std::pair<std::size_t, std::size_t> counts = mixed_operations(queue, noperations, seed);
+	std::size_t ninserted = initial_size + counts.first;
+	std::size_t npopped = counts.second;
+	
+	bool passed = true;
+	while (read(fds[0], &counts, sizeof(counts)) == sizeof(counts))
+	{
+		ninserted += counts.first;
+		npopped += counts.second;
+	}
+	close(fds[0]);
+	
+	for (std::size_t p=0; p<children.size(); ++p)
+	{
+		int status;
+		passed &= waitpid(children[p], &status, 0) == children[p] && 
+				  WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	
+	// No element may be lost or duplicated
+	passed &= queue.size() == ninserted - npopped;
+	
+	if (passed && verifies_heap_properties(queue))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Concurrent inserts, pop_front and pop_back on the interval heap
+void verify_interval_mixed(const std::size_t problem_size, const std::size_t initial_size,
+						   const std::size_t seed, const std::size_t nthreads)
+{
+	std::cout << "Testing interval heap after concurrent inserts, pop_front and pop_back ... " 
+			  << std::flush;
+	
+	Interval_CPQ<test_t, TATAS_lock> queue;
+	std::default_random_engine rng(seed);
+	
+	std::size_t ninserted = initial_size;
+	std::size_t npopped = 0;
+	
+	for (std::size_t i=0; i<initial_size; ++i)
+	{
+		test_t priority = rng();
+		queue.insert(priority, priority);
+	}
+	
+	#pragma omp parallel private(rng) shared(queue) num_threads(nthreads) \
+		reduction(+:ninserted, npopped)
+	{
+		rng.seed(seed + omp_get_thread_num()+1);
+		
+		test_t priority, value;
+		
+		#pragma omp for	
+		for (std::size_t i=0; i<problem_size; ++i)
+		{
+			switch (rng() % 4)
+			{
+				case 0:
+					npopped += queue.pop_front(value);
+					break;
+				case 1:
+					npopped += queue.pop_back(value);
+					break;
+				default:
+					priority = rng();
+					queue.insert(priority, priority);
+					ninserted++;
 			}
-			else
-				queue.pop_front(value);
 		} 
 	}
 	
-	if (verifies_heap_properties(queue))
+	// No element may be lost or duplicated
+	bool passed = (queue.size() == ninserted - npopped);
+	
+	// Draining from alternating ends gives falling fronts and rising backs
+	test_t value, front = test_t(-1), back = 0;
+	std::size_t ndrained = 0;
+	for (bool at_front = true; !queue.empty(); at_front = !at_front, ++ndrained)
+	{
+		if (at_front)
+		{
+			passed &= queue.pop_front(value) && value <= front && value >= back;
+			front = value;
+		}
+		else
+		{
+			passed &= queue.pop_back(value) && value >= back && value <= front;
+			back = value;
+		}
+	}
+	passed &= (ndrained == ninserted - npopped);
+	
+	if (passed)
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Concurrent inserts into a top-K, the result has to be the K largest of
+// all inserted priorities
+void verify_topk_concurrent(const std::size_t problem_size, const std::size_t seed,
+							const std::size_t nthreads)
+{
+	std::cout << "Testing top-K after concurrent inserts ... " << std::flush;
+	
+	const std::size_t K = 1000;
+	TopK<test_t, TATAS_lock> topk(K);
+	std::vector<test_t> stream(problem_size);
+	
+	#pragma omp parallel shared(topk, stream) num_threads(nthreads)
+	{
+		std::default_random_engine rng(seed + omp_get_thread_num());
+		
+		#pragma omp for	
+		for (std::size_t i=0; i<problem_size; ++i)
+		{
+			stream[i] = rng();
+			topk.insert(stream[i], stream[i]);
+		}
+	}
+	
+	std::sort(stream.begin(), stream.end(), std::greater<test_t>());
+	std::vector< TopK<test_t, TATAS_lock>::entry_t > top = topk.sorted();
+	
+	bool passed = top.size() == K;
+	for (std::size_t i=0; passed && i<K; ++i)
+		passed = top[i].first == stream[i];
+	
+	if (passed)
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+void verify_bucket_queue_mixed(const std::size_t problem_size, const std::size_t initial_size,
+							   const std::size_t seed, const std::size_t nthreads)
+{
+	std::cout << "Testing bucket queue properties after concurrent inserts and deletes ... " 
+			  << std::flush;
+	
+	// Small ring buffers, most levels spill into their overflow
+	BucketQueue queue(16);
+	std::default_random_engine rng(seed);
+	
+	std::size_t ninserted = initial_size;
+	std::size_t npopped = 0;
+	
+	for (std::size_t i=0; i<initial_size; ++i)
+	{
+		test_t priority = rng() % BucketQueue::levels();
+		queue.insert(priority, priority);
+	}
+	
+	#pragma omp parallel private(rng) shared(queue) num_threads(nthreads) \
+		reduction(+:ninserted, npopped)
+	{
+		rng.seed(seed + omp_get_thread_num()+1);
+		
+		test_t priority, value;
+		
+		#pragma omp for	
+		for (std::size_t i=0; i<problem_size; ++i)
+		{
+			if (rng() % 2)
+			{
+				priority = rng() % BucketQueue::levels();
+				queue.insert(priority, priority);
+				ninserted++;
+			}
+			else if (queue.pop_front(value))
+				npopped++;
+		} 
+	}
+	
+	// No element may be lost or duplicated
+	bool size_verified = (queue.size() == ninserted - npopped);
+	
+	if (size_verified && verifies_heap_properties(queue))
 		std::cout << "PASSED" << std::endl;
 	else
 		std::cout << "FAILED" << std::endl;
 }
 
+// Record a concurrent mixed workload, read the trace back and replay it
+void verify_trace_record_replay(const std::size_t problem_size, const std::size_t seed,
+								const std::size_t nthreads)
+{
+	std::cout << "Testing trace record and replay ... " << std::flush;
+	
+	CPQueue queue;
+	Recording_queue<CPQueue> recorder(queue, nthreads);
+	
+	std::size_t ninserted = 0, npops = 0, priority_sum = 0;
+	
+	#pragma omp parallel shared(recorder) num_threads(nthreads) \
+		reduction(+:ninserted, npops, priority_sum)
+	{
+		std::default_random_engine rng(seed + omp_get_thread_num()+1);
+		test_t priority, value;
+		
+		#pragma omp for	
+		for (std::size_t i=0; i<problem_size; ++i)
+		{
+			if (rng() % 2)
+			{
+				priority = rng();
+				recorder.insert(priority, priority);
+				ninserted++;
+				priority_sum += priority;
+			}
+			else
+			{
+				recorder.pop_front(value);
+				npops++;
+			}
+		} 
+	}
+	
+	char path[] = "/tmp/cpq_trace_XXXXXX";
+	int fd = mkstemp(path);
+	close(fd);
+	recorder.save(path);
+	
+	Trace_reader trace(path);
+	unlink(path);
+	
+	bool passed = trace.streams() == nthreads && trace.total_records() == problem_size;
+	
+	// Every recorded operation is replayed in stream order on a fresh queue
+	CPQueue replayed;
+	std::size_t ninserted_trace = 0, npops_trace = 0, priority_sum_trace = 0;
+	test_t value;
+	
+	for (std::size_t s=0; s<trace.streams(); ++s)
+	{
+		const Trace_record* records = trace.stream(s);
+		
+		passed &= trace.records(s) == recorder.trace().records(s);
+		passed &= trace.records(s) == 0 || records[0].delay_ns == 0;
+		
+		for (std::size_t i=0; i<trace.records(s); ++i)
+			if (records[i].op == Trace_record::INSERT)
+			{
+				replayed.insert(records[i].priority, records[i].priority);
+				ninserted_trace++;
+				priority_sum_trace += records[i].priority;
+			}
+			else
+			{
+				replayed.pop_front(value);
+				npops_trace++;
+			}
+	}
+	
+	passed &= ninserted_trace == ninserted && npops_trace == npops && 
+			  priority_sum_trace == priority_sum;
+	
+	if (passed && verifies_heap_properties(replayed))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
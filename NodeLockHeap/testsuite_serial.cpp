@@ -9,18 +9,59 @@
 #include <cassert>
 #include <random>
 #include <chrono>
+#include <vector>
+#include <deque>
+#include <set>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <tbb/concurrent_priority_queue.h>
 #include "CPQ.hpp"
+#include "bucket_queue.hpp"
+#include "external_PQ.hpp"
+#include "Buffered_CPQ.hpp"
+#include "Interval_CPQ.hpp"
+#include "TopK.hpp"
+#include "histogram.hpp"
+#include "rank_error.hpp"
+#include "scenario.hpp"
+#include "topology.hpp"
 
 typedef std::size_t test_t;
 
 typedef CPQ<test_t, omp_lock, Linear_counter> CPQueue;
+typedef Bucket_queue<test_t, 256> BucketQueue;
 
 void test_serial(const std::size_t problem_size, const std::size_t init_size, 
 				 const std::size_t seed);
+void test_serial_bucket(const std::size_t problem_size, const std::size_t init_size, 
+						const std::size_t seed);
+void test_serial_external(const std::size_t problem_size, const std::size_t init_size, 
+						  const std::size_t seed);
+void test_external_write_failure(const std::size_t init_size, const std::size_t seed);
+void test_serial_b_heap(const std::size_t problem_size, const std::size_t init_size, 
+						const std::size_t seed);
+void test_serial_buffered(const std::size_t problem_size, const std::size_t init_size, 
+						  const std::size_t seed);
+void test_serial_pop_if(const std::size_t problem_size, const std::size_t init_size, 
+						const std::size_t seed);
+void test_serial_interval(const std::size_t problem_size, const std::size_t init_size, 
+						  const std::size_t seed);
+void test_topk(const std::size_t problem_size, const std::size_t seed);
+void test_latency_histogram(const std::size_t problem_size, const std::size_t seed);
+void test_rank_error(const std::size_t problem_size, const std::size_t init_size,
+					 const std::size_t seed);
+void test_priority_generator(const std::size_t problem_size, const std::size_t seed);
+void test_topology();
 
-bool queues_are_equal(CPQueue&, tbb::concurrent_priority_queue<test_t>&);
+template< class queue_t >
+bool queues_are_equal(queue_t&, tbb::concurrent_priority_queue<test_t>&);
 
 int main(int argc, char* argv[])
 {	
@@ -31,6 +72,18 @@ int main(int argc, char* argv[])
 	std::size_t seed = std::chrono::system_clock::now().time_since_epoch().count();
 	
 	test_serial(problem_size, init_size, seed); 
+	test_serial_bucket(problem_size, init_size, seed);
+	test_serial_external(problem_size, init_size, seed);
+	test_external_write_failure(init_size, seed);
+	test_serial_b_heap(problem_size, init_size, seed);
+	test_serial_buffered(problem_size, init_size, seed);
+	test_serial_pop_if(problem_size, init_size, seed);
+	test_serial_interval(problem_size, init_size, seed);
+	test_topk(problem_size, seed);
+	test_latency_histogram(problem_size, seed);
+	test_rank_error(problem_size, init_size, seed);
+	test_priority_generator(problem_size, seed);
+	test_topology();
 	
 	return 0;
 }
@@ -80,7 +133,547 @@ void test_serial(const std::size_t problem_size, const std::size_t init_size,
 		std::cout << "FAILED" << std::endl;
 }
 
-bool queues_are_equal(CPQueue& queue_CPQ, tbb::concurrent_priority_queue<test_t>& queue_intel)
+// Perform a serial validation test of the bucket queue (mixed insert/delete)
+void test_serial_bucket(const std::size_t problem_size, const std::size_t init_size, 
+						const std::size_t seed) 
+{
+	std::cout << "Comparing serial bucket queue inserts and deletes with TBB ... " << std::flush;
+
+	// Small ring buffers, most levels spill into their overflow
+	BucketQueue queue_bucket(16);
+	tbb::concurrent_priority_queue<test_t> queue_intel;
+	
+	std::default_random_engine rng(seed);
+	
+	test_t priority;
+	
+	for(size_t i = 0; i < init_size; ++i)
+	{
+		priority = rng() % BucketQueue::levels();
+		queue_bucket.insert(priority, priority);
+		queue_intel.push(priority);
+	}
+
+	test_t value_bucket, value_intel;
+
+	for(size_t i = 0; i < problem_size; ++i)
+	{
+		if(rng() % 2)
+		{
+			queue_bucket.pop_front(value_bucket);
+			queue_intel.try_pop(value_intel);
+		}
+		else
+		{
+			priority = rng() % BucketQueue::levels();
+			queue_bucket.insert(priority, priority);
+			queue_intel.push(priority);
+		}
+	}
+	
+	// A priority beyond the levels is rejected and leaves the queue as it is
+	bool rejected = false;
+	std::size_t size = queue_bucket.size();
+	try { queue_bucket.insert(0, BucketQueue::levels()); }
+	catch(const std::out_of_range&) { rejected = true; }
+	rejected &= queue_bucket.size() == size;
+	
+	if(rejected && queues_are_equal(queue_bucket, queue_intel))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Perform a serial validation test of the external memory queue with a RAM
+// budget far below the queue size, hence most elements go through the runs
+void test_serial_external(const std::size_t problem_size, const std::size_t init_size, 
+						  const std::size_t seed) 
+{
+	std::cout << "Comparing serial external memory queue inserts and deletes with TBB ... " 
+			  << std::flush;
+
+	External_PQ<test_t> queue_external(64 << 10);
+	tbb::concurrent_priority_queue<test_t> queue_intel;
+	
+	std::default_random_engine rng(seed);
+	
+	test_t priority;
+	bool passed = true;
+	
+	for(size_t i = 0; i < init_size; ++i)
+	{
+		priority = rng();
+		queue_external.insert(priority, priority);
+		queue_intel.push(priority);
+	}
+
+	test_t value_external, value_intel;
+
+	for(size_t i = 0; i < problem_size; ++i)
+	{
+		if(rng() % 2)
+		{
+			bool popped = queue_external.pop_front(value_external);
+			passed &= popped == queue_intel.try_pop(value_intel);
+			passed &= !popped || value_external == value_intel;
+		}
+		else
+		{
+			priority = rng();
+			queue_external.insert(priority, priority);
+			queue_intel.push(priority);
+		}
+	}
+	
+	passed &= queue_external.spills() > 0 && queue_external.refills() > 0;
+	
+	if(passed && queues_are_equal(queue_external, queue_intel))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// The directory of the runs disappears, an insert whose spill fails must
+// throw and leave the queue as it was
+void test_external_write_failure(const std::size_t init_size, const std::size_t seed)
+{
+	std::cout << "Testing external memory queue inserts with failing spills ... " 
+			  << std::flush;
+	
+	char directory[] = "/tmp/cpq_test_XXXXXX";
+	if(!mkdtemp(directory))
+	{
+		std::cout << "FAILED" << std::endl;
+		return;
+	}
+	
+	External_PQ<test_t> queue_external(64 << 10, directory);
+	std::default_random_engine rng(seed);
+	
+	// Spills of the hot part raise the threshold above 0
+	for(size_t i = 0; i < init_size; ++i)
+	{
+		test_t priority = rng() % 1000 + 1;
+		queue_external.insert(priority, priority);
+	}
+	
+	bool passed = queue_external.spills() > 0;
+	rmdir(directory);
+	
+	// The elements of priority 0 go to the insertion buffer until it spills
+	std::size_t ninserted = init_size;
+	bool thrown = false;
+	for(size_t i = 0; i < init_size && !thrown; ++i)
+	{
+		try
+		{
+			queue_external.insert(0, 0);
+			++ninserted;
+		}
+		catch(const std::exception&) { thrown = true; }
+	}
+	
+	passed &= thrown && queue_external.size() == ninserted;
+	
+	// Every element which was inserted comes out again
+	test_t value;
+	std::size_t npopped = 0;
+	while(queue_external.pop_front(value))
+		++npopped;
+	passed &= npopped == ninserted;
+	
+	if(passed)
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Perform a serial validation test of the B-heap layout. Blocks of 3 levels,
+// so the heap has several rows and grows within a row.
+void test_serial_b_heap(const std::size_t problem_size, const std::size_t init_size, 
+						const std::size_t seed) 
+{
+	std::cout << "Comparing serial B-heap layout inserts and deletes with TBB ... " 
+			  << std::flush;
+
+	CPQ<test_t, omp_lock, Linear_counter, Vector_storage, B_heap_layout<3> > queue_b_heap;
+	tbb::concurrent_priority_queue<test_t> queue_intel;
+	
+	std::default_random_engine rng(seed);
+	
+	test_t priority;
+	bool passed = true;
+	
+	for(size_t i = 0; i < init_size; ++i)
+	{
+		priority = rng();
+		queue_b_heap.insert(priority, priority);
+		queue_intel.push(priority);
+	}
+
+	test_t value_b_heap, value_intel;
+
+	for(size_t i = 0; i < problem_size; ++i)
+	{
+		if(rng() % 2)
+		{
+			bool popped = queue_b_heap.pop_front(value_b_heap);
+			passed &= popped == queue_intel.try_pop(value_intel);
+			passed &= !popped || value_b_heap == value_intel;
+		}
+		else
+		{
+			priority = rng();
+			queue_b_heap.insert(priority, priority);
+			queue_intel.push(priority);
+		}
+	}
+	
+	passed &= queue_b_heap.size() == queue_intel.size();
+	
+	if(passed && queues_are_equal(queue_b_heap, queue_intel))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Perform a serial validation test of the front buffer. The priorities are
+// small, so many inserts beat the minimum of the buffer.
+void test_serial_buffered(const std::size_t problem_size, const std::size_t init_size, 
+						  const std::size_t seed) 
+{
+	std::cout << "Comparing serial buffered queue inserts and deletes with TBB ... " 
+			  << std::flush;
+
+	Buffered_CPQ<test_t> queue_buffered;
+	tbb::concurrent_priority_queue<test_t> queue_intel;
+	
+	std::default_random_engine rng(seed);
+	
+	test_t priority;
+	bool passed = true;
+	
+	for(size_t i = 0; i < init_size; ++i)
+	{
+		priority = rng() % 1024;
+		queue_buffered.insert(priority, priority);
+		queue_intel.push(priority);
+	}
+
+	test_t value_buffered, value_intel;
+
+	for(size_t i = 0; i < problem_size; ++i)
+	{
+		if(rng() % 2)
+		{
+			bool popped = queue_buffered.pop_front(value_buffered);
+			passed &= popped == queue_intel.try_pop(value_intel);
+			passed &= !popped || value_buffered == value_intel;
+		}
+		else
+		{
+			priority = rng() % 1024;
+			queue_buffered.insert(priority, priority);
+			queue_intel.push(priority);
+		}
+	}
+	
+	passed &= queue_buffered.size() == queue_intel.size();
+	
+	if(passed && queues_are_equal(queue_buffered, queue_intel))
+		std::cout << "PASSED" << std::endl;
+	else
+		std::cout << "FAILED" << std::endl;
+}
+
+// Pops only elements with an even value
+struct Is_even
+{
+	inline bool operator()(test_t value, std::size_t) const { return value % 2 == 0; }
+};
+
+// Compare conditional pops with a multiset, a failed pop must not change the queue
+void test_serial_pop_if(const std::size_t problem_size, const std::size_t init_size, 
+						const std::size_t seed) 
+{
+	std::cout << "Comparing serial conditional pops with a multiset ... " << std::flush;
+
+	CPQueue queue_CPQ;
+	std::multiset<test_t> reference;
+	
+	std::default_random_engine rng(seed);
+	
+	test_t priority, value;
+	bool passed = true;
+	
+	for(size_t i = 0; i < init_size; ++i)
+	{
+		priority = rng();
+		queue_CPQ.insert(priority, priority);
+		reference.insert(priority);
+	}
+
+	for(size_t i = 0; passed && i < problem_size; ++i)
+	{
+		bool expected, popped;
+		switch(rng() % 3)
+		{
+			case 0:
+				// Around the maximum, so about half of the pops fail
+				priority = reference.empty() ? rng() : *reference.rbegin() + rng() % 64 - 32;
+				expected = !reference.empty() && *reference.rbegin() >= priority;
+				popped = queue_CPQ.pop_front_if_priority_at_least(priority, value);
+				break;
+			case 1:
+				expected = !reference.empty() && *reference.rbegin() % 2 == 0;
+				popped = queue_CPQ.pop_if(Is_even(), value);
+				break;
+			default:
+				priority = rng();
+				queue_CPQ.insert(priority, priority);
+				reference.insert(priority);
+				continue;
+		}
+		
+		passed &= popped == expected;
+		if(popped)
+		{
+			passed &= value == *reference.rbegin();
+			reference.erase(std::prev(reference.end()));
+		}
+		passed &= queue_CPQ.size() == reference.size();
+	}
+	
+	// The rest must still be in order
+	while(passed && !reference.empty())
+	{
+		passed &= queue_CPQ.pop_front(value) && value == *reference.rbegin();
+		reference.erase(std::prev(reference.end()));
+	}
+	passed &= queue_CPQ.empty() && !queue_CPQ.pop_if(Is_even(), value);
+	
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+}
+
+// Perform a serial validation test of both ends of the interval heap
+void test_serial_interval(const std::size_t problem_size, const std::size_t init_size, 
+						  const std::size_t seed) 
+{
+	std::cout << "Comparing serial interval heap inserts, pop_front and pop_back with a multiset ... " 
+			  << std::flush;
+
+	Interval_CPQ<test_t> queue_interval;
+	std::multiset<test_t> reference;
+	
+	std::default_random_engine rng(seed);
+	
+	test_t priority, value;
+	bool passed = true;
+	
+	for(size_t i = 0; i < init_size; ++i)
+	{
+		priority = rng();
+		queue_interval.insert(priority, priority);
+		reference.insert(priority);
+	}
+
+	for(size_t i = 0; passed && i < problem_size; ++i)
+	{
+		switch(rng() % 3)
+		{
+			case 0:
+				passed &= queue_interval.pop_front(value) == !reference.empty();
+				if(!reference.empty())
+				{
+					passed &= value == *reference.rbegin();
+					reference.erase(std::prev(reference.end()));
+				}
+				break;
+			case 1:
+				passed &= queue_interval.pop_back(value) == !reference.empty();
+				if(!reference.empty())
+				{
+					passed &= value == *reference.begin();
+					reference.erase(reference.begin());
+				}
+				break;
+			default:
+				priority = rng();
+				queue_interval.insert(priority, priority);
+				reference.insert(priority);
+		}
+		passed &= queue_interval.size() == reference.size();
+	}
+	
+	// Drain from alternating ends
+	for(bool front = true; passed && !reference.empty(); front = !front)
+	{
+		if(front)
+		{
+			passed &= queue_interval.pop_front(value) && value == *reference.rbegin();
+			reference.erase(std::prev(reference.end()));
+		}
+		else
+		{
+			passed &= queue_interval.pop_back(value) && value == *reference.begin();
+			reference.erase(reference.begin());
+		}
+	}
+	passed &= queue_interval.empty() && !queue_interval.pop_back(value);
+	
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+}
+
+// Compare the top-K of a random stream with the K largest of a full sort
+void test_topk(const std::size_t problem_size, const std::size_t seed)
+{
+	std::cout << "Comparing the top-K of a stream with a sort ... " << std::flush;
+	
+	const std::size_t K = 1000;
+	TopK<test_t> topk(K);
+	std::vector<test_t> stream(problem_size);
+	
+	std::default_random_engine rng(seed);
+	std::size_t naccepted = 0;
+	
+	for(std::size_t i = 0; i < problem_size; ++i)
+	{
+		// Few distinct priorities, so there are ties with the threshold
+		stream[i] = rng() % (problem_size / 4);
+		naccepted += topk.insert(stream[i], stream[i]);
+	}
+	
+	std::sort(stream.begin(), stream.end(), std::greater<test_t>());
+	std::vector<TopK<test_t>::entry_t> top = topk.sorted();
+	
+	bool passed = top.size() == K && topk.threshold() == stream[K-1];
+	for(std::size_t i = 0; passed && i < K; ++i)
+		passed = top[i].first == stream[i] && top[i].second == stream[i];
+	
+	// Almost all elements of a random stream are rejected
+	passed &= naccepted < problem_size / 10;
+	
+	// Ties with the threshold are rejected, priority 0 fills a set which is not full
+	passed &= !topk.insert(0, topk.threshold());
+	TopK<test_t> topk_zero(2);
+	passed &= topk_zero.insert(0, 0) && topk_zero.insert(0, 0) && !topk_zero.insert(0, 0);
+	
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+}
+
+// Compare the percentiles of the latency histogram with the exact percentiles
+void test_latency_histogram(const std::size_t problem_size, const std::size_t seed)
+{
+	std::cout << "Comparing latency histogram percentiles with sorted samples ... " << std::flush;
+
+	std::default_random_engine rng(seed);
+	std::lognormal_distribution<double> dist(6.0, 1.5);
+
+	std::vector<std::uint64_t> samples(problem_size);
+	Latency_histogram hist, part1, part2;
+
+	for(std::size_t i = 0; i < problem_size; ++i)
+	{
+		samples[i] = std::uint64_t(dist(rng));
+		(i % 2 ? part1 : part2).record(samples[i]);
+	}
+
+	hist.merge(part1);
+	hist.merge(part2);
+	std::sort(samples.begin(), samples.end());
+
+	bool passed = hist.count() == problem_size && hist.max() == samples.back();
+	const double percentiles[] = {50, 99, 99.9, 100};
+
+	for(std::size_t i = 0; i < 4; ++i)
+	{
+		std::size_t rank = std::max<std::size_t>(1, std::size_t(percentiles[i] / 100 * problem_size + 0.5));
+		double exact = samples[rank - 1];
+		double approx = hist.percentile(percentiles[i]);
+
+		// The reported value lies in the bucket of the exact value
+		if(approx < exact || approx > exact * (1 + 1.0 / Latency_histogram::SUB_BUCKETS) + 1)
+		{
+			std::cout << "\nERROR: p" << percentiles[i] << " exact " << exact
+					  << " histogram " << approx << std::endl;
+			passed = false;
+		}
+	}
+
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+}
+
+// Minimal push/pop adaptors as used by the benchmarks
+struct CPQ_adaptor
+{
+	void push(test_t value, std::size_t priority) { queue.insert(value, priority); }
+	bool pop(test_t& value) { return queue.pop_front(value); }
+	CPQueue queue;
+};
+
+struct FIFO_adaptor
+{
+	void push(test_t value, std::size_t priority) { queue.push_back(value); }
+	bool pop(test_t& value)
+	{
+		if(queue.empty()) return false;
+		value = queue.front();
+		queue.pop_front();
+		return true;
+	}
+	std::deque<test_t> queue;
+};
+
+template< class adaptor_t >
+std::size_t rank_errors(const std::size_t problem_size, const std::size_t init_size,
+						const std::size_t seed, Latency_histogram& ranks)
+{
+	adaptor_t adaptor;
+	Rank_recorder recorder(1);
+	Rank_queue<adaptor_t> queue(adaptor, recorder);
+	std::default_random_engine rng(seed);
+	
+	for(std::size_t i = 0; i < init_size; ++i)
+	{
+		test_t priority = rng();
+		adaptor.push(priority, priority);
+		recorder.initial(priority);
+	}
+	
+	test_t value;
+	for(std::size_t i = 0; i < problem_size; ++i)
+	{
+		if(rng() % 2)
+		{
+			test_t priority = rng();
+			queue.push(priority, priority);
+		}
+		else
+			queue.pop(value);
+	}
+	
+	return recorder.analyze(ranks);
+}
+
+// A sequential strict priority queue has no rank error, a FIFO has
+void test_rank_error(const std::size_t problem_size, const std::size_t init_size,
+					 const std::size_t seed)
+{
+	std::cout << "Measuring the rank error of a serial CPQ and a FIFO ... " << std::flush;
+	
+	Latency_histogram ranks_CPQ, ranks_FIFO;
+	std::size_t unmatched_CPQ = rank_errors<CPQ_adaptor>(problem_size, init_size, seed, ranks_CPQ);
+	std::size_t unmatched_FIFO = rank_errors<FIFO_adaptor>(problem_size, init_size, seed, ranks_FIFO);
+	
+	bool passed = unmatched_CPQ == 0 && unmatched_FIFO == 0 &&
+				  ranks_CPQ.count() > 0 && ranks_CPQ.max() == 0 &&
+				  ranks_FIFO.count() == ranks_CPQ.count() && ranks_FIFO.max() > 0;
+	
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+}
+
+template< class queue_t >
+bool queues_are_equal(queue_t& queue_CPQ, tbb::concurrent_priority_queue<test_t>& queue_intel)
 {
 	assert(queue_CPQ.size() == queue_CPQ.size());
 	
@@ -102,3 +695,97 @@ bool queues_are_equal(CPQueue& queue_CPQ, tbb::concurrent_priority_queue<test_t>
 	}
 	return are_equal;
 }
+
+// The most frequent zipf priority must match 1/H(n,s) and the interleaved
+// increasing generators must never repeat or decrease
+void test_priority_generator(const std::size_t problem_size, const std::size_t seed)
+{
+	std::cout << "Checking the zipf and increasing priority generators ... " << std::flush;
+	
+	Scenario_config config;
+	config.distribution = Scenario_config::ZIPF;
+	config.zipf_exponent = 1.0;
+	config.zipf_keys = 1024;
+	config.disorder = 0;
+	
+	std::default_random_engine rng(seed);
+	Priority_generator zipf(config, 0, 1);
+	
+	std::size_t nsamples = 64*problem_size, top = 0;
+	for(std::size_t i = 0; i < nsamples; ++i)
+		top += zipf(rng) == config.zipf_keys - 1;
+	
+	double harmonic = 0;
+	for(std::size_t k = 1; k <= config.zipf_keys; ++k)
+		harmonic += 1.0 / k;
+	
+	bool passed = std::abs(double(top) / nsamples * harmonic - 1.0) < 0.05;
+	
+	config.distribution = Scenario_config::INCREASING;
+	Priority_generator even(config, 0, 2), odd(config, 1, 2);
+	
+	std::size_t last = even(rng);
+	for(std::size_t i = 0; i < problem_size && passed; ++i)
+	{
+		std::size_t next = (i % 2) ? even(rng) : odd(rng);
+		passed = next == last + 1;
+		last = next;
+	}
+	
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+}
+
+// Pinning orders of a fake /sys tree with 2 sockets x 2 cores x 2 SMT threads,
+// numbered like Linux does (the second SMT siblings are cpus 4-7)
+void test_topology()
+{
+	std::cout << "Checking the pinning orders of a 2x2x2 topology ... " << std::flush;
+	
+	char root[] = "/tmp/cpq_topologyXXXXXX";
+	bool passed = mkdtemp(root) != 0;
+	std::vector<std::string> files, dirs;
+	
+	if(passed)
+	{
+		files.push_back(std::string(root) + "/online");
+		std::ofstream(files.back().c_str()) << "0-7\n";
+		
+		for(int cpu = 0; cpu < 8; ++cpu)
+		{
+			std::ostringstream dir;
+			dir << root << "/cpu" << cpu;
+			dirs.push_back(dir.str());
+			dirs.push_back(dir.str() + "/topology");
+			mkdir(dirs[dirs.size()-2].c_str(), 0700);
+			mkdir(dirs.back().c_str(), 0700);
+			
+			files.push_back(dirs.back() + "/physical_package_id");
+			std::ofstream(files.back().c_str()) << (cpu % 4) / 2 << "\n";
+			files.push_back(dirs.back() + "/core_id");
+			std::ofstream(files.back().c_str()) << 4 * (cpu % 2) << "\n";
+		}
+		
+		Topology topology(root, false);
+		
+		int compact[] = {0, 1, 2, 3, 4, 5, 6, 7};
+		int scatter[] = {0, 2, 1, 3, 4, 6, 5, 7};
+		int smt_first[] = {0, 4, 1, 5, 2, 6, 3, 7};
+		int socket_fill[] = {0, 1, 4, 5, 2, 3, 6, 7};
+		
+		passed = topology.ncpus() == 8 && topology.ncores() == 4 && topology.nsockets() == 2 &&
+				 topology.order(Topology::COMPACT) == std::vector<int>(compact, compact + 8) &&
+				 topology.order(Topology::SCATTER) == std::vector<int>(scatter, scatter + 8) &&
+				 topology.order(Topology::SMT_FIRST) == std::vector<int>(smt_first, smt_first + 8) &&
+				 topology.order(Topology::SOCKET_FILL) == std::vector<int>(socket_fill, socket_fill + 8) &&
+				 topology.order(Topology::NONE).empty() &&
+				 topology.sweep().size() == 10 && topology.sweep().back() == 16;
+	}
+	
+	for(std::size_t i = 0; i < files.size(); ++i)
+		std::remove(files[i].c_str());
+	for(std::size_t i = dirs.size(); i > 0; --i)
+		rmdir(dirs[i-1].c_str());
+	rmdir(root);
+	
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+}
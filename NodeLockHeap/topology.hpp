@@ -0,0 +1,269 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	CPU topology of the machine and thread pinning for the scaling sweeps.
+ *
+ *	Topology reads the online CPUs and their socket (physical_package_id) and
+ *	core (core_id) from /sys/devices/system/cpu. The CPUs of a core are its
+ *	SMT siblings, numbered 0, 1, ... in the order of their CPU ids. Only the
+ *	CPUs in the affinity mask of the process are used. If /sys is not
+ *	readable every CPU is treated as a core of its own on one socket.
+ *
+ *	A pinning policy orders the CPUs, thread i of a team runs on CPU i of the
+ *	order (modulo the number of CPUs when oversubscribed):
+ *
+ *		compact		the cores of socket 0, then of socket 1, ..., then the
+ *					second SMT siblings in the same order
+ *		scatter		round-robin over the sockets, SMT siblings last
+ *		smt-first	both SMT siblings of a core before the next core
+ *		socket-fill	all CPUs of a socket (SMT siblings included) before the
+ *					next socket
+ */
+
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class Topology
+{
+public:
+	enum Policy { NONE, COMPACT, SCATTER, SMT_FIRST, SOCKET_FILL };
+
+	static Policy parse_policy(const std::string& name)
+	{
+		if(name == "none")			return NONE;
+		if(name == "compact")		return COMPACT;
+		if(name == "scatter")		return SCATTER;
+		if(name == "smt-first")		return SMT_FIRST;
+		if(name == "socket-fill")	return SOCKET_FILL;
+		throw std::invalid_argument("unknown pinning policy '" + name + "'");
+	}
+
+	static const char* name(Policy policy)
+	{
+		static const char* names[] = { "none", "compact", "scatter", "smt-first", "socket-fill" };
+		return names[policy];
+	}
+
+	struct Cpu
+	{
+		int id;
+		int socket;		// index of the socket (0, 1, ...)
+		int core;		// index of the core within its socket
+		int smt;		// index of the CPU within its core
+	};
+
+	/* Reads the topology below root, restricted to the process affinity */
+	explicit Topology(const std::string& root = "/sys/devices/system/cpu",
+					  bool use_affinity = true)
+	{
+		std::vector<int> ids = parse_list(read(root + "/online"));
+		std::vector<int> allowed = use_affinity ? affinity() : ids;
+
+		// Raw (socket, core) ids of the usable CPUs
+		std::vector<std::pair<int, int> > raw;
+		for(std::size_t i = 0; i < ids.size(); ++i)
+		{
+			if(std::find(allowed.begin(), allowed.end(), ids[i]) == allowed.end())
+				continue;
+
+			std::ostringstream dir;
+			dir << root << "/cpu" << ids[i] << "/topology/";
+			std::string socket = read(dir.str() + "physical_package_id");
+			std::string core = read(dir.str() + "core_id");
+
+			Cpu cpu = { ids[i], 0, 0, 0 };
+			cpus_.push_back(cpu);
+			raw.push_back(socket.empty() || core.empty()
+				? std::make_pair(0, ids[i])
+				: std::make_pair(std::atoi(socket.c_str()), std::atoi(core.c_str())));
+		}
+
+		if(cpus_.empty())
+		{
+			unsigned n = std::max(1u, std::thread::hardware_concurrency());
+			for(unsigned i = 0; i < n; ++i)
+			{
+				Cpu cpu = { int(i), 0, 0, 0 };
+				cpus_.push_back(cpu);
+				raw.push_back(std::make_pair(0, int(i)));
+			}
+		}
+
+		number(raw);
+	}
+
+	inline const std::vector<Cpu>& cpus() const { return cpus_; }
+	inline std::size_t ncpus() const { return cpus_.size(); }
+	inline std::size_t nsockets() const { return nsockets_; }
+	inline std::size_t ncores() const { return ncores_; }
+
+	/**
+	 *	order:	CPU ids in the order the threads of a team are pinned to,
+	 *			empty for NONE.
+	 */
+	std::vector<int> order(Policy policy) const
+	{
+		std::vector<Cpu> cpus(cpus_);
+
+		switch(policy)
+		{
+			case COMPACT:		std::sort(cpus.begin(), cpus.end(), Less<&Cpu::smt, &Cpu::socket, &Cpu::core>()); break;
+			case SCATTER:		std::sort(cpus.begin(), cpus.end(), Less<&Cpu::smt, &Cpu::core, &Cpu::socket>()); break;
+			case SMT_FIRST:		std::sort(cpus.begin(), cpus.end(), Less<&Cpu::socket, &Cpu::core, &Cpu::smt>()); break;
+			case SOCKET_FILL:	std::sort(cpus.begin(), cpus.end(), Less<&Cpu::socket, &Cpu::smt, &Cpu::core>()); break;
+			default:			return std::vector<int>();
+		}
+
+		std::vector<int> ids;
+		for(std::size_t i = 0; i < cpus.size(); ++i)
+			ids.push_back(cpus[i].id);
+		return ids;
+	}
+
+	/**
+	 *	sweep:	Thread counts from 1 to all CPUs followed by 1.5x and 2x
+	 *			oversubscription.
+	 */
+	std::vector<std::size_t> sweep() const
+	{
+		std::vector<std::size_t> nthreads;
+		for(std::size_t n = 1; n <= ncpus(); ++n)
+			nthreads.push_back(n);
+		std::size_t oversubscribed[] = { ncpus() + (ncpus() + 1) / 2, 2 * ncpus() };
+		for(std::size_t i = 0; i < 2; ++i)
+			if(oversubscribed[i] > nthreads.back())
+				nthreads.push_back(oversubscribed[i]);
+		return nthreads;
+	}
+
+	void print(std::ostream& out) const
+	{
+		out << ncpus() << " cpus, " << ncores() << " cores, " << nsockets() << " sockets\n";
+		for(std::size_t i = 0; i < cpus_.size(); ++i)
+			out << "cpu " << cpus_[i].id << ": socket " << cpus_[i].socket
+				<< ", core " << cpus_[i].core << ", smt " << cpus_[i].smt << "\n";
+	}
+
+	/* Pins the calling thread to the CPU, returns false on failure */
+	static bool pin(int cpu)
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// Parses a CPU list such as "0-3,8-11,16"
+	static std::vector<int> parse_list(const std::string& list)
+	{
+		std::vector<int> ids;
+		std::istringstream ss(list);
+		std::string item;
+
+		while(std::getline(ss, item, ','))
+		{
+			if(item.empty() || item == "\n") continue;
+			std::size_t dash = item.find('-');
+			int first = std::atoi(item.c_str());
+			int last = dash == std::string::npos ? first : std::atoi(item.c_str() + dash + 1);
+			for(int id = first; id <= last; ++id)
+				ids.push_back(id);
+		}
+		return ids;
+	}
+
+private:
+	// Lexicographic order of the CPUs by the members m1, m2, m3
+	template< int Cpu::*m1, int Cpu::*m2, int Cpu::*m3 >
+	struct Less
+	{
+		bool operator()(const Cpu& a, const Cpu& b) const
+		{
+			if(a.*m1 != b.*m1) return a.*m1 < b.*m1;
+			if(a.*m2 != b.*m2) return a.*m2 < b.*m2;
+			return a.*m3 < b.*m3;
+		}
+	};
+
+	static std::string read(const std::string& path)
+	{
+		std::ifstream in(path.c_str());
+		std::string line;
+		std::getline(in, line);
+		return line;
+	}
+
+	static std::vector<int> affinity()
+	{
+		std::vector<int> ids;
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if(sched_getaffinity(0, sizeof(set), &set) == 0)
+			for(int id = 0; id < CPU_SETSIZE; ++id)
+				if(CPU_ISSET(id, &set))
+					ids.push_back(id);
+#endif
+		return ids;
+	}
+
+	// Replaces the raw (sparse) socket and core ids by dense indices
+	void number(const std::vector<std::pair<int, int> >& raw)
+	{
+		std::map<int, int> sockets;
+		std::map<std::pair<int, int>, int> cores;		// per socket
+		std::map<std::pair<int, int>, int> siblings;	// per core
+		std::vector<int> ncores_of;
+
+		for(std::size_t i = 0; i < raw.size(); ++i)
+			sockets.insert(std::make_pair(raw[i].first, 0));
+		int s = 0;
+		for(std::map<int, int>::iterator it = sockets.begin(); it != sockets.end(); ++it)
+			it->second = s++;
+
+		for(std::size_t i = 0; i < raw.size(); ++i)
+			cores.insert(std::make_pair(raw[i], 0));
+		ncores_of.assign(sockets.size(), 0);
+		for(std::map<std::pair<int, int>, int>::iterator it = cores.begin(); it != cores.end(); ++it)
+			it->second = ncores_of[sockets[it->first.first]]++;
+
+		// The CPUs are in increasing id order, so are the SMT indices
+		for(std::size_t i = 0; i < cpus_.size(); ++i)
+		{
+			cpus_[i].socket = sockets[raw[i].first];
+			cpus_[i].core = cores[raw[i]];
+			cpus_[i].smt = siblings[raw[i]]++;
+		}
+
+		nsockets_ = sockets.size();
+		ncores_ = cores.size();
+	}
+
+	std::vector<Cpu> cpus_;
+	std::size_t nsockets_;
+	std::size_t ncores_;
+};
+
+#endif // TOPOLOGY_HPP
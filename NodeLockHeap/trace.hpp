@@ -0,0 +1,303 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Binary traces of priority queue operations for record/replay benchmarks.
+ *
+ *	A trace holds one stream of records per recording thread:
+ *
+ *		Trace_header		magic "CPQTRACE", version, number of streams
+ *		Trace_stream[n]		offset (bytes from the start of the file) and
+ *							number of records of every stream
+ *		Trace_record[]		the streams, one after the other
+ *
+ *	A record is 16 bytes: the priority, the operation and the delay in ns
+ *	since the previous operation of the same thread finished (inter-arrival
+ *	time, saturated at ~4s). All fields are stored in native byte order.
+ *
+ *	Recording_queue wraps a queue with the CPQ interface and appends every
+ *	insert and pop_front to the stream of the calling OpenMP thread.
+ *	Trace_reader memory-maps a trace file.
+ */
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "histogram.hpp"
+
+/****************************
+ * 		  File format 		*
+ ****************************/
+struct Trace_header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t nstreams;
+};
+
+struct Trace_stream
+{
+	std::uint64_t offset;
+	std::uint64_t nrecords;
+};
+
+struct Trace_record
+{
+	enum Op { INSERT = 0, POP = 1 };
+
+	std::uint64_t priority;
+	std::uint32_t delay_ns;
+	std::uint32_t op;
+};
+
+static_assert(sizeof(Trace_header) == 16, "unexpected trace header layout");
+static_assert(sizeof(Trace_stream) == 16, "unexpected trace stream layout");
+static_assert(sizeof(Trace_record) == 16, "unexpected trace record layout");
+
+static const char TRACE_MAGIC[8] = {'C','P','Q','T','R','A','C','E'};
+static const std::uint32_t TRACE_VERSION = 1;
+
+/****************************
+ * 		 Trace writer 		*
+ ****************************/
+class Trace_writer
+{
+public:
+	Trace_writer(std::size_t nstreams)
+		: streams_(nstreams)
+	{}
+
+	inline std::size_t streams() const { return streams_.size(); }
+
+	// Not thread safe for the same stream
+	inline void append(std::size_t stream, const Trace_record& record)
+	{
+		streams_[stream].records.push_back(record);
+	}
+
+	inline std::size_t records(std::size_t stream) const
+	{
+		return streams_[stream].records.size();
+	}
+
+	void save(const std::string& path) const
+	{
+		std::ofstream out(path.c_str(), std::ios::binary);
+		if(!out)
+			throw std::runtime_error("cannot open trace '" + path + "' for writing");
+
+		Trace_header header;
+		std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+		header.version = TRACE_VERSION;
+		header.nstreams = streams_.size();
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::uint64_t offset = sizeof(Trace_header) + streams_.size() * sizeof(Trace_stream);
+		for(std::size_t i = 0; i < streams_.size(); ++i)
+		{
+			Trace_stream stream = { offset, streams_[i].records.size() };
+			out.write(reinterpret_cast<const char*>(&stream), sizeof(stream));
+			offset += stream.nrecords * sizeof(Trace_record);
+		}
+
+		for(std::size_t i = 0; i < streams_.size(); ++i)
+			if(!streams_[i].records.empty())
+				out.write(reinterpret_cast<const char*>(&streams_[i].records[0]),
+						  streams_[i].records.size() * sizeof(Trace_record));
+
+		if(!out)
+			throw std::runtime_error("failed to write trace '" + path + "'");
+	}
+
+private:
+	// The vectors of different threads must not share a cacheline
+	struct Stream
+	{
+		std::vector<Trace_record> records;
+		char pad[64];
+	};
+
+	std::vector<Stream> streams_;
+};
+
+/****************************
+ * 		 Trace reader 		*
+ ****************************/
+class Trace_reader
+{
+public:
+	explicit Trace_reader(const std::string& path)
+		: data_(0), size_(0)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw std::runtime_error("cannot open trace '" + path + "'");
+
+		struct stat st;
+		if(fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(Trace_header))
+		{
+			close(fd);
+			throw std::runtime_error("trace '" + path + "' is truncated");
+		}
+
+		size_ = st.st_size;
+		void* data = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if(data == MAP_FAILED)
+			throw std::runtime_error("cannot map trace '" + path + "'");
+		data_ = static_cast<const char*>(data);
+
+		if(!valid())
+		{
+			munmap(const_cast<char*>(data_), size_);
+			throw std::runtime_error("'" + path + "' is not a valid trace");
+		}
+	}
+
+	~Trace_reader() { munmap(const_cast<char*>(data_), size_); }
+
+	inline std::size_t streams() const { return header().nstreams; }
+
+	inline std::size_t records(std::size_t stream) const
+	{
+		return table()[stream].nrecords;
+	}
+
+	inline const Trace_record* stream(std::size_t stream) const
+	{
+		return reinterpret_cast<const Trace_record*>(data_ + table()[stream].offset);
+	}
+
+	std::size_t total_records() const
+	{
+		std::size_t total = 0;
+		for(std::size_t i = 0; i < streams(); ++i)
+			total += records(i);
+		return total;
+	}
+
+private:
+	Trace_reader(const Trace_reader&);
+	Trace_reader& operator=(const Trace_reader&);
+
+	inline const Trace_header& header() const
+	{
+		return *reinterpret_cast<const Trace_header*>(data_);
+	}
+
+	inline const Trace_stream* table() const
+	{
+		return reinterpret_cast<const Trace_stream*>(data_ + sizeof(Trace_header));
+	}
+
+	bool valid() const
+	{
+		if(std::memcmp(header().magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+		   header().version != TRACE_VERSION)
+			return false;
+
+		std::size_t table_end = sizeof(Trace_header) + streams() * sizeof(Trace_stream);
+		if(table_end > size_)
+			return false;
+
+		for(std::size_t i = 0; i < streams(); ++i)
+		{
+			const Trace_stream& s = table()[i];
+			if(s.offset % sizeof(Trace_record) != 0 || s.offset < table_end ||
+			   s.nrecords > (size_ - s.offset) / sizeof(Trace_record))
+				return false;
+		}
+		return true;
+	}
+
+	const char* data_;
+	std::size_t size_;
+};
+
+/****************************
+ * 		Recording queue 	*
+ ****************************/
+template< class queue_t >
+class Recording_queue
+{
+public:
+	/* Constructor (one stream per OpenMP thread id below nthreads) */
+	Recording_queue(queue_t& queue, std::size_t nthreads)
+		: queue_(queue), writer_(nthreads), last_(nthreads)
+	{
+		for(std::size_t i = 0; i < nthreads; ++i)
+			last_[i].ns = 0;
+	}
+
+	template< class value_t >
+	inline void insert(value_t value, std::size_t priority)
+	{
+		std::size_t tid = begin(Trace_record::INSERT, priority);
+		queue_.insert(value, priority);
+		end(tid);
+	}
+
+	template< class value_t >
+	inline bool pop_front(value_t& value)
+	{
+		std::size_t tid = begin(Trace_record::POP, 0);
+		bool success = queue_.pop_front(value);
+		end(tid);
+		return success;
+	}
+
+	inline bool empty() const { return queue_.empty(); }
+	inline std::size_t size() const { return queue_.size(); }
+
+	inline const Trace_writer& trace() const { return writer_; }
+	inline void save(const std::string& path) const { writer_.save(path); }
+
+private:
+	inline std::size_t begin(Trace_record::Op op, std::size_t priority)
+	{
+		std::size_t tid = omp_get_thread_num();
+		std::uint64_t now = Latency_clock::monotonic_ns();
+
+		Trace_record record;
+		record.priority = priority;
+		record.op = op;
+
+		std::uint64_t delay = last_[tid].ns ? now - last_[tid].ns : 0;
+		record.delay_ns = delay > 0xffffffffull ? 0xffffffffu : std::uint32_t(delay);
+
+		writer_.append(tid, record);
+		return tid;
+	}
+
+	inline void end(std::size_t tid)
+	{
+		last_[tid].ns = Latency_clock::monotonic_ns();
+	}
+
+	struct Last
+	{
+		std::uint64_t ns;
+		char pad[56];
+	};
+
+	queue_t& queue_;
+	Trace_writer writer_;
+	std::vector<Last> last_;
+};
+
+#endif // TRACE_HPP
@@ -0,0 +1,266 @@
+/**
+ *	CPQ, version 1.0
+ * 	(c) 2015 Michel Breyer, Florian Frei, Fabian Thüring ETH Zurich
+ *
+ *	[DESCRIPTION]
+ *	Timeline tracing of the CPQ. Compiling with -DCPQ_TRACE makes every CPQ
+ *	write fixed-size events into a ring buffer per thread:
+ *
+ *		- begin and end of insert and pop_front
+ *		- waiting for heap_lock and the root lock
+ *		- acquisition and release of heap_lock and the root lock
+ *		- growth of the heap (including the drain)
+ *
+ *	A ring buffer holds the last CAPACITY events of its thread and is
+ *	allocated at the first event of the thread. After the run the buffers
+ *	are written as Chrome trace-event JSON (Timeline_writer), which can be
+ *	opened in Perfetto (ui.perfetto.dev) or chrome://tracing. Operations,
+ *	waits and growth are slices on the track of their thread, the holders of
+ *	a lock are async slices on one track per lock, so convoys on the root are
+ *	visible as a long chain of short holds next to long waits.
+ *
+ *	Without CPQ_TRACE the tracer is an empty class whose member functions do
+ *	nothing, hence the tracing compiles away completely. Times are taken
+ *	with Latency_clock.
+ */
+
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <omp.h>
+
+#include "histogram.hpp"
+
+#ifdef CPQ_TRACE
+#define CPQ_TRACE_ENABLED true
+#else
+#define CPQ_TRACE_ENABLED false
+#endif
+
+/****************************
+ * 			Events 			*
+ ****************************/
+struct Trace_event
+{
+	enum Kind { INSERT, POP, WAIT_GLOBAL, WAIT_ROOT, HOLD_GLOBAL, HOLD_ROOT, GROWTH, NKINDS };
+	enum Phase { BEGIN, END };
+
+	static const char* name(int kind)
+	{
+		static const char* names[NKINDS] =
+			{ "insert", "pop_front", "wait heap_lock", "wait root", "heap_lock", "root", "growth" };
+		return names[kind];
+	}
+
+	std::uint64_t time;
+	std::uint32_t kind;
+	std::uint32_t phase;
+};
+
+static_assert(sizeof(Trace_event) == 16, "unexpected trace event layout");
+
+/****************************
+ * 	   Timeline writer 		*
+ ****************************/
+// Writes a Chrome trace-event JSON array. Every traced run becomes a process
+// of its own, named after the run.
+class Timeline_writer
+{
+public:
+	explicit Timeline_writer(std::ostream& out)
+		: out_(out), first_(true), npids_(0)
+	{
+		out_ << "[";
+	}
+
+	~Timeline_writer() { out_ << "\n]\n"; }
+
+	int begin_process(const std::string& name)
+	{
+		int pid = npids_++;
+		separator();
+		out_ << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid
+			 << ",\"args\":{\"name\":\"" << name << "\"}}";
+		return pid;
+	}
+
+	// ph is "B"/"E" (slice of the thread) or "b"/"e" (async slice of a lock)
+	void event(int pid, int tid, const char* name, char ph, double us)
+	{
+		separator();
+		out_ << "{\"ph\":\"" << ph << "\",\"name\":\"" << name << "\",\"cat\":\"cpq\""
+			 << ",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":" << us;
+		if(ph == 'b' || ph == 'e')
+			out_ << ",\"id\":\"" << name << "\",\"args\":{\"thread\":" << tid << "}";
+		out_ << "}";
+	}
+
+private:
+	Timeline_writer(const Timeline_writer&);
+	Timeline_writer& operator=(const Timeline_writer&);
+
+	inline void separator()
+	{
+		out_ << (first_ ? "\n" : ",\n");
+		first_ = false;
+	}
+
+	std::ostream& out_;
+	bool first_;
+	int npids_;
+};
+
+/****************************
+ * 			Tracer 			*
+ ****************************/
+template< bool enabled >
+class CPQ_tracer;
+
+template<>
+class CPQ_tracer<false>
+{
+public:
+	inline void begin(Trace_event::Kind) {}
+	inline void end(Trace_event::Kind) {}
+
+	inline void wait(bool) {}
+	inline void acquired(bool) {}
+	inline void released(bool) {}
+
+	inline void write(Timeline_writer&, const std::string&, std::uint64_t = 0) const {}
+};
+
+template<>
+class CPQ_tracer<true>
+{
+public:
+	static const std::size_t CAPACITY = std::size_t(1) << 16;	// events per thread
+
+	CPQ_tracer()
+	{
+		for(std::size_t t = 0; t < MAX_THREADS; ++t)
+		{
+			buffers_[t].events = 0;
+			buffers_[t].head = 0;
+		}
+	}
+
+	~CPQ_tracer()
+	{
+		for(std::size_t t = 0; t < MAX_THREADS; ++t)
+			delete[] buffers_[t].events;
+	}
+
+	inline void begin(Trace_event::Kind kind) { record(kind, Trace_event::BEGIN); }
+	inline void end(Trace_event::Kind kind) { record(kind, Trace_event::END); }
+
+	// Only heap_lock (global) and the root lock are traced, not the interior
+	// node locks
+	inline void wait(bool global) { begin(global ? Trace_event::WAIT_GLOBAL : Trace_event::WAIT_ROOT); }
+
+	inline void acquired(bool global)
+	{
+		std::uint64_t now = Latency_clock::now();
+		record(global ? Trace_event::WAIT_GLOBAL : Trace_event::WAIT_ROOT, Trace_event::END, now);
+		record(global ? Trace_event::HOLD_GLOBAL : Trace_event::HOLD_ROOT, Trace_event::BEGIN, now);
+	}
+
+	inline void released(bool global) { end(global ? Trace_event::HOLD_GLOBAL : Trace_event::HOLD_ROOT); }
+
+	/**
+	 *	write:	Appends the events of all threads since the given time
+	 *			stamp as process name to the timeline. Must not run
+	 *			concurrently with the queue. Events whose begin was before
+	 *			since or overwritten in a full ring buffer are dropped.
+	 */
+	void write(Timeline_writer& out, const std::string& name, std::uint64_t since = 0) const
+	{
+		std::uint64_t origin = ~std::uint64_t(0);
+		for(std::size_t t = 0; t < MAX_THREADS; ++t)
+			for(std::uint64_t i = buffers_[t].first(); i < buffers_[t].head; ++i)
+				if(buffers_[t].at(i).time >= since)
+				{
+					origin = std::min(origin, buffers_[t].at(i).time);
+					break;
+				}
+
+		int pid = out.begin_process(name);
+		double us_per_tick = Latency_clock::ns_per_tick() * 1e-3;
+
+		for(std::size_t t = 0; t < MAX_THREADS; ++t)
+		{
+			const Buffer& buffer = buffers_[t];
+			if(!buffer.events) continue;
+
+			int depth = 0;
+			bool held[Trace_event::NKINDS] = {};
+
+			for(std::uint64_t i = buffer.first(); i < buffer.head; ++i)
+			{
+				const Trace_event& e = buffer.at(i);
+				if(e.time < since) continue;
+
+				bool async = e.kind == Trace_event::HOLD_GLOBAL || e.kind == Trace_event::HOLD_ROOT;
+				bool begin = e.phase == Trace_event::BEGIN;
+
+				if(async)
+				{
+					if(!begin && !held[e.kind]) continue;
+					held[e.kind] = begin;
+				}
+				else
+				{
+					if(!begin && depth == 0) continue;
+					depth += begin ? 1 : -1;
+				}
+
+				char ph = async ? (begin ? 'b' : 'e') : (begin ? 'B' : 'E');
+				out.event(pid, t, Trace_event::name(e.kind), ph, (e.time - origin) * us_per_tick);
+			}
+		}
+	}
+
+private:
+	CPQ_tracer(const CPQ_tracer&);
+	CPQ_tracer& operator=(const CPQ_tracer&);
+
+	static const std::size_t MAX_THREADS = 128;
+
+	// Only the owning thread writes its buffer, padded to whole cachelines
+	struct Buffer
+	{
+		Trace_event* events;
+		std::uint64_t head;		// number of events ever recorded
+		char pad[64 - sizeof(Trace_event*) - sizeof(std::uint64_t)];
+
+		inline std::uint64_t first() const { return head > CAPACITY ? head - CAPACITY : 0; }
+		inline const Trace_event& at(std::uint64_t i) const { return events[i & (CAPACITY - 1)]; }
+	};
+
+	inline void record(Trace_event::Kind kind, Trace_event::Phase phase)
+	{
+		record(kind, phase, Latency_clock::now());
+	}
+
+	inline void record(Trace_event::Kind kind, Trace_event::Phase phase, std::uint64_t time)
+	{
+		Buffer& buffer = buffers_[omp_get_thread_num() % MAX_THREADS];
+		if(!buffer.events)
+			buffer.events = new Trace_event[CAPACITY];
+
+		Trace_event& e = buffer.events[buffer.head++ & (CAPACITY - 1)];
+		e.time = time;
+		e.kind = kind;
+		e.phase = phase;
+	}
+
+	Buffer buffers_[MAX_THREADS];
+};
+
+typedef CPQ_tracer<CPQ_TRACE_ENABLED> CPQ_tracer_t;
+
+#endif // TRACER_HPP